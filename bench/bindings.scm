@@ -0,0 +1,60 @@
+;;; bindings.scm -- the binding's hot paths, against pcre-bench
+;;; -*- coding: utf-8 -*-
+;;;
+;;; Run from the top of the build tree, or with "make bench":
+;;;   GUILE_LOAD_PATH=src LTDL_LIBRARY_PATH=src/.libs guile bench/bindings.scm
+;;;
+;;; The cases, pattern and subjects are those of pcre-bench.c, so the
+;;; difference between the "binding" and "libpcre" lines for a case is
+;;; the cost of the binding itself: string conversion, the match
+;;; object and the offset mapping.
+
+(use-modules (ice-9 format)
+	     (guile-pcre))
+
+(include "common.scm")
+
+(define pattern "(?<key>\\w+)\\s*=\\s*(?<value>[^;]+);")
+
+(define (subject filler count tail)
+  (string-append (string-concatenate (make-list count filler)) tail))
+
+(define (bench name thunk iterations)
+  (report "binding" name "interp" iterations thunk))
+
+(define (bench-compile)
+  (let ((re (pcre-compile pattern)))
+    (bench "compile" (lambda () (pcre-compile pattern)) 20000)
+    (bench "study" (lambda () (pcre-study re 0)) 20000)
+    (report "binding" "study" "jit" 2000
+	    (lambda () (pcre-study re PCRE_STUDY_JIT_COMPILE)))))
+
+(define (bench-exec name str flags)
+  (let ((iterations (if (> (string-length str) 1000) 2000 1000000)))
+    (for-each
+     (lambda (engine study-flags)
+       (let ((re (pcre-study (pcre-compile pattern flags) study-flags)))
+	 (report "binding" name engine iterations
+		 (lambda () (pcre-exec re str)))))
+     '("interp" "jit")
+     (list 0 PCRE_STUDY_JIT_COMPILE))))
+
+;;; pcre-match? builds no match object and pcre-exec does, so the two
+;;; lines bracket the cost of the match vector; match:named adds the
+;;; name lookup on top of an existing match.
+(define (bench-match-object)
+  (let* ((str "name = value;")
+	 (re (pcre-study (pcre-compile pattern) 0))
+	 (m (pcre-exec re str)))
+    (bench "match-boolean" (lambda () (pcre-match? re str)) 1000000)
+    (bench "match-vector" (lambda () (pcre-exec re str)) 1000000)
+    (bench "match-named" (lambda () (match:named m 'value)) 1000000)))
+
+(bench-compile)
+(bench-exec "exec-short-ascii" "name = value;" 0)
+(bench-exec "exec-long-ascii"
+	    (subject "lorem ipsum dolor " 4096 "name = value;") 0)
+(bench-exec "exec-short-utf8" "näme = välue;" PCRE_UTF8)
+(bench-exec "exec-long-utf8"
+	    (subject "lörem ïpsum dólor " 4096 "näme = välue;") PCRE_UTF8)
+(bench-match-object)
@@ -0,0 +1,33 @@
+;;; common.scm -- timing and reporting shared by the benchmark scripts
+;;;
+;;; Included by the other scripts.  Every case prints one tab separated
+;;; line: suite, case, engine, iterations, ns per call and bytes
+;;; allocated per million calls -- the columns pcre-bench prints for
+;;; libpcre, so the two outputs can be joined on case and engine.
+
+(define (bytes-allocated)
+  (assq-ref (gc-stats) 'heap-total-allocated))
+
+(define (measure thunk iterations)
+  (let ((bytes (bytes-allocated))
+	(start (get-internal-real-time)))
+    (do ((i 0 (1+ i)))
+	((= i iterations))
+      (thunk))
+    (let ((ticks (- (get-internal-real-time) start)))
+      (values (/ (* ticks (/ 1e9 internal-time-units-per-second))
+		 iterations)
+	      (round (/ (* (- (bytes-allocated) bytes) 1000000)
+			iterations))))))
+
+;;; A binding built --with-pcre2 marks its suites, as pcre2-bench marks
+;;; its "libpcre2" lines, so the output of the two builds can be laid
+;;; side by side.  pcre2's versions start at 10.
+(define suite-suffix
+  (if (string-prefix? "10." (pcre-version)) "/pcre2" ""))
+
+(define (report suite name engine iterations thunk)
+  (call-with-values (lambda () (measure thunk iterations))
+    (lambda (ns bytes)
+      (format #t "~a~a\t~a\t~a\t~a\t~,1f\t~a\n"
+	      suite suite-suffix name engine iterations ns bytes))))
@@ -0,0 +1,51 @@
+;;; dfa.scm -- pcre-dfa-exec against pcre-exec, interpreted and JIT
+;;;
+;;; Run from the top of the build tree, or with "make bench":
+;;;   GUILE_LOAD_PATH=src LTDL_LIBRARY_PATH=src/.libs guile bench/dfa.scm
+;;;
+;;; Each line reports the columns described in common.scm; a call finds
+;;; every match in the subject.
+
+(use-modules (ice-9 format)
+	     (rnrs bytevectors)
+	     (guile-pcre))
+
+(include "common.scm")
+
+(define patterns
+  ;; Tokenizer-style alternations, and one that backtracks badly.
+  '(("keywords"
+     "\\b(?:if|then|else|elsif|end|while|for|foreach|do|return|break)\\b")
+    ("tokens"
+     "[A-Za-z_]\\w*|0x[0-9a-fA-F]+|\\d+(?:\\.\\d+)?|\"(?:[^\"\\\\]|\\\\.)*\"|[-+*/=<>!]=?|[(){};,]")
+    ("nested" "(?:a|aa|aaa)*$")))
+
+;;; Subjects are bytevectors so that the repeated pcre-dfa-exec calls
+;;; match in place rather than re-encoding the subject each time.
+(define (subject name)
+  (string->utf8
+   (if (string=? name "nested")
+       (string-append (make-string 16 #\a) "b")
+       (string-concatenate
+	(make-list 200 "foreach item in list do total = total + 0x1f; end ")))))
+
+(define (run name pattern)
+  (let* ((str (subject name))
+	 (len (bytevector-length str))
+	 (iterations 200)
+	 (plain (pcre-study (pcre-compile pattern) 0))
+	 (jit (pcre-study (pcre-compile pattern) PCRE_STUDY_JIT_COMPILE))
+	 (workspace (make-pcre-dfa-workspace)))
+    (for-each
+     (lambda (engine proc)
+       (report "dfa" (format #f "~a-~a" name len) engine iterations proc))
+     '("exec" "jit" "dfa")
+     (list (lambda () (pcre-list-matches plain str))
+	   (lambda () (pcre-list-matches jit str))
+	   (lambda ()
+	     (let loop ((start 0))
+	       (let ((m (pcre-dfa-exec plain str start workspace)))
+		 (when (and m (< (match:end m) len))
+		   (loop (max (match:end m) (1+ start)))))))))))
+
+(for-each (lambda (p) (apply run p)) patterns)
@@ -0,0 +1,177 @@
+/*
+ * pcre-bench.c -- libpcre baseline for the guile-pcre benchmarks
+ *
+ * Runs the cases of bindings.scm against libpcre directly, so that the
+ * time the binding adds can be told from the time spent in pcre.  Each
+ * line is tab separated: suite, case, engine, iterations, nanoseconds
+ * per call and bytes allocated per million calls, always 0 here.
+ *
+ * Built as pcre2-bench with GUILE_PCRE_PCRE2 defined, the same cases
+ * run against pcre2 by way of src/pcre2-compat.c, the layer a binding
+ * configured --with-pcre2 matches through, as suite "libpcre2".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef GUILE_PCRE_PCRE2
+#include "pcre2-compat.h"
+#define SUITE "libpcre2"
+#define free_pattern pcre2_code_free
+#else
+#include <pcre.h>
+#define SUITE "libpcre"
+#define free_pattern pcre_free
+#endif
+
+#define PATTERN "(?<key>\\w+)\\s*=\\s*(?<value>[^;]+);"
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, const char *engine, long iterations,
+		   double start)
+{
+    printf(SUITE "\t%s\t%s\t%ld\t%.1f\t0\n", name, engine, iterations,
+	   (now_ns() - start) / iterations);
+}
+
+	/* COUNT copies of FILLER followed by TAIL, in a malloc()ed
+	 * buffer. */
+static char *subject(const char *filler, int count, const char *tail)
+{
+    size_t len = strlen(filler) * count + strlen(tail);
+    char *s = malloc(len + 1);
+    char *p = s;
+    int  i;
+
+    for (i = 0; i < count; ++i) {
+	strcpy(p, filler);
+	p += strlen(filler);
+    }
+    strcpy(p, tail);
+    return s;
+}
+
+static void bench_compile(void)
+{
+    const char *error;
+    int  offset;
+    long iterations = 20000;
+    long i;
+    double start;
+    pcre *re;
+    pcre_extra *extra;
+
+    start = now_ns();
+    for (i = 0; i < iterations; ++i)
+	free_pattern(pcre_compile(PATTERN, 0, &error, &offset, NULL));
+    report("compile", "interp", iterations, start);
+
+    re = pcre_compile(PATTERN, 0, &error, &offset, NULL);
+    start = now_ns();
+    for (i = 0; i < iterations; ++i)
+	pcre_free_study(pcre_study(re, 0, &error));
+    report("study", "interp", iterations, start);
+
+    iterations /= 10;
+    start = now_ns();
+    for (i = 0; i < iterations; ++i) {
+	extra = pcre_study(re, PCRE_STUDY_JIT_COMPILE, &error);
+	pcre_free_study(extra);
+    }
+    report("study", "jit", iterations, start);
+    free_pattern(re);
+}
+
+static void bench_exec(const char *name, const char *text, int flags)
+{
+    static const char *engines[] = { "interp", "jit" };
+    const char *error;
+    int  offset;
+    int  ovector[30];
+    int  len = strlen(text);
+    long iterations = len > 1000 ? 2000 : 1000000;
+    long i;
+    int  e;
+    double start;
+    pcre *re = pcre_compile(PATTERN, flags, &error, &offset, NULL);
+
+    for (e = 0; e < 2; ++e) {
+	pcre_extra *extra = pcre_study(re, e ? PCRE_STUDY_JIT_COMPILE : 0,
+				       &error);
+
+	start = now_ns();
+	for (i = 0; i < iterations; ++i)
+	    pcre_exec(re, extra, text, len, 0, 0, ovector, 30);
+	report(name, engines[e], iterations, start);
+	pcre_free_study(extra);
+    }
+    free_pattern(re);
+}
+
+	/* The costs the binding adds per match: the match vector, here
+	 * a malloc()ed ovector, against a match with no ovector, and
+	 * looking up a named group. */
+static void bench_match_object(void)
+{
+    const char *error;
+    const char *text = "name = value;";
+    int  offset;
+    int  ovector[30];
+    int  len = strlen(text);
+    long iterations = 1000000;
+    long i;
+    double start;
+    pcre *re = pcre_compile(PATTERN, 0, &error, &offset, NULL);
+    pcre_extra *extra = pcre_study(re, 0, &error);
+
+    start = now_ns();
+    for (i = 0; i < iterations; ++i)
+	pcre_exec(re, extra, text, len, 0, 0, NULL, 0);
+    report("match-boolean", "interp", iterations, start);
+
+    start = now_ns();
+    for (i = 0; i < iterations; ++i) {
+	int *v = malloc(30 * sizeof(*v));
+
+	pcre_exec(re, extra, text, len, 0, 0, v, 30);
+	free(v);
+    }
+    report("match-vector", "interp", iterations, start);
+
+    pcre_exec(re, extra, text, len, 0, 0, ovector, 30);
+    start = now_ns();
+    for (i = 0; i < iterations; ++i) {
+	int n = pcre_get_stringnumber(re, "value");
+
+	if (ovector[2 * n] < 0)
+	    abort();
+    }
+    report("match-named", "interp", iterations, start);
+    pcre_free_study(extra);
+    free_pattern(re);
+}
+
+int main(void)
+{
+    char *long_ascii = subject("lorem ipsum dolor ", 4096, "name = value;");
+    char *long_utf8 = subject("l\xc3\xb6rem \xc3\xafpsum d\xc3\xb3lor ", 4096,
+			      "n\xc3\xa4me = v\xc3\xa4lue;");
+
+    bench_compile();
+    bench_exec("exec-short-ascii", "name = value;", 0);
+    bench_exec("exec-long-ascii", long_ascii, 0);
+    bench_exec("exec-short-utf8", "n\xc3\xa4me = v\xc3\xa4lue;", PCRE_UTF8);
+    bench_exec("exec-long-utf8", long_utf8, PCRE_UTF8);
+    bench_match_object();
+    free(long_ascii);
+    free(long_utf8);
+    return 0;
+}
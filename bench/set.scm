@@ -0,0 +1,51 @@
+;;; set.scm -- pcre-set-match over 2,000 patterns, against a loop
+;;;
+;;; Run from the top of the build tree, or with "make bench":
+;;;   GUILE_LOAD_PATH=src LTDL_LIBRARY_PATH=src/.libs guile bench/set.scm
+;;;
+;;; Each line reports the columns described in common.scm, per subject.
+;;; The patterns are log rules sharing a long prefix, so a set that
+;;; indexed them by their first bytes would try them all; "loop" tries
+;;; every pattern with pcre-match? for comparison.
+
+(use-modules (ice-9 format)
+	     (guile-pcre))
+
+(include "common.scm")
+
+(define count 2000)
+
+(define patterns
+  (map (lambda (i)
+	 (format #f "service-~4,'0d: ~a \\d+" i
+		 (if (even? i) "error" "warning")))
+       (iota count)))
+
+(define regexps (map (lambda (pattern) (make-pcre pattern)) patterns))
+
+(define set (make-pcre-set patterns))
+
+(define (subject hits)
+  (string-append
+   (string-concatenate (make-list 4 "request handled in 12 ms; "))
+   (string-concatenate
+    (map (lambda (i)
+	   (format #f "service-~4,'0d: ~a ~a; " i
+		   (if (even? i) "error" "warning") i))
+	 hits))))
+
+(for-each
+ (lambda (name hits)
+   (let ((str (subject hits)))
+     (report "set" (format #f "~a-~a" name count) "set" 20000
+	     (lambda () (pcre-set-match set str)))
+     (report "set" (format #f "~a-~a" name count) "loop" 200
+	     (lambda ()
+	       (let loop ((res regexps) (ids '()) (id 0))
+		 (if (null? res)
+		     (reverse! ids)
+		     (loop (cdr res)
+			   (if (pcre-match? (car res) str) (cons id ids) ids)
+			   (1+ id))))))))
+ '("no-hit" "two-hits")
+ '(() (17 1999)))
@@ -0,0 +1,30 @@
+;;; utf8-offsets.scm -- cost of mapping pcre byte offsets to string indices
+;;; -*- coding: utf-8 -*-
+;;;
+;;; Run from the top of the build tree, or with "make bench":
+;;;   GUILE_LOAD_PATH=src LTDL_LIBRARY_PATH=src/.libs guile bench/utf8-offsets.scm
+;;;
+;;; Each line reports the columns described in common.scm, per pcre-exec.
+
+(use-modules (ice-9 format)
+	     (guile-pcre))
+
+(include "common.scm")
+
+(define (subject unit count)
+  (string-concatenate (make-list count unit)))
+
+(define (run name unit count)
+  ;; The match sits at the very end, so every offset has to be mapped
+  ;; across the whole subject.
+  (let* ((str (string-append (subject unit count) "key=value"))
+	 (re (make-pcre "(\\w+)=(\\w+)$" PCRE_UTF8))
+	 (iterations (max 10 (quotient 2000000 (string-length str)))))
+    (report "utf8-offsets" (format #f "~a-~a" name (string-length str))
+	    "interp" iterations (lambda () (pcre-exec re str)))))
+
+(for-each (lambda (count)
+	    (run "ascii" "abcdefgh " count)
+	    (run "latin-1" "été café " count)
+	    (run "mixed-script" "abc 日本語 да " count))
+	  '(1 100 10000))
@@ -18,23 +18,260 @@
  * Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <libguile.h>
+#ifdef GUILE_PCRE_PCRE2
+#include "pcre2-compat.h"
+#else
 #include <pcre.h>
+#endif
+
+#define GUILE_PCRE_STUDY_PREFILTER 0x10000	/* not PCRE_STUDY_* bits */
+#define GUILE_PCRE_STUDY_JIT_LAZY 0x20000
+
+#define GUILE_PCRE_STUDY_JIT_FLAGS (PCRE_STUDY_JIT_COMPILE |		\
+				    PCRE_STUDY_JIT_PARTIAL_SOFT_COMPILE |	\
+				    PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE)
 
 #if !defined(ARRAY_SIZE)
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
 #endif
 
+#if defined(HAVE_SCM_I_IS_NARROW_STRING) && defined(HAVE_SCM_I_STRING_CHARS)
+#define GUILE_PCRE_NARROW_IN_PLACE 1
+#if defined(HAVE_SCM_I_STRING_WIDE_CHARS) && defined(HAVE_LIBPCRE32) && \
+    !defined(GUILE_PCRE_PCRE2)
+#define GUILE_PCRE_WIDE 1
+#endif
+#endif
+
 static scm_t_bits pcre_tag;
-static SCM match_regexp_hash_table;
+static scm_t_bits pcre_match_tag;
+static scm_t_bits pcre_set_tag;
+static scm_t_bits pcre_template_tag;
+static SCM exec_limits_fluid;
+
+#define GUILE_PCRE_ERROR_CODES 40
+
+#define GUILE_PCRE_NEWLINE_BITS (PCRE_NEWLINE_CR | PCRE_NEWLINE_LF | \
+				 PCRE_NEWLINE_CRLF | PCRE_NEWLINE_ANY | \
+				 PCRE_NEWLINE_ANYCRLF)
+#define GUILE_PCRE_BSR_BITS (PCRE_BSR_ANYCRLF | PCRE_BSR_UNICODE)
+
+enum {
+    GUILE_PCRE_MEMORY_CODE, GUILE_PCRE_MEMORY_STUDY, GUILE_PCRE_MEMORY_JIT,
+    GUILE_PCRE_MEMORY_KINDS
+};
+
+#ifdef GUILE_PCRE_WIDE
+enum {
+    GUILE_PCRE_WIDE_NONE, GUILE_PCRE_WIDE_FAILED, GUILE_PCRE_WIDE_COMPILED,
+    GUILE_PCRE_WIDE_READY
+};
+#endif
+
+struct guile_pcre_counters
+{
+    unsigned long calls;
+    unsigned long matches;
+    unsigned long no_matches;
+    unsigned long errors[GUILE_PCRE_ERROR_CODES];
+    uint64_t subject_bytes;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    unsigned long histogram[64];
+};
+
+struct guile_pcre_retired
+{
+    pcre_extra *extra;
+#ifdef GUILE_PCRE_WIDE
+    pcre32_extra *extra32;
+#endif
+    struct guile_pcre_retired *next;
+};
 
 struct guile_pcre
 {
     pcre *regexp;
     pcre_extra *extra;
+    int  study_flags;		/* as last passed to pcre-study */
+    int  shared;		/* from the cache, so not to be changed */
     SCM  pattern;
+    SCM  owner;			/* holder of REGEXP's memory, or #f */
     SCM  name_table;
+    SCM  name_alist;		/* group names and numbers, or #f */
+    int  capture_count;
+    int  utf8;			/* compiled in UTF-8 mode */
+    int  crlf_newline;		/* CRLF is a valid newline sequence */
+    int  newline;		/* the PCRE_NEWLINE_* compiled in */
+    int  bsr;			/* the PCRE_BSR_* compiled in */
+    pcre_jit_stack *jit_stack;	/* private JIT stack, or NULL for the pool */
+    int  prefilter;		/* studied with GUILE_PCRE_STUDY_PREFILTER */
+    char *literal;		/* bytes every match contains, or NULL */
+    int  literal_len;
+    int  min_length;		/* fewest bytes a match can span */
+    unsigned long prefilter_rejects;
+    unsigned long prefilter_passes;
+    int  detached_users;	/* calls matching outside Guile mode */
+    int  jit_pending;		/* JIT flags deferred by JIT_LAZY, or 0 */
+    unsigned long interpreted_calls;	/* while JIT is pending */
+    uint64_t interpreted_ns;
+    size_t jit_size;		/* JIT code added by lazy compilation */
+    struct guile_pcre_retired *retired;	/* replaced study data */
+    struct guile_pcre_counters *counters;	/* or NULL */
+    SCM  template;		/* last template compiled from a string */
+    size_t memory[GUILE_PCRE_MEMORY_KINDS];	/* as last accounted */
+#ifdef GUILE_PCRE_WIDE
+    int  wide_state;		/* of REGEXP32, one of GUILE_PCRE_WIDE_* */
+    pcre32 *regexp32;		/* for 32-bit subjects, compiled on demand */
+    pcre32_extra *extra32;
+#endif
+};
+
+struct guile_pcre_match
+{
+    SCM  subject;
+    SCM  regexp;
+    size_t base;
+    int  count;
+    int  offsets[1];
+};
+
+struct guile_pcre_set_entry
+{
+    int  first;			/* first byte, folded, or -1 */
+    int  required;		/* required byte, folded, or -1 */
+    int  min_length;		/* from pcre_study(), or -1 */
+    int  literal;		/* offset in LITERALS, or -1 */
+    int  literal_len;
+    int  window;		/* offset of the two bytes hashed */
+};
+
+struct guile_pcre_set
+{
+    SCM  regexps;		/* vector of pcre smobs */
+    int  count;
+    struct guile_pcre_set_entry *entries;
+    char *literals;
+    int  hash_mask;		/* a power of 2 less one */
+    int  *hash;
+    int  *literal_ids;
+    int  bucket[257];
+    int  *ids;
+    int  unkeyed_end;
+};
+
+struct guile_pcre_template_op
+{
+    int  group;
+    int  start;
+    int  len;
+};
+
+struct guile_pcre_template
+{
+    SCM  regexp;
+    SCM  source;
+    char *literals;
+    int  count;
+    struct guile_pcre_template_op ops[1];
+};
+
+enum {
+    REGEX_MATCH_P, REGEX_COUNT, REGEX_STRING, REGEX_START, REGEX_END,
+    REGEX_SUBSTRING, REGEX_PREFIX, REGEX_SUFFIX, REGEX_PROC_COUNT
+};
+
+static SCM regex_procs[REGEX_PROC_COUNT];
+
+struct guile_pcre_scratch
+{
+    char *subject;
+    size_t subject_size;
+    int  *ovector;
+    size_t ovector_count;
+    int  *workspace;
+    size_t workspace_count;
+    int  *ids;
+    size_t ids_count;
+    unsigned char *seen;	/* all zero between calls */
+    size_t seen_count;
+    pcre_jit_stack *jit_stack;
+    int  jit_stack_size;
+#ifdef GUILE_PCRE_WIDE
+    pcre32_jit_stack *jit_stack32;	/* the same, for 32-bit code */
+    int  jit_stack32_size;
+#endif
+    int  pooled_jit_stack;	/* ignore regexps' own stacks */
+    char *frames;		/* free pcre_stack_malloc() blocks */
+    int  frame_count;
+    size_t frame_size;
+};
+
+static pthread_key_t scratch_key;
+static int jit_stack_pool_size = 512 * 1024;
+static int blocking_threshold = 256 * 1024;
+static unsigned long detached_calls;	/* matches run outside Guile mode */
+
+static unsigned long lazy_jit_calls = 100;
+static uint64_t lazy_jit_ns = 1000000;
+static unsigned long jit_promotions;
+static size_t jit_promoted_size;
+
+static int instrumentation;
+static struct guile_pcre_counters global_counters;
+static SCM instrumented_regexps;
+
+static size_t live_memory[GUILE_PCRE_MEMORY_KINDS];
+static size_t heap_live;		/* pcre_malloc() blocks */
+static size_t frames_live;		/* pcre_stack_malloc() blocks */
+static size_t frames_pooled;		/* kept for reuse */
+
+struct guile_pcre_cache_entry
+{
+    struct guile_pcre_cache_entry *newer;
+    struct guile_pcre_cache_entry *older;
+    struct guile_pcre_cache_entry *chain;
+    unsigned long hash;
+    char *key;
+    size_t key_len;
+    int  compile_flags;
+    int  study_flags;
+    SCM  smob;
+};
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct guile_pcre_cache_entry **cache_buckets;
+static size_t cache_bucket_count;
+static struct guile_pcre_cache_entry *cache_newest;
+static struct guile_pcre_cache_entry *cache_oldest;
+static size_t cache_size;
+static size_t cache_capacity = 512;
+static unsigned long cache_hits;
+static unsigned long cache_misses;
+static unsigned long cache_evictions;
+
+struct guile_pcre_subject
+{
+    const char *bytes;
+    int  len;			/* in bytes, or characters when WIDE */
+    int  mapped;
+    int  wide;			/* BYTES holds 32-bit characters */
+    int  anchor;
+    size_t index;
 };
 
 struct name_value
@@ -43,12 +280,12 @@ struct name_value
     int value;
 };
 
-static SCM guile_pcre_compile(SCM pattern, SCM options)
+static int guile_pcre_flags(SCM options)
 {
-    SCM smob;
-    struct guile_pcre *regexp;
     int flags = 0;
 
+    if (SCM_UNBNDP(options))
+	return 0;
     if (scm_is_integer(options))
 	flags = scm_to_int(options);
     else {
@@ -57,59 +294,677 @@ static SCM guile_pcre_compile(SCM pattern, SCM options)
 	    options = scm_cdr(options);
 	}
     }
+    return flags;
+}
 
-    regexp = (struct guile_pcre *) scm_gc_malloc(sizeof(*regexp), "pcre");
+static void guile_pcre_cache_info(struct guile_pcre *regexp)
+{
+    int all_options = 0;
+    int options;
+    int newline = 0;
+    int bsr = 0;
 
-    if (regexp) {
-	int  error_code = 0;
-	const char *error_ptr = NULL;
-	int  error_offset = 0;
+    pcre_fullinfo(regexp->regexp, NULL, PCRE_INFO_CAPTURECOUNT,
+		  &regexp->capture_count);
+    pcre_fullinfo(regexp->regexp, NULL, PCRE_INFO_OPTIONS, &all_options);
+    regexp->utf8 = (all_options & PCRE_UTF8) != 0;
 
-	regexp->pattern = pattern;
-	regexp->regexp = pcre_compile2(scm_to_locale_string(pattern), flags,
-				       &error_code, &error_ptr,
-				       &error_offset, NULL);
-	if (regexp->regexp == NULL) {
-	    SCM args;
+    options = all_options & GUILE_PCRE_NEWLINE_BITS;
+    if (options == 0) {
+	pcre_config(PCRE_CONFIG_NEWLINE, &newline);
+	options = newline == 13 ? PCRE_NEWLINE_CR :
+	    newline == 10 ? PCRE_NEWLINE_LF :
+	    newline == ((13 << 8) | 10) ? PCRE_NEWLINE_CRLF :
+	    newline == -2 ? PCRE_NEWLINE_ANYCRLF :
+	    newline == -1 ? PCRE_NEWLINE_ANY : 0;
+    }
+    regexp->newline = options;
+    regexp->crlf_newline = options == PCRE_NEWLINE_ANY ||
+	options == PCRE_NEWLINE_CRLF || options == PCRE_NEWLINE_ANYCRLF;
+
+    regexp->bsr = all_options & GUILE_PCRE_BSR_BITS;
+    if (regexp->bsr == 0) {
+	pcre_config(PCRE_CONFIG_BSR, &bsr);
+	regexp->bsr = bsr ? PCRE_BSR_ANYCRLF : PCRE_BSR_UNICODE;
+    }
+}
+
+static void guile_pcre_account(struct guile_pcre *regexp, int gc)
+{
+    size_t size[GUILE_PCRE_MEMORY_KINDS];
+    pcre_extra *extra = __atomic_load_n(&regexp->extra, __ATOMIC_ACQUIRE);
+    int i;
+
+    memset(size, 0, sizeof(size));
+    pcre_fullinfo(regexp->regexp, NULL, PCRE_INFO_SIZE,
+		  &size[GUILE_PCRE_MEMORY_CODE]);
+    if (extra) {
+	pcre_fullinfo(regexp->regexp, extra, PCRE_INFO_STUDYSIZE,
+		      &size[GUILE_PCRE_MEMORY_STUDY]);
+	pcre_fullinfo(regexp->regexp, extra, PCRE_INFO_JITSIZE,
+		      &size[GUILE_PCRE_MEMORY_JIT]);
+    }
+#ifdef GUILE_PCRE_WIDE
+    if (regexp->regexp32) {
+	size_t size32 = 0;
 
-	    args = scm_cons(scm_from_latin1_string(error_ptr),
-			    scm_cons(scm_from_int(error_offset), SCM_EOL));
-	    scm_error(scm_from_latin1_symbol("make-pcre-error"),
-		      "make-pcre", "~S: offset ~S", args, SCM_BOOL_F);
+	pcre32_fullinfo(regexp->regexp32, NULL, PCRE_INFO_SIZE, &size32);
+	size[GUILE_PCRE_MEMORY_CODE] += size32;
+	if (regexp->extra32) {
+	    size32 = 0;
+	    pcre32_fullinfo(regexp->regexp32, regexp->extra32,
+			    PCRE_INFO_STUDYSIZE, &size32);
+	    size[GUILE_PCRE_MEMORY_STUDY] += size32;
+	    size32 = 0;
+	    pcre32_fullinfo(regexp->regexp32, regexp->extra32,
+			    PCRE_INFO_JITSIZE, &size32);
+	    size[GUILE_PCRE_MEMORY_JIT] += size32;
 	}
-	regexp->name_table = SCM_EOL;
     }
+#endif
+    for (i = 0; i < GUILE_PCRE_MEMORY_KINDS; ++i) {
+	if (gc && size[i] > regexp->memory[i] &&
+	    (i != GUILE_PCRE_MEMORY_CODE || scm_is_false(regexp->owner)))
+	    scm_gc_register_allocation(size[i] - regexp->memory[i]);
+	__atomic_fetch_add(&live_memory[i], size[i] - regexp->memory[i],
+			   __ATOMIC_RELAXED);
+	regexp->memory[i] = size[i];
+    }
+}
+
+static SCM guile_pcre_new(SCM pattern, pcre *code, SCM owner)
+{
+    SCM smob;
+    struct guile_pcre *regexp;
+
+    regexp = (struct guile_pcre *) scm_gc_malloc(sizeof(*regexp), "pcre");
+    regexp->pattern = pattern;
+    regexp->regexp = code;
+    regexp->owner = owner;
+    regexp->name_table = SCM_BOOL_F;
+    regexp->name_alist = SCM_BOOL_F;
+    regexp->extra = NULL;
+    regexp->study_flags = 0;
+    regexp->jit_stack = NULL;
+    regexp->prefilter = 0;
+    regexp->literal = NULL;
+    regexp->literal_len = 0;
+    regexp->min_length = 0;
+    regexp->prefilter_rejects = 0;
+    regexp->prefilter_passes = 0;
+    regexp->detached_users = 0;
+    regexp->jit_pending = 0;
+    regexp->interpreted_calls = 0;
+    regexp->interpreted_ns = 0;
+    regexp->jit_size = 0;
+    regexp->retired = NULL;
+    regexp->counters = NULL;
+    regexp->template = SCM_BOOL_F;
+    regexp->shared = 0;
+    memset(regexp->memory, 0, sizeof(regexp->memory));
+#ifdef GUILE_PCRE_WIDE
+    regexp->wide_state = GUILE_PCRE_WIDE_NONE;
+    regexp->regexp32 = NULL;
+    regexp->extra32 = NULL;
+#endif
+    guile_pcre_cache_info(regexp);
+    guile_pcre_account(regexp, 1);
 
     SCM_NEWSMOB(smob, pcre_tag, regexp);
     return smob;
 }
 
-static SCM guile_pcre_study(SCM pcre_smob, SCM options)
+static SCM guile_pcre_compile(SCM pattern, SCM options)
 {
-    struct guile_pcre *regexp;
+    int  flags = guile_pcre_flags(options);
+    int  error_code = 0;
     const char *error_ptr = NULL;
-    int flags = 0;
+    int  error_offset = 0;
+    char *cpattern = scm_to_utf8_string(pattern);
+    pcre *code;
 
-    if (scm_is_integer(options))
-	flags = scm_to_int(options);
-    else {
-	while (!scm_is_null(options)) {
-	    flags |= scm_to_int(scm_car(options));
-	    options = scm_cdr(options);
+    code = pcre_compile2(cpattern, flags, &error_code, &error_ptr,
+			 &error_offset, NULL);
+    free(cpattern);
+    if (code == NULL) {
+	SCM args;
+
+	args = scm_cons(scm_from_latin1_string(error_ptr),
+			scm_cons(scm_from_int(error_offset), SCM_EOL));
+	scm_error(scm_from_latin1_symbol("make-pcre-error"),
+		  "make-pcre", "~S: offset ~S", args, SCM_BOOL_F);
+    }
+    return guile_pcre_new(pattern, code, SCM_BOOL_F);
+}
+
+static pcre_jit_stack *guile_pcre_jit_stack(void *data);
+#ifdef GUILE_PCRE_WIDE
+static pcre32_jit_stack *guile_pcre_jit_stack32(void *data);
+#endif
+
+static pcre_extra *guile_pcre_extra(struct guile_pcre *regexp)
+{
+    if (regexp->extra == NULL) {
+	pcre_extra *extra = pcre_malloc(sizeof(*extra));
+
+	if (extra == NULL)
+	    scm_report_out_of_memory();
+	memset(extra, 0, sizeof(*extra));
+	regexp->extra = extra;
+    }
+    return regexp->extra;
+}
+
+static size_t guile_pcre_drop_char(const char *run, size_t len)
+{
+    while (len > 0 && (run[len - 1] & 0xc0) == 0x80)
+	--len;
+    return len > 0 ? len - 1 : 0;
+}
+
+static size_t guile_pcre_required_literal(const char *pattern, size_t len,
+					  char *best)
+{
+    char *run = scm_malloc(len + 1);
+    size_t run_len = 0;
+    size_t best_len = 0;
+    size_t i = 0;
+    int depth = 0;
+
+#define END_RUN()				\
+    do {					\
+	if (run_len > best_len) {		\
+	    memcpy(best, run, run_len);		\
+	    best_len = run_len;			\
+	}					\
+	run_len = 0;				\
+    } while (0)
+
+    for (i = 0; i + 1 < len; ++i)
+	if (pattern[i] == '|' ||
+	    (pattern[i] == '(' && (pattern[i + 1] == '?' ||
+				   pattern[i + 1] == '*')) ||
+	    (pattern[i] == '\\' && pattern[i + 1] == 'Q'))
+	    goto give_up;
+    if (len > 0 && pattern[len - 1] == '|')
+	goto give_up;
+
+    i = 0;
+    while (i < len) {
+	unsigned char c = pattern[i];
+
+	switch (c) {
+	case '\\':
+	    if (i + 1 >= len)
+		goto give_up;
+	    c = pattern[i + 1];
+	    if (c >= 0x80 || c == 'c' || c == 'g' || c == 'k' || c == 'N')
+		goto give_up;
+	    i += 2;
+	    if (isalnum(c)) {
+		    /* A class, assertion or coded character, with
+		     * whatever digits or braced argument it takes. */
+		END_RUN();
+		while (i < len && (isalnum((unsigned char) pattern[i]) ||
+				   pattern[i] == '{' || pattern[i] == '}'))
+		    ++i;
+	    } else if (depth == 0)
+		run[run_len++] = c;
+	    break;
+	case '[':
+	    END_RUN();
+	    ++i;
+	    if (i < len && pattern[i] == '^')
+		++i;
+	    if (i < len && pattern[i] == ']')
+		++i;
+	    while (i < len && pattern[i] != ']') {
+		if (pattern[i] == '\\')
+		    ++i;
+		else if (pattern[i] == '[' && i + 1 < len &&
+			 pattern[i + 1] == ':') {
+		    const char *end = memchr(pattern + i + 2, ']',
+					     len - i - 2);
+
+		    if (end == NULL)
+			goto give_up;
+		    i = end - pattern;
+		}
+		++i;
+	    }
+	    ++i;
+	    break;
+	case '(':
+	case ')':
+	    END_RUN();
+	    depth += c == '(' ? 1 : -1;
+	    ++i;
+	    break;
+	case '?':
+	case '*':
+	case '{':
+	    run_len = guile_pcre_drop_char(run, run_len);
+	    END_RUN();
+	    ++i;
+	    if (c == '{') {
+		const char *end = memchr(pattern + i, '}', len - i);
+
+		i = end ? (size_t) (end - pattern) + 1 : len;
+	    }
+	    break;
+	case '+':
+	case '.':
+	case '^':
+	case '$':
+	    END_RUN();
+	    ++i;
+	    break;
+	default:
+	    if (depth == 0)
+		run[run_len++] = c;
+	    ++i;
+	    break;
 	}
     }
+    END_RUN();
+#undef END_RUN
+    free(run);
+    return best_len;
+
+  give_up:
+    free(run);
+    return 0;
+}
+
+static char *guile_pcre_literal(const struct guile_pcre *regexp, int *lenp)
+{
+    int options = 0;
+    size_t len;
+    char *pattern;
+    char *best;
+    char *literal = NULL;
+
+    *lenp = 0;
+    pcre_fullinfo(regexp->regexp, NULL, PCRE_INFO_OPTIONS, &options);
+    if (options & (PCRE_CASELESS | PCRE_EXTENDED))
+	return NULL;
+    pattern = scm_to_utf8_stringn(regexp->pattern, &len);
+    best = scm_malloc(len + 1);
+    len = guile_pcre_required_literal(pattern, len, best);
+    if (len > 0) {
+	literal = scm_gc_malloc_pointerless(len, "pcre");
+	memcpy(literal, best, len);
+	*lenp = len;
+    }
+    free(best);
+    free(pattern);
+    return literal;
+}
+
+static void guile_pcre_prepare_prefilter(struct guile_pcre *regexp)
+{
+    regexp->prefilter = 1;
+    regexp->min_length = 0;
+    if (regexp->extra)
+	pcre_fullinfo(regexp->regexp, regexp->extra, PCRE_INFO_MINLENGTH,
+		      &regexp->min_length);
+    if (regexp->min_length < 0)
+	regexp->min_length = 0;
+
+    regexp->literal_len = 0;
+    regexp->literal = guile_pcre_literal(regexp, &regexp->literal_len);
+}
+
+#if !defined(HAVE_MEMMEM)
+static void *memmem(const void *haystack, size_t len,
+		    const void *needle, size_t needle_len)
+{
+    const char *p = haystack;
+    const char *end = p + len;
+
+    while (needle_len <= (size_t) (end - p) &&
+	   (p = memchr(p, *(const char *) needle,
+		       end - p - needle_len + 1)) != NULL) {
+	if (memcmp(p, needle, needle_len) == 0)
+	    return (void *) p;
+	++p;
+    }
+    return NULL;
+}
+#endif
+
+static int guile_pcre_prefilter_rejects(struct guile_pcre *regexp,
+					const char *subject, int len,
+					int start, int flags)
+{
+    int reject;
+
+    if (!regexp->prefilter || (flags & (PCRE_PARTIAL_SOFT | PCRE_PARTIAL_HARD)))
+	return 0;
+    reject = len - start < regexp->min_length;
+    if (!reject && regexp->literal_len == 1)
+	reject = memchr(subject + start, regexp->literal[0],
+			len - start) == NULL;
+    else if (!reject && regexp->literal_len > 1)
+	reject = memmem(subject + start, len - start, regexp->literal,
+			regexp->literal_len) == NULL;
+    __atomic_fetch_add(reject ? &regexp->prefilter_rejects :
+		       &regexp->prefilter_passes, 1, __ATOMIC_RELAXED);
+    return reject;
+}
+
+static void guile_pcre_retire(struct guile_pcre *regexp, pcre_extra *extra,
+			      void *extra32)
+{
+    struct guile_pcre_retired *retired;
+
+    if (extra == NULL && extra32 == NULL)
+	return;
+    retired = malloc(sizeof(*retired));
+    if (retired == NULL)
+	return;
+    retired->extra = extra;
+#ifdef GUILE_PCRE_WIDE
+    retired->extra32 = extra32;
+#endif
+    retired->next = __atomic_load_n(&regexp->retired, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&regexp->retired, &retired->next,
+					retired, 0, __ATOMIC_RELEASE,
+					__ATOMIC_RELAXED))
+	;
+}
+
+static void guile_pcre_check_unshared(const char *subr,
+				      struct guile_pcre *regexp)
+{
+    if (regexp->shared)
+	scm_error_scm(scm_from_latin1_symbol("pcre-error"),
+		      scm_from_latin1_string(subr),
+		      scm_from_latin1_string("regexp is shared and cannot be changed"),
+		      SCM_EOL, SCM_BOOL_F);
+}
+
+static SCM guile_pcre_study(SCM pcre_smob, SCM options)
+{
+    struct guile_pcre *regexp;
+    pcre_extra *old;
+    pcre_extra *extra;
+    void *old32 = NULL;
+    const char *error_ptr = NULL;
+    int flags = guile_pcre_flags(options);
+    int prefilter = flags & GUILE_PCRE_STUDY_PREFILTER;
+    int jit_lazy = 0;
+    int limits = PCRE_EXTRA_MATCH_LIMIT | PCRE_EXTRA_MATCH_LIMIT_RECURSION;
 
     scm_assert_smob_type(pcre_tag, pcre_smob);
     regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
-    regexp->extra = pcre_study(regexp->regexp, flags, &error_ptr);
+    guile_pcre_check_unshared("pcre-study", regexp);
+    if (__atomic_load_n(&regexp->detached_users, __ATOMIC_ACQUIRE) > 0)
+	scm_error_scm(scm_from_latin1_symbol("pcre-error"),
+		      scm_from_latin1_string("pcre-study"),
+		      scm_from_latin1_string("regexp in use outside Guile mode"),
+		      SCM_EOL, SCM_BOOL_F);
+	    /* With JIT_LAZY, study now and leave the JIT for later. */
+    if (flags & GUILE_PCRE_STUDY_JIT_LAZY) {
+	jit_lazy = flags & GUILE_PCRE_STUDY_JIT_FLAGS;
+	if (jit_lazy == 0)
+	    jit_lazy = PCRE_STUDY_JIT_COMPILE;
+    }
+    old = regexp->extra;
+    extra = pcre_study(regexp->regexp,
+		       flags & ~(GUILE_PCRE_STUDY_PREFILTER |
+				 GUILE_PCRE_STUDY_JIT_LAZY |
+				 (jit_lazy ? GUILE_PCRE_STUDY_JIT_FLAGS : 0)),
+		       &error_ptr);
     if (error_ptr != NULL)
 	scm_error_scm(scm_from_latin1_symbol("pcre-error"),
 		      scm_from_latin1_string("pcre-study"),
 		      scm_from_latin1_string(error_ptr),
 		      SCM_EOL, SCM_BOOL_F);
+
+	    /* Studying again keeps the limits already set, and they are
+	     * in place before the new study data is published. */
+    if (old && (old->flags & limits)) {
+	if (extra == NULL) {
+	    extra = pcre_malloc(sizeof(*extra));
+	    if (extra == NULL)
+		scm_report_out_of_memory();
+	    memset(extra, 0, sizeof(*extra));
+	}
+	extra->flags |= old->flags & limits;
+	extra->match_limit = old->match_limit;
+	extra->match_limit_recursion = old->match_limit_recursion;
+    }
+    if (extra)
+	pcre_assign_jit_stack(extra, guile_pcre_jit_stack, regexp);
+    __atomic_store_n(&regexp->extra, extra, __ATOMIC_RELEASE);
+    regexp->study_flags = flags;
+#ifdef GUILE_PCRE_WIDE
+    if (regexp->regexp32) {
+	old32 = regexp->extra32;
+	__atomic_store_n(&regexp->extra32, NULL, __ATOMIC_RELEASE);
+	__atomic_store_n(&regexp->wide_state, GUILE_PCRE_WIDE_COMPILED,
+			 __ATOMIC_RELEASE);
+    }
+#endif
+    guile_pcre_retire(regexp, old, old32);
+    __atomic_fetch_sub(&jit_promoted_size, regexp->jit_size, __ATOMIC_RELAXED);
+    regexp->jit_size = 0;
+    regexp->interpreted_calls = 0;
+    regexp->interpreted_ns = 0;
+    __atomic_store_n(&regexp->jit_pending, jit_lazy, __ATOMIC_RELEASE);
+    guile_pcre_account(regexp, 1);
+    if (prefilter)
+	guile_pcre_prepare_prefilter(regexp);
+    else
+	regexp->prefilter = 0;
     return pcre_smob;
 }
 
+static unsigned long guile_pcre_cache_hash(const char *key, size_t len,
+					   int compile_flags, int study_flags)
+{
+    unsigned long hash = 2166136261UL;	/* FNV-1a */
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+	hash = (hash ^ (unsigned char) key[i]) * 16777619UL;
+    hash = (hash ^ (unsigned int) compile_flags) * 16777619UL;
+    hash = (hash ^ (unsigned int) study_flags) * 16777619UL;
+    return hash;
+}
+
+static void guile_pcre_cache_unlink(struct guile_pcre_cache_entry *entry)
+{
+    if (entry->newer)
+	entry->newer->older = entry->older;
+    else
+	cache_newest = entry->older;
+    if (entry->older)
+	entry->older->newer = entry->newer;
+    else
+	cache_oldest = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+static void guile_pcre_cache_push(struct guile_pcre_cache_entry *entry)
+{
+    entry->older = cache_newest;
+    entry->newer = NULL;
+    if (cache_newest)
+	cache_newest->newer = entry;
+    cache_newest = entry;
+    if (cache_oldest == NULL)
+	cache_oldest = entry;
+}
+
+static struct guile_pcre_cache_entry *
+guile_pcre_cache_find(const char *key, size_t len, int compile_flags,
+		      int study_flags, unsigned long hash)
+{
+    struct guile_pcre_cache_entry *entry;
+
+    if (cache_buckets == NULL)
+	return NULL;
+    for (entry = cache_buckets[hash & (cache_bucket_count - 1)];
+	 entry; entry = entry->chain)
+	if (entry->hash == hash && entry->key_len == len &&
+	    entry->compile_flags == compile_flags &&
+	    entry->study_flags == study_flags &&
+	    memcmp(entry->key, key, len) == 0)
+	    return entry;
+    return NULL;
+}
+
+static void guile_pcre_cache_remove(struct guile_pcre_cache_entry *entry)
+{
+    struct guile_pcre_cache_entry **link;
+
+    link = &cache_buckets[entry->hash & (cache_bucket_count - 1)];
+    while (*link != entry)
+	link = &(*link)->chain;
+    *link = entry->chain;
+    guile_pcre_cache_unlink(entry);
+    --cache_size;
+}
+
+static void guile_pcre_cache_rehash(void)
+{
+    struct guile_pcre_cache_entry **buckets;
+    struct guile_pcre_cache_entry *entry;
+    size_t count = 16;
+
+    while (count < cache_capacity)
+	count <<= 1;
+    if (count == cache_bucket_count)
+	return;
+    buckets = scm_gc_malloc(count * sizeof(*buckets), "pcre cache");
+    memset(buckets, 0, count * sizeof(*buckets));
+    for (entry = cache_newest; entry; entry = entry->older) {
+	entry->chain = buckets[entry->hash & (count - 1)];
+	buckets[entry->hash & (count - 1)] = entry;
+    }
+    cache_buckets = buckets;
+    cache_bucket_count = count;
+}
+
+static void guile_pcre_cache_trim(void)
+{
+    while (cache_size > cache_capacity) {
+	guile_pcre_cache_remove(cache_oldest);
+	++cache_evictions;
+    }
+}
+
+static SCM guile_pcre_compile_cached(SCM pattern, SCM compile_options,
+				     SCM study_options)
+{
+    struct guile_pcre_cache_entry *entry;
+    int compile_flags = guile_pcre_flags(compile_options);
+    int study_flags = guile_pcre_flags(study_options);
+    unsigned long hash;
+    size_t len;
+    char *key;
+    SCM smob = SCM_BOOL_F;
+
+    scm_dynwind_begin(0);
+    key = scm_to_utf8_stringn(pattern, &len);
+    scm_dynwind_free(key);
+    hash = guile_pcre_cache_hash(key, len, compile_flags, study_flags);
+
+    scm_dynwind_begin(0);
+    scm_dynwind_pthread_mutex_lock(&cache_mutex);
+    entry = guile_pcre_cache_find(key, len, compile_flags, study_flags, hash);
+    if (entry) {
+	guile_pcre_cache_unlink(entry);
+	guile_pcre_cache_push(entry);
+	smob = entry->smob;
+	++cache_hits;
+    } else
+	++cache_misses;
+    scm_dynwind_end();
+
+    if (scm_is_false(smob)) {
+	SCM fresh = guile_pcre_study(guile_pcre_compile(pattern,
+							  scm_from_int(compile_flags)),
+				     scm_from_int(study_flags));
+
+	((struct guile_pcre *) SCM_SMOB_DATA(fresh))->shared = 1;
+
+	scm_dynwind_begin(0);
+	scm_dynwind_pthread_mutex_lock(&cache_mutex);
+	entry = guile_pcre_cache_find(key, len, compile_flags, study_flags,
+				      hash);
+	if (entry == NULL && cache_capacity > 0) {
+	    if (cache_buckets == NULL)
+		guile_pcre_cache_rehash();
+	    entry = scm_gc_malloc(sizeof(*entry), "pcre cache");
+	    entry->key = scm_gc_malloc_pointerless(len, "pcre cache");
+	    memcpy(entry->key, key, len);
+	    entry->key_len = len;
+	    entry->hash = hash;
+	    entry->compile_flags = compile_flags;
+	    entry->study_flags = study_flags;
+	    entry->smob = fresh;
+	    entry->chain = cache_buckets[hash & (cache_bucket_count - 1)];
+	    cache_buckets[hash & (cache_bucket_count - 1)] = entry;
+	    guile_pcre_cache_push(entry);
+	    ++cache_size;
+	    guile_pcre_cache_trim();
+	}
+	smob = entry ? entry->smob : fresh;
+	scm_dynwind_end();
+    }
+
+    scm_dynwind_end();
+    return smob;
+}
+
+static SCM guile_pcre_cache_stats(void)
+{
+    SCM rv;
+
+    scm_dynwind_begin(0);
+    scm_dynwind_pthread_mutex_lock(&cache_mutex);
+    rv = scm_list_5(scm_cons(scm_from_latin1_symbol("hits"),
+			     scm_from_ulong(cache_hits)),
+		    scm_cons(scm_from_latin1_symbol("misses"),
+			     scm_from_ulong(cache_misses)),
+		    scm_cons(scm_from_latin1_symbol("evictions"),
+			     scm_from_ulong(cache_evictions)),
+		    scm_cons(scm_from_latin1_symbol("size"),
+			     scm_from_size_t(cache_size)),
+		    scm_cons(scm_from_latin1_symbol("capacity"),
+			     scm_from_size_t(cache_capacity)));
+    scm_dynwind_end();
+    return rv;
+}
+
+static SCM guile_pcre_set_cache_capacity(SCM capacity)
+{
+    size_t n = scm_to_size_t(capacity);
+
+    scm_dynwind_begin(0);
+    scm_dynwind_pthread_mutex_lock(&cache_mutex);
+    cache_capacity = n;
+    guile_pcre_cache_trim();
+    if (cache_buckets)
+	guile_pcre_cache_rehash();
+    scm_dynwind_end();
+    return SCM_UNSPECIFIED;
+}
+
+static SCM guile_pcre_cache_clear(void)
+{
+    scm_dynwind_begin(0);
+    scm_dynwind_pthread_mutex_lock(&cache_mutex);
+    while (cache_oldest)
+	guile_pcre_cache_remove(cache_oldest);
+    cache_hits = cache_misses = cache_evictions = 0;
+    scm_dynwind_end();
+    return SCM_UNSPECIFIED;
+}
+
 static SCM pcre_error_to_string(int rc)
 {
     static struct name_value error_table[] = {
@@ -138,7 +993,15 @@ static SCM pcre_error_to_string(int rc)
 	{ "PCRE_ERROR_NULLWSLIMIT", PCRE_ERROR_NULLWSLIMIT },
 	{ "PCRE_ERROR_BADNEWLINE", PCRE_ERROR_BADNEWLINE },
 	{ "PCRE_ERROR_BADOFFSET", PCRE_ERROR_BADOFFSET },
-	{ "PCRE_ERROR_SHORTUTF8", PCRE_ERROR_SHORTUTF8 }
+	{ "PCRE_ERROR_SHORTUTF8", PCRE_ERROR_SHORTUTF8 },
+	{ "PCRE_ERROR_RECURSELOOP", PCRE_ERROR_RECURSELOOP },
+	{ "PCRE_ERROR_JIT_STACKLIMIT", PCRE_ERROR_JIT_STACKLIMIT },
+	{ "PCRE_ERROR_BADMODE", PCRE_ERROR_BADMODE },
+	{ "PCRE_ERROR_BADENDIANNESS", PCRE_ERROR_BADENDIANNESS },
+	{ "PCRE_ERROR_DFA_BADRESTART", PCRE_ERROR_DFA_BADRESTART },
+	{ "PCRE_ERROR_JIT_BADOPTION", PCRE_ERROR_JIT_BADOPTION },
+	{ "PCRE_ERROR_BADLENGTH", PCRE_ERROR_BADLENGTH },
+	{ "PCRE_ERROR_UNSET", PCRE_ERROR_UNSET }
     };
     char error_buffer[64];
     size_t i;
@@ -214,254 +1077,4258 @@ static SCM guile_pcre_build_name_alist(const struct guile_pcre *pcre)
     if (rc)
 	return value;
 
-    utf = guile_pcre_library_utf();
-    offset = utf == 32 ? 4 : 2;
+    utf = guile_pcre_library_utf();
+    offset = utf == 32 ? 4 : 2;
+
+    for (i = 0; i < name_count; ++i) {
+	entry_number = guile_pcre_match_entry_number(name_table, utf);
+	value = scm_cons(scm_cons(scm_from_utf8_symbol(name_table + offset),
+				  scm_from_signed_integer(entry_number)),
+			 value);
+	name_table += entry_size;
+    }
+    return value;
+}
+
+static void guile_pcre_init_subject(struct guile_pcre_subject *subject,
+				    const char *bytes, size_t len,
+				    int mapped)
+{
+    subject->bytes = bytes;
+    subject->len = (int) len;
+    subject->mapped = mapped;
+    subject->wide = 0;
+    subject->anchor = 0;
+    subject->index = 0;
+}
+
+static size_t guile_pcre_char_index(struct guile_pcre_subject *subject,
+				    int byte)
+{
+    const unsigned char *p;
+    const unsigned char *end;
+
+    if (!subject->mapped)
+	return byte;
+
+    if (byte >= subject->anchor) {
+	p = (const unsigned char *) subject->bytes + subject->anchor;
+	end = (const unsigned char *) subject->bytes + byte;
+	for (; p < end; ++p)
+	    subject->index += (*p & 0xc0) != 0x80;
+    } else {
+	p = (const unsigned char *) subject->bytes + byte;
+	end = (const unsigned char *) subject->bytes + subject->anchor;
+	for (; p < end; ++p)
+	    subject->index -= (*p & 0xc0) != 0x80;
+    }
+    subject->anchor = byte;
+    return subject->index;
+}
+
+static int guile_pcre_byte_offset(struct guile_pcre_subject *subject,
+				  size_t index)
+{
+    const unsigned char *bytes = (const unsigned char *) subject->bytes;
+    int byte = subject->anchor;
+
+    if (!subject->mapped)
+	return (int) index;
+
+    while (subject->index < index) {
+	++byte;
+	while (byte < subject->len && (bytes[byte] & 0xc0) == 0x80)
+	    ++byte;
+	++subject->index;
+    }
+    while (subject->index > index) {
+	--byte;
+	while (byte > 0 && (bytes[byte] & 0xc0) == 0x80)
+	    --byte;
+	--subject->index;
+    }
+    subject->anchor = byte;
+    return byte;
+}
+
+static struct guile_pcre_match *guile_pcre_alloc_match(SCM regexp,
+							SCM subject,
+							int match_count)
+{
+    struct guile_pcre_match *match;
+
+    match = scm_gc_malloc(sizeof(*match) + (match_count * 2 - 1) *
+			  sizeof(match->offsets[0]), "pcre-match");
+    match->subject = subject;
+    match->regexp = regexp;
+    match->base = 0;
+    match->count = match_count;
+    return match;
+}
+
+static SCM guile_pcre_make_match(SCM regexp, SCM string, const int *captures,
+				 int match_count,
+				 struct guile_pcre_subject *subject)
+{
+    struct guile_pcre_match *match;
+    int i;
+
+    match = guile_pcre_alloc_match(regexp, string, match_count);
+    for (i = 0; i < match_count * 2; i += 2) {
+	if (captures[i] < 0) {
+	    match->offsets[i] = -1;
+	    match->offsets[i + 1] = -1;
+	} else {
+	    match->offsets[i] = guile_pcre_char_index(subject, captures[i]);
+	    match->offsets[i + 1] = guile_pcre_char_index(subject,
+							  captures[i + 1]);
+	}
+    }
+    SCM_RETURN_NEWSMOB(pcre_match_tag, match);
+}
+
+static void guile_pcre_exec_error(const char *subr, int rc)
+{
+    const char *key;
+
+    switch (rc) {
+    case PCRE_ERROR_JIT_STACKLIMIT:
+	key = "pcre-jit-stack-limit";
+	break;
+    case PCRE_ERROR_MATCHLIMIT:
+	key = "pcre-match-limit";
+	break;
+    case PCRE_ERROR_RECURSIONLIMIT:
+	key = "pcre-recursion-limit";
+	break;
+    default:
+	key = "pcre-error";
+	break;
+    }
+    scm_error_scm(scm_from_latin1_symbol(key),
+		  scm_from_latin1_string(subr),
+		  pcre_error_to_string(rc), SCM_EOL, SCM_BOOL_F);
+}
+
+static void guile_pcre_check_exec_flags(const char *subr,
+					const struct guile_pcre *regexp,
+					int flags)
+{
+    int  newline = flags & GUILE_PCRE_NEWLINE_BITS;
+    int  bsr = flags & GUILE_PCRE_BSR_BITS;
+
+    if ((newline && newline != regexp->newline) ||
+	(bsr && bsr != regexp->bsr))
+	guile_pcre_exec_error(subr, PCRE_ERROR_BADOPTION);
+}
+
+static pcre_extra *guile_pcre_exec_extra(const struct guile_pcre *regexp,
+					 pcre_extra *local)
+{
+    SCM limits = scm_fluid_ref(exec_limits_fluid);
+    pcre_extra *extra = __atomic_load_n(&regexp->extra, __ATOMIC_ACQUIRE);
+
+    if (scm_is_false(limits))
+	return extra;
+    if (extra)
+	*local = *extra;
+    else
+	memset(local, 0, sizeof(*local));
+    if (scm_is_true(scm_car(limits))) {
+	local->match_limit = scm_to_ulong(scm_car(limits));
+	local->flags |= PCRE_EXTRA_MATCH_LIMIT;
+    }
+    if (scm_is_true(scm_cdr(limits))) {
+	local->match_limit_recursion = scm_to_ulong(scm_cdr(limits));
+	local->flags |= PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+    }
+    return local;
+}
+
+static uint64_t guile_pcre_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void guile_pcre_promote(struct guile_pcre *regexp)
+{
+    int  limits = PCRE_EXTRA_MATCH_LIMIT | PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+    int  jit_flags = __atomic_exchange_n(&regexp->jit_pending, 0,
+					 __ATOMIC_ACQ_REL);
+    const char *error_ptr = NULL;
+    pcre_extra *old = regexp->extra;
+    pcre_extra *extra;
+    size_t size = 0;
+
+    if (jit_flags == 0)
+	return;
+    extra = pcre_study(regexp->regexp, jit_flags, &error_ptr);
+    if (extra == NULL)
+	return;
+    if (old && (old->flags & limits)) {
+	extra->flags |= old->flags & limits;
+	extra->match_limit = old->match_limit;
+	extra->match_limit_recursion = old->match_limit_recursion;
+    }
+    pcre_assign_jit_stack(extra, guile_pcre_jit_stack, regexp);
+    pcre_fullinfo(regexp->regexp, extra, PCRE_INFO_JITSIZE, &size);
+    __atomic_store_n(&regexp->extra, extra, __ATOMIC_RELEASE);
+    guile_pcre_retire(regexp, old, NULL);
+    regexp->jit_size = size;
+    guile_pcre_account(regexp, 0);
+    if (extra->flags & PCRE_EXTRA_EXECUTABLE_JIT)
+	__atomic_fetch_add(&jit_promotions, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&jit_promoted_size, size, __ATOMIC_RELAXED);
+}
+
+static void guile_pcre_count_interpreted(struct guile_pcre *regexp,
+					 uint64_t ns)
+{
+    unsigned long calls;
+
+    calls = __atomic_add_fetch(&regexp->interpreted_calls, 1,
+			       __ATOMIC_RELAXED);
+    ns = __atomic_add_fetch(&regexp->interpreted_ns, ns, __ATOMIC_RELAXED);
+    if ((lazy_jit_calls && calls >= lazy_jit_calls) ||
+	(lazy_jit_ns && ns >= lazy_jit_ns))
+	guile_pcre_promote(regexp);
+}
+
+static void guile_pcre_count(struct guile_pcre_counters *counters, int rc,
+			     uint64_t bytes, uint64_t ns)
+{
+    uint64_t max = __atomic_load_n(&counters->max_ns, __ATOMIC_RELAXED);
+    int  bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+
+    __atomic_fetch_add(&counters->calls, 1, __ATOMIC_RELAXED);
+    if (rc >= 0)
+	__atomic_fetch_add(&counters->matches, 1, __ATOMIC_RELAXED);
+    else if (rc == PCRE_ERROR_NOMATCH)
+	__atomic_fetch_add(&counters->no_matches, 1, __ATOMIC_RELAXED);
+    else
+	__atomic_fetch_add(&counters->errors[-rc < GUILE_PCRE_ERROR_CODES ?
+					     -rc : 0], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counters->subject_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counters->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counters->histogram[bucket], 1, __ATOMIC_RELAXED);
+    while (ns > max &&
+	   !__atomic_compare_exchange_n(&counters->max_ns, &max, ns, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+static void guile_pcre_instrument(SCM pcre_smob, struct guile_pcre *regexp)
+{
+    struct guile_pcre_counters *counters;
+    struct guile_pcre_counters *none = NULL;
+
+    counters = scm_gc_malloc_pointerless(sizeof(*counters), "pcre");
+    memset(counters, 0, sizeof(*counters));
+    if (__atomic_compare_exchange_n(&regexp->counters, &none, counters, 0,
+				    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	scm_hashq_set_x(instrumented_regexps, pcre_smob, SCM_BOOL_T);
+}
+
+struct guile_pcre_exec_call
+{
+    const pcre *code;
+    const pcre_extra *extra;
+#ifdef GUILE_PCRE_WIDE
+    const pcre32 *code32;	/* when set, SUBJECT holds 32-bit characters */
+    const pcre32_extra *extra32;
+#endif
+    const char *subject;
+    int  length;
+    int  start_offset;
+    int  options;
+    int  *ovector;
+    int  ovec_count;
+    int  rc;
+};
+
+static void *guile_pcre_exec_without_guile(void *data)
+{
+    struct guile_pcre_exec_call *call = data;
+
+#ifdef GUILE_PCRE_WIDE
+    if (call->code32) {
+	call->rc = pcre32_exec(call->code32, call->extra32,
+			       (PCRE_SPTR32) call->subject, call->length,
+			       call->start_offset, call->options,
+			       call->ovector, call->ovec_count);
+	return NULL;
+    }
+#endif
+    call->rc = pcre_exec(call->code, call->extra, call->subject,
+			 call->length, call->start_offset, call->options,
+			 call->ovector, call->ovec_count);
+    return NULL;
+}
+
+static int guile_pcre_run_exec(struct guile_pcre *regexp,
+			       struct guile_pcre_exec_call *call, int width)
+{
+    struct guile_pcre_counters *counters =
+	instrumentation ? regexp->counters : NULL;
+    int length = call->length;
+    uint64_t start = 0;
+    uint64_t ns = 0;
+
+    if (counters || (regexp->jit_pending && lazy_jit_ns))
+	start = guile_pcre_now_ns();
+
+    if (blocking_threshold == 0 ||
+	(size_t) (length - call->start_offset) * width <
+	(size_t) blocking_threshold)
+	guile_pcre_exec_without_guile(call);
+    else {
+	__atomic_fetch_add(&regexp->detached_users, 1, __ATOMIC_ACQUIRE);
+	__atomic_fetch_add(&detached_calls, 1, __ATOMIC_RELAXED);
+	scm_without_guile(guile_pcre_exec_without_guile, call);
+	__atomic_fetch_sub(&regexp->detached_users, 1, __ATOMIC_RELEASE);
+    }
+
+    if (start)
+	ns = guile_pcre_now_ns() - start;
+    if (regexp->jit_pending && width == 1)
+	guile_pcre_count_interpreted(regexp, ns);
+    if (counters) {
+	guile_pcre_count(counters, call->rc, (uint64_t) length * width, ns);
+	guile_pcre_count(&global_counters, call->rc, (uint64_t) length * width,
+			 ns);
+    }
+    return call->rc;
+}
+
+static int guile_pcre_call_exec(struct guile_pcre *regexp,
+				const pcre_extra *extra, const char *subject,
+				int length, int start_offset, int options,
+				int *ovector, int ovec_count)
+{
+    struct guile_pcre_exec_call call;
+
+    call.code = regexp->regexp;
+    call.extra = extra;
+#ifdef GUILE_PCRE_WIDE
+    call.code32 = NULL;
+    call.extra32 = NULL;
+#endif
+    call.subject = subject;
+    call.length = length;
+    call.start_offset = start_offset;
+    call.options = options;
+    call.ovector = ovector;
+    call.ovec_count = ovec_count;
+    return guile_pcre_run_exec(regexp, &call, 1);
+}
+
+#ifdef GUILE_PCRE_WIDE
+static int guile_pcre_prepare_wide(struct guile_pcre *regexp)
+{
+    static pthread_mutex_t wide_mutex = PTHREAD_MUTEX_INITIALIZER;
+    int  study_flags = regexp->study_flags & (GUILE_PCRE_STUDY_JIT_FLAGS |
+					      PCRE_STUDY_EXTRA_NEEDED);
+    int  state;
+
+    if (!regexp->utf8)
+	return 0;
+    state = __atomic_load_n(&regexp->wide_state, __ATOMIC_ACQUIRE);
+    if (state == GUILE_PCRE_WIDE_READY || state == GUILE_PCRE_WIDE_FAILED)
+	return state == GUILE_PCRE_WIDE_READY;
+
+    scm_dynwind_begin(0);
+    scm_dynwind_pthread_mutex_lock(&wide_mutex);
+    if (regexp->wide_state == GUILE_PCRE_WIDE_NONE) {
+	unsigned long options = 0;
+	const char *error_ptr = NULL;
+	int  error_code = 0;
+	int  error_offset = 0;
+	scm_t_wchar *chars;
+	PCRE_UCHAR32 *pattern;
+	size_t len;
+	size_t i;
+
+	chars = scm_to_utf32_stringn(regexp->pattern, &len);
+	scm_dynwind_free(chars);
+	pattern = scm_malloc((len + 1) * sizeof(*pattern));
+	scm_dynwind_free(pattern);
+	for (i = 0; i < len; ++i)
+	    pattern[i] = chars[i];
+	pattern[len] = 0;
+	pcre_fullinfo(regexp->regexp, NULL, PCRE_INFO_OPTIONS, &options);
+	regexp->regexp32 = pcre32_compile2(pattern, (int) options, &error_code,
+					   &error_ptr, &error_offset, NULL);
+	regexp->wide_state = regexp->regexp32 ? GUILE_PCRE_WIDE_COMPILED :
+	    GUILE_PCRE_WIDE_FAILED;
+    }
+    if (regexp->wide_state == GUILE_PCRE_WIDE_COMPILED) {
+	const char *error_ptr = NULL;
+
+	if (regexp->study_flags & GUILE_PCRE_STUDY_JIT_LAZY &&
+	    !(study_flags & GUILE_PCRE_STUDY_JIT_FLAGS))
+	    study_flags |= PCRE_STUDY_JIT_COMPILE;
+	if (regexp->extra)
+	    regexp->extra32 = pcre32_study(regexp->regexp32, study_flags,
+					   &error_ptr);
+	if (regexp->extra32)
+	    pcre32_assign_jit_stack(regexp->extra32, guile_pcre_jit_stack32,
+				    regexp);
+	__atomic_store_n(&regexp->wide_state, GUILE_PCRE_WIDE_READY,
+			 __ATOMIC_RELEASE);
+	guile_pcre_account(regexp, 1);
+    }
+    state = regexp->wide_state;
+    scm_dynwind_end();
+    return state == GUILE_PCRE_WIDE_READY;
+}
+
+static void guile_pcre_extra32(const struct guile_pcre *regexp,
+			       const pcre_extra *extra, pcre32_extra *extra32)
+{
+    int  limits = PCRE_EXTRA_MATCH_LIMIT | PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+    const pcre32_extra *study = __atomic_load_n(&regexp->extra32,
+						__ATOMIC_ACQUIRE);
+
+    if (study)
+	*extra32 = *study;
+    else
+	memset(extra32, 0, sizeof(*extra32));
+    if (extra && (extra->flags & limits)) {
+	extra32->flags |= extra->flags & limits;
+	extra32->match_limit = extra->match_limit;
+	extra32->match_limit_recursion = extra->match_limit_recursion;
+    }
+}
+
+static int guile_pcre_call_exec32(struct guile_pcre *regexp,
+				  const pcre_extra *extra, const char *subject,
+				  int length, int start_offset, int options,
+				  int *ovector, int ovec_count)
+{
+    struct guile_pcre_exec_call call;
+    pcre32_extra extra32;
+
+    guile_pcre_extra32(regexp, extra, &extra32);
+    call.code = NULL;
+    call.extra = NULL;
+    call.code32 = regexp->regexp32;
+    call.extra32 = &extra32;
+    call.subject = subject;
+    call.length = length;
+    call.start_offset = start_offset;
+    call.options = options;
+    call.ovector = ovector;
+    call.ovec_count = ovec_count;
+    return guile_pcre_run_exec(regexp, &call, 4);
+}
+#endif
+
+static int guile_pcre_subject_exec(struct guile_pcre *regexp,
+				   const pcre_extra *extra,
+				   const struct guile_pcre_subject *subject,
+				   int start_offset, int options,
+				   int *ovector, int ovec_count)
+{
+#ifdef GUILE_PCRE_WIDE
+    if (subject->wide)
+	return guile_pcre_call_exec32(regexp, extra, subject->bytes,
+				      subject->len, start_offset, options,
+				      ovector, ovec_count);
+#endif
+    if (guile_pcre_prefilter_rejects(regexp, subject->bytes, subject->len,
+				     start_offset, options))
+	return PCRE_ERROR_NOMATCH;
+    return guile_pcre_call_exec(regexp, extra, subject->bytes, subject->len,
+				start_offset, options, ovector, ovec_count);
+}
+
+static int guile_pcre_start_offset(const char *subr, SCM start, SCM string,
+				   struct guile_pcre_subject *subject)
+{
+    size_t offset;
+    size_t limit;
+
+    if (SCM_UNBNDP(start))
+	return 0;
+    offset = scm_to_size_t(start);
+    limit = scm_is_string(string) ? scm_c_string_length(string)
+	: (size_t) subject->len;
+    if (offset > limit)
+	scm_out_of_range(subr, start);
+    return guile_pcre_byte_offset(subject, offset);
+}
+
+#define GUILE_PCRE_BLOCK_HEADER 16
+
+static void *guile_pcre_malloc(size_t size)
+{
+    char *block = malloc(size + GUILE_PCRE_BLOCK_HEADER);
+
+    if (block == NULL)
+	return NULL;
+    *(size_t *) block = size;
+    __atomic_fetch_add(&heap_live, size, __ATOMIC_RELAXED);
+    return block + GUILE_PCRE_BLOCK_HEADER;
+}
+
+static void guile_pcre_free(void *data)
+{
+    char *block;
+
+    if (data == NULL)
+	return;
+    block = (char *) data - GUILE_PCRE_BLOCK_HEADER;
+    __atomic_fetch_sub(&heap_live, *(size_t *) block, __ATOMIC_RELAXED);
+    free(block);
+}
+
+#define GUILE_PCRE_FRAME_POOL 64
+
+static void *guile_pcre_stack_malloc(size_t size)
+{
+    struct guile_pcre_scratch *scratch = pthread_getspecific(scratch_key);
+    char *block;
+
+    if (scratch && scratch->frames && size == scratch->frame_size) {
+	block = scratch->frames;
+	scratch->frames = *(char **) (block + GUILE_PCRE_BLOCK_HEADER);
+	--scratch->frame_count;
+	__atomic_fetch_sub(&frames_pooled, size, __ATOMIC_RELAXED);
+    } else {
+	block = malloc(size + GUILE_PCRE_BLOCK_HEADER);
+	if (block == NULL)
+	    return NULL;
+	*(size_t *) block = size;
+    }
+    __atomic_fetch_add(&frames_live, size, __ATOMIC_RELAXED);
+    return block + GUILE_PCRE_BLOCK_HEADER;
+}
+
+static void guile_pcre_stack_free(void *data)
+{
+    struct guile_pcre_scratch *scratch = pthread_getspecific(scratch_key);
+    char *block = (char *) data - GUILE_PCRE_BLOCK_HEADER;
+    size_t size = *(size_t *) block;
+
+    __atomic_fetch_sub(&frames_live, size, __ATOMIC_RELAXED);
+    if (scratch && scratch->frame_count < GUILE_PCRE_FRAME_POOL &&
+	(scratch->frames == NULL || size == scratch->frame_size)) {
+	scratch->frame_size = size;
+	*(char **) data = scratch->frames;
+	scratch->frames = block;
+	++scratch->frame_count;
+	__atomic_fetch_add(&frames_pooled, size, __ATOMIC_RELAXED);
+    } else
+	free(block);
+}
+
+static void free_scratch(void *data)
+{
+    struct guile_pcre_scratch *scratch = data;
+
+    free(scratch->subject);
+    free(scratch->ovector);
+    free(scratch->workspace);
+    free(scratch->ids);
+    free(scratch->seen);
+    if (scratch->jit_stack)
+	pcre_jit_stack_free(scratch->jit_stack);
+#ifdef GUILE_PCRE_WIDE
+    if (scratch->jit_stack32)
+	pcre32_jit_stack_free(scratch->jit_stack32);
+#endif
+    while (scratch->frames) {
+	char *frame = scratch->frames;
+
+	scratch->frames = *(char **) (frame + GUILE_PCRE_BLOCK_HEADER);
+	__atomic_fetch_sub(&frames_pooled, scratch->frame_size,
+			   __ATOMIC_RELAXED);
+	free(frame);
+    }
+    free(scratch);
+}
+
+static struct guile_pcre_scratch *guile_pcre_thread_scratch(void)
+{
+    struct guile_pcre_scratch *scratch = pthread_getspecific(scratch_key);
+
+    if (scratch == NULL) {
+	scratch = calloc(1, sizeof(*scratch));
+	if (scratch == NULL || pthread_setspecific(scratch_key, scratch)) {
+	    free(scratch);
+	    return NULL;
+	}
+    }
+    return scratch;
+}
+
+static struct guile_pcre_scratch *guile_pcre_scratch(void)
+{
+    struct guile_pcre_scratch *scratch = guile_pcre_thread_scratch();
+
+    if (scratch == NULL)
+	scm_report_out_of_memory();
+    return scratch;
+}
+
+static pcre_jit_stack *guile_pcre_jit_stack(void *data)
+{
+    const struct guile_pcre *regexp = data;
+    struct guile_pcre_scratch *scratch = guile_pcre_thread_scratch();
+
+    if (scratch == NULL)
+	return regexp->jit_stack;
+    if (regexp->jit_stack && !scratch->pooled_jit_stack)
+	return regexp->jit_stack;
+    if (scratch->jit_stack && scratch->jit_stack_size != jit_stack_pool_size) {
+	pcre_jit_stack_free(scratch->jit_stack);
+	scratch->jit_stack = NULL;
+    }
+    if (scratch->jit_stack == NULL && jit_stack_pool_size > 0) {
+	scratch->jit_stack_size = jit_stack_pool_size;
+	scratch->jit_stack =
+	    pcre_jit_stack_alloc(jit_stack_pool_size < 32 * 1024 ?
+				 jit_stack_pool_size : 32 * 1024,
+				 jit_stack_pool_size);
+    }
+    return scratch->jit_stack;
+}
+
+#ifdef GUILE_PCRE_WIDE
+static pcre32_jit_stack *guile_pcre_jit_stack32(void *data)
+{
+    struct guile_pcre_scratch *scratch = guile_pcre_thread_scratch();
+
+    (void) data;
+    if (scratch == NULL)
+	return NULL;
+    if (scratch->jit_stack32 &&
+	scratch->jit_stack32_size != jit_stack_pool_size) {
+	pcre32_jit_stack_free(scratch->jit_stack32);
+	scratch->jit_stack32 = NULL;
+    }
+    if (scratch->jit_stack32 == NULL && jit_stack_pool_size > 0) {
+	scratch->jit_stack32_size = jit_stack_pool_size;
+	scratch->jit_stack32 =
+	    pcre32_jit_stack_alloc(jit_stack_pool_size < 32 * 1024 ?
+				   jit_stack_pool_size : 32 * 1024,
+				   jit_stack_pool_size);
+    }
+    return scratch->jit_stack32;
+}
+#endif
+
+static int *guile_pcre_grow_ovector(struct guile_pcre_scratch *scratch,
+				    int count)
+{
+    if (scratch->ovector_count < (size_t) count) {
+	int *ovector = realloc(scratch->ovector,
+			       count * sizeof(*scratch->ovector));
+
+	if (ovector == NULL)
+	    return NULL;
+	scratch->ovector = ovector;
+	scratch->ovector_count = count;
+    }
+    return scratch->ovector;
+}
+
+static int *guile_pcre_scratch_ovector(struct guile_pcre_scratch *scratch,
+				       int count)
+{
+    int *ovector = guile_pcre_grow_ovector(scratch, count);
+
+    if (ovector == NULL)
+	scm_report_out_of_memory();
+    return ovector;
+}
+
+static int *guile_pcre_scratch_workspace(struct guile_pcre_scratch *scratch,
+					 size_t count)
+{
+    if (scratch->workspace_count < count) {
+	int *workspace = realloc(scratch->workspace,
+				 count * sizeof(*scratch->workspace));
+
+	if (workspace == NULL)
+	    scm_report_out_of_memory();
+	scratch->workspace = workspace;
+	scratch->workspace_count = count;
+    }
+    return scratch->workspace;
+}
+
+static int *guile_pcre_scratch_ids(struct guile_pcre_scratch *scratch,
+				   size_t count)
+{
+    if (scratch->ids_count < count) {
+	int *ids = realloc(scratch->ids, count * sizeof(*scratch->ids));
+
+	if (ids == NULL)
+	    scm_report_out_of_memory();
+	scratch->ids = ids;
+	scratch->ids_count = count;
+    }
+    return scratch->ids;
+}
+
+static unsigned char *guile_pcre_scratch_seen(struct guile_pcre_scratch *scratch,
+					      size_t count)
+{
+    if (scratch->seen_count < count) {
+	unsigned char *seen = realloc(scratch->seen, count);
+
+	if (seen == NULL)
+	    scm_report_out_of_memory();
+	memset(seen + scratch->seen_count, 0, count - scratch->seen_count);
+	scratch->seen = seen;
+	scratch->seen_count = count;
+    }
+    return scratch->seen;
+}
+
+static int guile_pcre_encode_utf8(SCM string, char **bufp, size_t *sizep,
+				  size_t *lenp)
+{
+    size_t len = scm_c_string_length(string);
+    size_t needed;
+    size_t i;
+    size_t n = 0;
+    unsigned char *p;
+    int ascii = 1;
+
+#if defined(HAVE_SCM_I_IS_NARROW_STRING) && defined(HAVE_SCM_I_STRING_CHARS)
+    if (scm_i_is_narrow_string(string)) {
+	const unsigned char *chars =
+	    (const unsigned char *) scm_i_string_chars(string);
+	size_t high = 0;
+
+	    /* Latin-1: each character is one byte or two, so the size
+	     * is known before encoding. */
+	for (i = 0; i < len; ++i)
+	    high += chars[i] >> 7;
+	if (*sizep < len + high + 1) {
+	    *bufp = scm_realloc(*bufp, len + high + 1);
+	    *sizep = len + high + 1;
+	}
+	p = (unsigned char *) *bufp;
+	if (high == 0) {
+	    memcpy(p, chars, len);
+	    n = len;
+	} else {
+	    for (i = 0; i < len; ++i) {
+		if (chars[i] < 0x80) {
+		    p[n++] = chars[i];
+		} else {
+		    p[n++] = 0xc0 | (chars[i] >> 6);
+		    p[n++] = 0x80 | (chars[i] & 0x3f);
+		}
+	    }
+	}
+	p[n] = 0;
+	*lenp = n;
+	return high == 0;
+    }
+#endif
+    if (*sizep < len + 1) {
+	*bufp = scm_realloc(*bufp, len + 1);
+	*sizep = len + 1;
+    }
+    p = (unsigned char *) *bufp;
+    for (i = 0; i < len; ++i) {
+	scm_t_wchar c = SCM_CHAR(scm_c_string_ref(string, i));
+
+	if (c < 0x80) {
+	    p[n++] = c;
+	    continue;
+	}
+
+	    /* Room for this character and one byte for each remaining. */
+	ascii = 0;
+	needed = n + 4 + (len - i);
+	if (needed > *sizep) {
+	    needed = needed > *sizep * 2 ? needed : *sizep * 2;
+	    *bufp = scm_realloc(*bufp, needed);
+	    *sizep = needed;
+	    p = (unsigned char *) *bufp;
+	}
+	if (c < 0x800) {
+	    p[n++] = 0xc0 | (c >> 6);
+	} else if (c < 0x10000) {
+	    p[n++] = 0xe0 | (c >> 12);
+	    p[n++] = 0x80 | ((c >> 6) & 0x3f);
+	} else {
+	    p[n++] = 0xf0 | (c >> 18);
+	    p[n++] = 0x80 | ((c >> 12) & 0x3f);
+	    p[n++] = 0x80 | ((c >> 6) & 0x3f);
+	}
+	p[n++] = 0x80 | (c & 0x3f);
+    }
+    p[n] = 0;
+    *lenp = n;
+    return ascii;
+}
+
+#ifdef GUILE_PCRE_NARROW_IN_PLACE
+static int guile_pcre_string_in_place(SCM string, struct guile_pcre *wide,
+				      struct guile_pcre_scratch *scratch,
+				      struct guile_pcre_subject *subject)
+{
+    size_t len = scm_c_string_length(string);
+    size_t i;
+
+    if (len > INT_MAX)
+	return 0;
+    if (scm_i_is_narrow_string(string)) {
+	const unsigned char *chars =
+	    (const unsigned char *) scm_i_string_chars(string);
+
+	for (i = 0; i < len && chars[i] < 0x80; ++i)
+	    ;
+	if (i == len) {
+	    guile_pcre_init_subject(subject, (const char *) chars, len, 0);
+	    return 1;
+	}
+#ifdef GUILE_PCRE_WIDE
+	if (wide && guile_pcre_prepare_wide(wide)) {
+	    uint32_t *widened;
+
+	    if (scratch->subject_size < len * sizeof(*widened)) {
+		scratch->subject = scm_realloc(scratch->subject,
+					       len * sizeof(*widened));
+		scratch->subject_size = len * sizeof(*widened);
+	    }
+	    widened = (uint32_t *) scratch->subject;
+	    for (i = 0; i < len; ++i)
+		widened[i] = chars[i];
+	    guile_pcre_init_subject(subject, scratch->subject, len, 0);
+	    subject->wide = 1;
+	    return 1;
+	}
+#endif
+	return 0;
+    }
+#ifdef GUILE_PCRE_WIDE
+    if (wide && guile_pcre_prepare_wide(wide)) {
+	guile_pcre_init_subject(subject,
+				(const char *) scm_i_string_wide_chars(string),
+				len, 0);
+	subject->wide = 1;
+	return 1;
+    }
+#endif
+    return 0;
+}
+#endif
+
+static void guile_pcre_get_subject(const char *subr, SCM string,
+				   struct guile_pcre_scratch *scratch,
+				   struct guile_pcre_subject *subject,
+				   struct guile_pcre *wide)
+{
+    size_t len;
+    int ascii = 1;
+
+    (void) wide;
+    if (scm_is_bytevector(string)) {
+	len = SCM_BYTEVECTOR_LENGTH(string);
+	if (len > INT_MAX)
+	    scm_out_of_range(subr, string);
+	guile_pcre_init_subject(subject,
+				(const char *) SCM_BYTEVECTOR_CONTENTS(string),
+				len, 0);
+    } else if (scm_is_string(string)) {
+#ifdef GUILE_PCRE_NARROW_IN_PLACE
+	if (guile_pcre_string_in_place(string, wide, scratch, subject))
+	    return;
+#endif
+	ascii = guile_pcre_encode_utf8(string, &scratch->subject,
+				       &scratch->subject_size, &len);
+	if (len > INT_MAX)
+	    scm_out_of_range(subr, string);
+	guile_pcre_init_subject(subject, scratch->subject, len, !ascii);
+    } else
+	scm_wrong_type_arg_msg(subr, SCM_ARG2, string, "string or bytevector");
+}
+
+static int guile_pcre_match(const char *subr, SCM pcre_smob, SCM string,
+			    SCM start, SCM options,
+			    struct guile_pcre_subject *subject,
+			    int *ovector, int ovec_count)
+{
+    struct guile_pcre *regexp;
+    pcre_extra extra;
+    int start_offset;
+    int flags = guile_pcre_flags(options);
+    int rc;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    guile_pcre_check_exec_flags(subr, regexp, flags);
+    if (instrumentation && regexp->counters == NULL)
+	guile_pcre_instrument(pcre_smob, regexp);
+    guile_pcre_get_subject(subr, string, guile_pcre_scratch(), subject,
+			   regexp);
+    start_offset = guile_pcre_start_offset(subr, start, string, subject);
+
+    rc = guile_pcre_subject_exec(regexp,
+				 guile_pcre_exec_extra(regexp, &extra),
+				 subject, start_offset, flags, ovector,
+				 ovec_count);
+    if (rc < 0 && rc != PCRE_ERROR_NOMATCH)
+	guile_pcre_exec_error(subr, rc);
+    return rc;
+}
+
+static SCM guile_pcre_exec(SCM pcre_smob, SCM string, SCM start,
+			   SCM options)
+{
+    struct guile_pcre *regexp;
+    struct guile_pcre_subject subject;
+    SCM rv = SCM_BOOL_F;
+    int rc;
+    int *captures;
+    int ovec_count;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    ovec_count = (regexp->capture_count + 1) * 3;
+    captures = guile_pcre_scratch_ovector(guile_pcre_scratch(), ovec_count);
+
+    rc = guile_pcre_match("pcre-exec", pcre_smob, string, start, options,
+			  &subject, captures, ovec_count);
+    if (rc > 0)
+	rv = guile_pcre_make_match(pcre_smob, string, captures, rc,
+				   &subject);
+
+    scm_remember_upto_here_2(pcre_smob, string);
+
+    return rv;
+}
+
+static SCM guile_pcre_match_p(SCM pcre_smob, SCM string, SCM start,
+			      SCM options)
+{
+    struct guile_pcre_subject subject;
+    int rc;
+
+    rc = guile_pcre_match("pcre-match?", pcre_smob, string, start, options,
+			  &subject, NULL, 0);
+    scm_remember_upto_here_2(pcre_smob, string);
+    return scm_from_bool(rc >= 0);
+}
+
+static SCM guile_pcre_match_span(SCM pcre_smob, SCM string, SCM start,
+				 SCM options)
+{
+    struct guile_pcre_subject subject;
+    int ovector[3];
+    SCM values[2] = { SCM_BOOL_F, SCM_BOOL_F };
+    int rc;
+
+    rc = guile_pcre_match("pcre-match-span", pcre_smob, string, start,
+			  options, &subject, ovector, 3);
+    if (rc >= 0) {
+	values[0] = scm_from_size_t(guile_pcre_char_index(&subject,
+							   ovector[0]));
+	values[1] = scm_from_size_t(guile_pcre_char_index(&subject,
+							   ovector[1]));
+    }
+    scm_remember_upto_here_2(pcre_smob, string);
+    return scm_c_values(values, 2);
+}
+
+static SCM guile_pcre_make_ovector(SCM pcre_smob)
+{
+    struct guile_pcre *regexp;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    return scm_make_s32vector(scm_from_int((regexp->capture_count + 1) * 3),
+			      scm_from_int(-1));
+}
+
+static SCM guile_pcre_exec_x(SCM pcre_smob, SCM string, SCM ovector,
+			     SCM start, SCM options)
+{
+    struct guile_pcre_subject subject;
+    int *offsets;
+    size_t count;
+    int rc;
+    int i;
+
+    SCM_ASSERT_TYPE(scm_is_bytevector(ovector), ovector, SCM_ARG3,
+		    "pcre-exec!", "bytevector");
+    offsets = (int *) SCM_BYTEVECTOR_CONTENTS(ovector);
+    count = SCM_BYTEVECTOR_LENGTH(ovector) / sizeof(int);
+    if ((uintptr_t) offsets % sizeof(int) != 0 || count > INT_MAX)
+	scm_wrong_type_arg_msg("pcre-exec!", SCM_ARG3, ovector,
+			       "aligned s32 bytevector");
+    count -= count % 3;
+
+    rc = guile_pcre_match("pcre-exec!", pcre_smob, string, start, options,
+			  &subject, offsets, count);
+    scm_remember_upto_here_2(pcre_smob, string);
+    if (rc < 0)
+	return SCM_BOOL_F;
+    if (rc == 0)
+	rc = count / 3;
+    for (i = 0; i < rc * 2; ++i)
+	if (offsets[i] >= 0)
+	    offsets[i] = guile_pcre_char_index(&subject, offsets[i]);
+    return scm_from_int(rc);
+}
+
+static SCM guile_pcre_exec_bytevector(SCM pcre_smob, SCM bv, SCM start,
+				      SCM options)
+{
+    SCM_ASSERT_TYPE(scm_is_bytevector(bv), bv, SCM_ARG2,
+		    "pcre-exec/bytevector", "bytevector");
+    return guile_pcre_exec(pcre_smob, bv, start, options);
+}
+
+static SCM guile_pcre_make_dfa_workspace(SCM size)
+{
+    if (SCM_UNBNDP(size))
+	size = scm_from_int(1000);
+    else if (scm_to_int(size) < 20)
+	scm_out_of_range("make-pcre-dfa-workspace", size);
+    return scm_make_s32vector(size, scm_from_int(0));
+}
+
+static SCM guile_pcre_dfa_exec(SCM pcre_smob, SCM string, SCM start,
+			       SCM workspace, SCM options)
+{
+    struct guile_pcre *regexp;
+    struct guile_pcre_scratch *scratch;
+    struct guile_pcre_subject subject;
+    pcre_extra extra;
+    pcre_extra *extrap;
+    int flags = guile_pcre_flags(options);
+    int pooled = SCM_UNBNDP(workspace) || scm_is_false(workspace);
+    int *ovector;
+    int ovec_count = 64;
+    int *ws = NULL;
+    size_t ws_count;
+    int start_offset;
+    int rc;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    guile_pcre_check_exec_flags("pcre-dfa-exec", regexp, flags);
+    scratch = guile_pcre_scratch();
+    if (pooled) {
+	if (flags & PCRE_DFA_RESTART)
+	    scm_misc_error("pcre-dfa-exec",
+			   "PCRE_DFA_RESTART needs the workspace of the "
+			   "previous match", SCM_EOL);
+	ws_count = scratch->workspace_count > 1000 ?
+	    scratch->workspace_count : 1000;
+    } else {
+	SCM_ASSERT_TYPE(scm_is_bytevector(workspace), workspace, SCM_ARG4,
+			"pcre-dfa-exec", "bytevector");
+	ws = (int *) SCM_BYTEVECTOR_CONTENTS(workspace);
+	ws_count = SCM_BYTEVECTOR_LENGTH(workspace) / sizeof(int);
+	if ((uintptr_t) ws % sizeof(int) != 0 || ws_count > INT_MAX)
+	    scm_wrong_type_arg_msg("pcre-dfa-exec", SCM_ARG4, workspace,
+				   "aligned s32 bytevector");
+    }
+
+    guile_pcre_get_subject("pcre-dfa-exec", string, scratch, &subject, NULL);
+    start_offset = guile_pcre_start_offset("pcre-dfa-exec", start, string,
+					   &subject);
+    extrap = guile_pcre_exec_extra(regexp, &extra);
+    for (;;) {
+	ovector = guile_pcre_scratch_ovector(scratch, ovec_count);
+	if (pooled)
+	    ws = guile_pcre_scratch_workspace(scratch, ws_count);
+	rc = pcre_dfa_exec(regexp->regexp, extrap, subject.bytes,
+			   subject.len, start_offset, flags, ovector,
+			   ovec_count, ws, ws_count);
+	if (rc == 0 && !(flags & PCRE_DFA_RESTART) &&
+	    ovec_count < INT_MAX / 4)
+	    ovec_count *= 2;
+	else if (rc == PCRE_ERROR_DFA_WSSIZE && pooled &&
+		 ws_count < INT_MAX / 4)
+	    ws_count *= 2;
+	else
+	    break;
+    }
+    scm_remember_upto_here_2(pcre_smob, workspace);
+
+    if (rc == PCRE_ERROR_NOMATCH)
+	return SCM_BOOL_F;
+    if (rc == PCRE_ERROR_PARTIAL)
+	return scm_from_latin1_symbol("partial");
+    if (rc < 0)
+	guile_pcre_exec_error("pcre-dfa-exec", rc);
+    if (rc == 0)
+	rc = ovec_count / 2;
+    return guile_pcre_make_match(SCM_BOOL_F, string, ovector, rc, &subject);
+}
+
+static int guile_pcre_next_offset(const struct guile_pcre *regexp,
+				  const struct guile_pcre_subject *subject,
+				  int offset)
+{
+    const char *bytes = subject->bytes;
+    int next = offset + 1;
+
+#ifdef GUILE_PCRE_WIDE
+    if (subject->wide) {
+	const uint32_t *chars = (const uint32_t *) bytes;
+
+	if (regexp->crlf_newline && offset < subject->len - 1 &&
+	    chars[offset] == '\r' && chars[offset + 1] == '\n')
+	    return offset + 2;
+	return next;
+    }
+#endif
+    if (regexp->crlf_newline && offset < subject->len - 1 &&
+	bytes[offset] == '\r' && bytes[offset + 1] == '\n')
+	return offset + 2;
+    if (regexp->utf8 || subject->mapped)
+	while (next < subject->len && (bytes[next] & 0xc0) == 0x80)
+	    ++next;
+    return next;
+}
+
+#ifdef GUILE_PCRE_WIDE
+static int guile_pcre_own_wide(SCM string, struct guile_pcre *wide,
+			       struct guile_pcre_subject *subject)
+{
+    size_t len = scm_c_string_length(string);
+    uint32_t *chars;
+    size_t i;
+
+    if (wide == NULL || len > INT_MAX)
+	return 0;
+    if (scm_i_is_narrow_string(string)) {
+	const unsigned char *narrow =
+	    (const unsigned char *) scm_i_string_chars(string);
+
+	for (i = 0; i < len && narrow[i] < 0x80; ++i)
+	    ;
+	if (i == len || !guile_pcre_prepare_wide(wide))
+	    return 0;
+	chars = scm_malloc((len + 1) * sizeof(*chars));
+	for (i = 0; i < len; ++i)
+	    chars[i] = narrow[i];
+    } else {
+	if (!guile_pcre_prepare_wide(wide))
+	    return 0;
+	chars = scm_malloc((len + 1) * sizeof(*chars));
+	memcpy(chars, scm_i_string_wide_chars(string), len * sizeof(*chars));
+    }
+    scm_dynwind_free(chars);
+    guile_pcre_init_subject(subject, (const char *) chars, len, 0);
+    subject->wide = 1;
+    return 1;
+}
+#endif
+
+static void guile_pcre_own_subject(const char *subr, SCM string,
+				   struct guile_pcre_subject *subject,
+				   struct guile_pcre *wide)
+{
+    char *buffer = NULL;
+    size_t size = 0;
+    size_t len;
+
+    (void) wide;
+    if (scm_is_bytevector(string)) {
+	len = SCM_BYTEVECTOR_LENGTH(string);
+	guile_pcre_init_subject(subject,
+				(const char *) SCM_BYTEVECTOR_CONTENTS(string),
+				len, 0);
+    } else {
+	int ascii;
+
+	SCM_ASSERT_TYPE(scm_is_string(string), string, SCM_ARG2, subr,
+			"string or bytevector");
+#ifdef GUILE_PCRE_WIDE
+	if (guile_pcre_own_wide(string, wide, subject))
+	    return;
+#endif
+	ascii = guile_pcre_encode_utf8(string, &buffer, &size, &len);
+	scm_dynwind_free(buffer);
+	guile_pcre_init_subject(subject, buffer, len, !ascii);
+    }
+    if (len > INT_MAX)
+	scm_out_of_range(subr, string);
+}
+
+struct guile_pcre_matches
+{
+    const char *subr;
+    struct guile_pcre *regexp;
+    struct guile_pcre_subject subject;
+    pcre_extra extra;
+    pcre_extra *extrap;
+    int  flags;
+    int  *captures;
+    int  ovec_count;
+    int  offset;
+    int  retry_empty;
+    int  done;
+};
+
+static void guile_pcre_matches_init(struct guile_pcre_matches *matches,
+				    const char *subr, SCM pcre_smob,
+				    SCM string, int flags)
+{
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    matches->subr = subr;
+    matches->regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    guile_pcre_check_exec_flags(subr, matches->regexp, flags);
+    matches->flags = flags;
+    matches->ovec_count = (matches->regexp->capture_count + 1) * 3;
+    matches->offset = 0;
+    matches->retry_empty = 0;
+    matches->done = 0;
+    if (instrumentation && matches->regexp->counters == NULL)
+	guile_pcre_instrument(pcre_smob, matches->regexp);
+    guile_pcre_own_subject(subr, string, &matches->subject,
+			   matches->regexp);
+    matches->captures = scm_malloc(matches->ovec_count *
+				   sizeof(*matches->captures));
+    scm_dynwind_free(matches->captures);
+    matches->extrap = guile_pcre_exec_extra(matches->regexp,
+					    &matches->extra);
+}
+
+static int guile_pcre_matches_next(struct guile_pcre_matches *matches)
+{
+    const struct guile_pcre_subject *subject = &matches->subject;
+    int *captures = matches->captures;
+    int exec_flags;
+    int rc;
+
+    while (!matches->done) {
+	exec_flags = matches->flags;
+	if (matches->retry_empty)
+	    exec_flags |= PCRE_NOTEMPTY_ATSTART | PCRE_ANCHORED;
+	rc = guile_pcre_subject_exec(matches->regexp, matches->extrap,
+				     subject, matches->offset, exec_flags,
+				     captures, matches->ovec_count);
+	if (rc == PCRE_ERROR_NOMATCH) {
+	    if (!matches->retry_empty)
+		break;
+	    matches->retry_empty = 0;
+	    matches->offset = guile_pcre_next_offset(matches->regexp, subject,
+						     matches->offset);
+	    if (matches->offset > subject->len)
+		break;
+	    continue;
+	}
+	if (rc < 0)
+	    guile_pcre_exec_error(matches->subr, rc);
+
+	if (captures[1] <= captures[0]) {
+	    if (captures[0] == subject->len)
+		matches->done = 1;
+	    matches->retry_empty = 1;
+	}
+	if (captures[1] > matches->offset)
+	    matches->offset = captures[1];
+	return rc;
+    }
+    matches->done = 1;
+    return 0;
+}
+
+static SCM guile_pcre_fold_matches(SCM pcre_smob, SCM string, SCM init,
+				   SCM proc, SCM options)
+{
+    struct guile_pcre_matches matches;
+    SCM rv = init;
+    int rc;
+
+    scm_dynwind_begin(0);
+    guile_pcre_matches_init(&matches, "pcre-fold-matches", pcre_smob,
+			    string, guile_pcre_flags(options));
+    while ((rc = guile_pcre_matches_next(&matches)) > 0)
+	rv = scm_call_2(proc,
+			guile_pcre_make_match(pcre_smob, string,
+					      matches.captures, rc,
+					      &matches.subject),
+			rv);
+    scm_dynwind_end();
+    scm_remember_upto_here_2(pcre_smob, string);
+
+    return rv;
+}
+
+static int guile_pcre_utf8_prefix(const char *bytes, int len)
+{
+    const unsigned char *p = (const unsigned char *) bytes;
+    int i = len;
+    int need;
+
+    while (i > 0 && i > len - 4 && (p[i - 1] & 0xc0) == 0x80)
+	--i;
+    if (i == 0 || p[i - 1] < 0xc0)
+	return len;
+    need = p[i - 1] >= 0xf0 ? 4 : p[i - 1] >= 0xe0 ? 3 : 2;
+    return len - (i - 1) >= need ? len : i - 1;
+}
+
+static SCM guile_pcre_make_port_match(SCM regexp, const char *bytes,
+				      const int *captures, int match_count,
+				      size_t base)
+{
+    struct guile_pcre_match *match;
+    SCM region;
+    int lo = captures[0];
+    int hi = captures[1];
+    int i;
+
+    for (i = 2; i < match_count * 2; i += 2)
+	if (captures[i] >= 0) {
+	    lo = captures[i] < lo ? captures[i] : lo;
+	    hi = captures[i + 1] > hi ? captures[i + 1] : hi;
+	}
+    region = scm_c_make_bytevector(hi - lo);
+    memcpy(SCM_BYTEVECTOR_CONTENTS(region), bytes + lo, hi - lo);
+
+    match = guile_pcre_alloc_match(regexp, region, match_count);
+    match->base = base + lo;
+    for (i = 0; i < match_count * 2; i += 2) {
+	if (captures[i] < 0) {
+	    match->offsets[i] = -1;
+	    match->offsets[i + 1] = -1;
+	} else {
+	    match->offsets[i] = captures[i] - lo;
+	    match->offsets[i + 1] = captures[i + 1] - lo;
+	}
+    }
+    SCM_RETURN_NEWSMOB(pcre_match_tag, match);
+}
+
+static void free_port_buffer(void *data)
+{
+    free(*(char **) data);
+}
+
+static SCM guile_pcre_fold_port(SCM pcre_smob, SCM port, SCM init,
+				SCM proc, SCM chunk_size, SCM options)
+{
+    struct guile_pcre *regexp;
+    struct guile_pcre_subject subject;
+    pcre_extra extra;
+    pcre_extra *extrap;
+    SCM rv = init;
+    int flags = guile_pcre_flags(options);
+    int exec_flags;
+    int chunk = 65536;
+    int lookbehind = 0;
+    int *captures;
+    int ovec_count;
+    char *buffer = NULL;
+    size_t size = 0;
+    size_t base = 0;		/* stream offset of BUFFER[0] */
+    int len = 0;
+    int offset = 0;
+    int keep;
+    int retry_empty = 0;
+    int eof = 0;
+    int rc;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    SCM_ASSERT(scm_is_true(scm_input_port_p(port)), port, SCM_ARG2,
+	       "pcre-fold-port");
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    guile_pcre_check_exec_flags("pcre-fold-port", regexp, flags);
+    if (!SCM_UNBNDP(chunk_size) && scm_is_true(chunk_size)) {
+	chunk = scm_to_int(chunk_size);
+	if (chunk <= 0)
+	    scm_out_of_range("pcre-fold-port", chunk_size);
+    }
+	/* Keep a character before where the next search starts, as
+	 * well as the lookbehind, so ^, \b and the like see it. */
+    pcre_fullinfo(regexp->regexp, NULL, PCRE_INFO_MAXLOOKBEHIND,
+		  &lookbehind);
+    lookbehind = (lookbehind + 1) * (regexp->utf8 ? 4 : 1);
+    ovec_count = (regexp->capture_count + 1) * 3;
+
+    scm_dynwind_begin(0);
+    captures = scm_malloc(ovec_count * sizeof(*captures));
+    scm_dynwind_free(captures);
+    extrap = guile_pcre_exec_extra(regexp, &extra);
+
+    for (;;) {
+	if (len == 0 && !eof) {
+	    keep = 0;
+	    goto refill;
+	}
+	guile_pcre_init_subject(&subject, buffer, len, 0);
+	if (!eof && regexp->utf8)
+	    subject.len = guile_pcre_utf8_prefix(buffer, len);
+	if (offset > subject.len) {
+	    keep = offset;
+	    if (eof)
+		break;
+	    goto refill;
+	}
+
+	exec_flags = flags;
+	if (!eof)
+	    exec_flags |= PCRE_PARTIAL_HARD;
+	if (retry_empty)
+	    exec_flags |= PCRE_NOTEMPTY_ATSTART | PCRE_ANCHORED;
+	rc = guile_pcre_subject_exec(regexp, extrap, &subject, offset,
+				     exec_flags, captures, ovec_count);
+
+	if (rc == PCRE_ERROR_PARTIAL) {
+	    keep = offset = captures[0];
+	    goto refill;
+	}
+	if (rc == PCRE_ERROR_NOMATCH) {
+	    if (retry_empty) {
+		if (!eof && offset >= subject.len) {
+		    keep = offset;
+		    goto refill;
+		}
+		retry_empty = 0;
+		offset = guile_pcre_next_offset(regexp, &subject, offset);
+		continue;
+	    }
+	    if (eof)
+		break;
+	    keep = offset = subject.len;
+	    goto refill;
+	}
+	if (rc < 0)
+	    guile_pcre_exec_error("pcre-fold-port", rc);
+	if (rc == 0)
+	    rc = ovec_count / 3;
+
+	rv = scm_call_2(proc,
+			guile_pcre_make_port_match(pcre_smob, buffer, captures,
+						   rc, base),
+			rv);
+
+	if (captures[1] <= captures[0]) {
+	    if (eof && captures[0] == len)
+		break;
+	    retry_empty = 1;
+	}
+	offset = captures[1] > offset ? captures[1] : offset;
+	continue;
+
+    refill:
+	    /* Drop what is before KEEP, less the lookbehind, and read
+	     * the next chunk after what is left. */
+	keep = keep > lookbehind ? keep - lookbehind : 0;
+	while (regexp->utf8 && keep > 0 && keep < len &&
+	       (buffer[keep] & 0xc0) == 0x80)
+	    --keep;
+	if (keep > 0) {
+	    memmove(buffer, buffer + keep, len - keep);
+	    len -= keep;
+	    offset -= keep;
+	    base += keep;
+	}
+	if (size < (size_t) len + chunk) {
+	    if ((size_t) len + chunk > INT_MAX)
+		scm_out_of_range("pcre-fold-port", chunk_size);
+	    if (buffer == NULL) {
+		buffer = scm_malloc(len + chunk);
+		scm_dynwind_unwind_handler(free_port_buffer, &buffer,
+					   SCM_F_WIND_EXPLICITLY);
+	    } else
+		buffer = scm_realloc(buffer, len + chunk);
+	    size = len + chunk;
+	}
+	rc = scm_c_read(port, buffer + len, chunk);
+	if (rc == 0)
+	    eof = 1;
+	len += rc;
+    }
+
+    scm_dynwind_end();
+    scm_remember_upto_here_2(pcre_smob, port);
+
+    return rv;
+}
+
+static void guile_pcre_append(char **bufp, size_t *sizep, size_t *lenp,
+			      const char *bytes, size_t n)
+{
+    size_t needed = *lenp + n;
+
+    if (needed > *sizep) {
+	needed = needed > *sizep * 2 ? needed : *sizep * 2;
+	needed = needed > 64 ? needed : 64;
+	*bufp = scm_realloc(*bufp, needed);
+	*sizep = needed;
+    }
+    memcpy(*bufp + *lenp, bytes, n);
+    *lenp += n;
+}
+
+static void guile_pcre_append_subject(char **bufp, size_t *sizep,
+				      size_t *lenp,
+				      const struct guile_pcre_subject *subject,
+				      int start, int end)
+{
+#ifdef GUILE_PCRE_WIDE
+    if (subject->wide) {
+	const uint32_t *chars = (const uint32_t *) subject->bytes;
+	char utf8[256];
+	int  n = 0;
+	int  i;
+
+	for (i = start; i < end; ++i) {
+	    uint32_t c = chars[i];
+
+	    if (n > (int) sizeof(utf8) - 4) {
+		guile_pcre_append(bufp, sizep, lenp, utf8, n);
+		n = 0;
+	    }
+	    if (c < 0x80)
+		utf8[n++] = c;
+	    else {
+		if (c < 0x800)
+		    utf8[n++] = 0xc0 | (c >> 6);
+		else {
+		    if (c < 0x10000)
+			utf8[n++] = 0xe0 | (c >> 12);
+		    else {
+			utf8[n++] = 0xf0 | (c >> 18);
+			utf8[n++] = 0x80 | ((c >> 12) & 0x3f);
+		    }
+		    utf8[n++] = 0x80 | ((c >> 6) & 0x3f);
+		}
+		utf8[n++] = 0x80 | (c & 0x3f);
+	    }
+	}
+	guile_pcre_append(bufp, sizep, lenp, utf8, n);
+	return;
+    }
+#endif
+    guile_pcre_append(bufp, sizep, lenp, subject->bytes + start, end - start);
+}
+
+static SCM guile_pcre_name_table(struct guile_pcre *regexp);
+static SCM guile_pcre_subject_slice(SCM subject, size_t start, size_t end);
+
+static void guile_pcre_template_error(const char *message, SCM args)
+{
+    scm_error_scm(scm_from_latin1_symbol("pcre-error"),
+		  scm_from_latin1_string("pcre-compile-template"),
+		  scm_from_latin1_string(message), args, SCM_BOOL_F);
+}
+
+static int guile_pcre_template_group(struct guile_pcre *regexp,
+				     const char *ref, size_t len)
+{
+    SCM name;
+    SCM number;
+    size_t i;
+    long group = 0;
+
+    for (i = 0; i < len && isdigit((unsigned char) ref[i]); ++i)
+	if (group <= regexp->capture_count)
+	    group = group * 10 + ref[i] - '0';
+    if (len > 0 && i == len) {
+	if (group > regexp->capture_count)
+	    guile_pcre_template_error("no group ~A in regexp",
+				      scm_list_1(scm_from_long(group)));
+	return (int) group;
+    }
+
+    name = scm_from_utf8_symboln(ref, len);
+    number = scm_hashq_ref(guile_pcre_name_table(regexp), name, SCM_BOOL_F);
+    if (scm_is_false(number))
+	guile_pcre_template_error("no group named ~A in regexp",
+				  scm_list_1(name));
+    return scm_to_int(number);
+}
+
+static SCM guile_pcre_compile_template(SCM pcre_smob, SCM source)
+{
+    struct guile_pcre *regexp;
+    struct guile_pcre_template *template;
+    struct guile_pcre_template_op *op;
+    char *bytes;
+    const char *end;
+    size_t len;
+    size_t i;
+    size_t count;
+    int literal_len = 0;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    SCM_ASSERT_TYPE(scm_is_string(source), source, SCM_ARG2,
+		    "pcre-compile-template", "string");
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+
+    scm_dynwind_begin(0);
+    bytes = scm_to_utf8_stringn(source, &len);
+    scm_dynwind_free(bytes);
+
+	    /* Every "$" starts at most one piece and ends a literal. */
+    for (i = 0, count = 1; i < len; ++i)
+	count += (bytes[i] == '$') * 2;
+    template = scm_gc_malloc(sizeof(*template) +
+			     (count - 1) * sizeof(template->ops[0]),
+			     "pcre-template");
+    template->regexp = pcre_smob;
+    template->source = source;
+    template->literals = scm_gc_malloc_pointerless(len + 1, "pcre-template");
+    template->count = 0;
+
+    op = NULL;
+    for (i = 0; i < len; ) {
+	int group = -1;
+
+	if (bytes[i] != '$' || (i + 1 < len && bytes[i + 1] == '$')) {
+	    if (op == NULL || op->group != -1) {
+		op = &template->ops[template->count++];
+		op->group = -1;
+		op->start = literal_len;
+		op->len = 0;
+	    }
+	    template->literals[literal_len++] = bytes[i];
+	    ++op->len;
+	    i += bytes[i] == '$' ? 2 : 1;
+	    continue;
+	}
+
+	if (i + 1 < len && bytes[i + 1] == '{') {
+	    end = memchr(bytes + i + 2, '}', len - i - 2);
+	    if (end == NULL)
+		guile_pcre_template_error("unterminated ${ in template ~S",
+					  scm_list_1(source));
+	    group = guile_pcre_template_group(regexp, bytes + i + 2,
+					      end - (bytes + i + 2));
+	    i = end - bytes + 1;
+	} else {
+	    size_t digits = i + 1;
+
+	    while (digits < len && isdigit((unsigned char) bytes[digits]))
+		++digits;
+	    if (digits == i + 1)
+		guile_pcre_template_error("stray $ in template ~S",
+					  scm_list_1(source));
+	    group = guile_pcre_template_group(regexp, bytes + i + 1,
+					      digits - i - 1);
+	    i = digits;
+	}
+	op = &template->ops[template->count++];
+	op->group = group;
+	op->start = 0;
+	op->len = 0;
+    }
+    scm_dynwind_end();
+    scm_remember_upto_here_1(pcre_smob);
+
+    SCM_RETURN_NEWSMOB(pcre_template_tag, template);
+}
+
+static SCM guile_pcre_template_p(SCM obj)
+{
+    return scm_from_bool(SCM_SMOB_PREDICATE(pcre_template_tag, obj));
+}
+
+static struct guile_pcre_template *
+guile_pcre_replacement(const char *subr, SCM pcre_smob, SCM replacement)
+{
+    struct guile_pcre *regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    struct guile_pcre_template *template;
+    SCM cached = regexp->template;
+
+    if (SCM_SMOB_PREDICATE(pcre_template_tag, replacement)) {
+	template = (struct guile_pcre_template *) SCM_SMOB_DATA(replacement);
+	if (!scm_is_eq(template->regexp, pcre_smob))
+	    scm_error_scm(scm_from_latin1_symbol("pcre-error"),
+			  scm_from_latin1_string(subr),
+			  scm_from_latin1_string("template compiled for ~S"),
+			  scm_list_1(template->regexp), SCM_BOOL_F);
+	return template;
+    }
+    if (scm_is_true(scm_procedure_p(replacement)))
+	return NULL;
+    SCM_ASSERT_TYPE(scm_is_string(replacement), replacement, SCM_ARG3, subr,
+		    "string, template or procedure");
+
+    if (scm_is_true(cached)) {
+	template = (struct guile_pcre_template *) SCM_SMOB_DATA(cached);
+	if (scm_is_true(scm_string_eq(replacement, template->source,
+				      SCM_UNDEFINED, SCM_UNDEFINED,
+				      SCM_UNDEFINED, SCM_UNDEFINED)))
+	    return template;
+    }
+    cached = guile_pcre_compile_template(pcre_smob, replacement);
+    regexp->template = cached;
+    return (struct guile_pcre_template *) SCM_SMOB_DATA(cached);
+}
+
+static SCM guile_pcre_replace(const char *subr, SCM pcre_smob, SCM string,
+			      SCM replacement, SCM options, int all)
+{
+    struct guile_pcre_matches matches;
+    struct guile_pcre_template *template;
+    struct guile_pcre_subject *subject = &matches.subject;
+    SCM rv = string;
+    int flags = guile_pcre_flags(options);
+    int *captures;
+    int copied = 0;
+    int replaced = 0;
+    char *out = NULL;
+    size_t out_size = 0;
+    size_t out_len = 0;
+    char *piece = NULL;
+    size_t piece_size = 0;
+    int i;
+    int rc;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    template = guile_pcre_replacement(subr, pcre_smob, replacement);
+
+    scm_dynwind_begin(0);
+    scm_dynwind_unwind_handler(free_port_buffer, &out, SCM_F_WIND_EXPLICITLY);
+    scm_dynwind_unwind_handler(free_port_buffer, &piece,
+			       SCM_F_WIND_EXPLICITLY);
+    guile_pcre_matches_init(&matches, subr, pcre_smob, string, flags);
+    captures = matches.captures;
+
+    while ((rc = guile_pcre_matches_next(&matches)) > 0) {
+	replaced = 1;
+	guile_pcre_append_subject(&out, &out_size, &out_len, subject, copied,
+				  captures[0]);
+	if (template) {
+	    for (i = 0; i < template->count; ++i) {
+		const struct guile_pcre_template_op *op = &template->ops[i];
+
+		if (op->group < 0)
+		    guile_pcre_append(&out, &out_size, &out_len,
+				      template->literals + op->start, op->len);
+		else if (op->group < rc && captures[2 * op->group] >= 0)
+		    guile_pcre_append_subject(&out, &out_size, &out_len,
+					      subject, captures[2 * op->group],
+					      captures[2 * op->group + 1]);
+	    }
+	} else {
+	    SCM text = scm_call_1(replacement,
+				  guile_pcre_make_match(pcre_smob, string,
+							captures, rc,
+							subject));
+
+	    if (scm_is_bytevector(text))
+		guile_pcre_append(&out, &out_size, &out_len,
+				  (const char *) SCM_BYTEVECTOR_CONTENTS(text),
+				  SCM_BYTEVECTOR_LENGTH(text));
+	    else {
+		size_t n;
+
+		SCM_ASSERT_TYPE(scm_is_string(text), text, SCM_ARGn, subr,
+				"string returned by the replacement");
+		guile_pcre_encode_utf8(text, &piece, &piece_size, &n);
+		guile_pcre_append(&out, &out_size, &out_len, piece, n);
+	    }
+	    scm_remember_upto_here_1(text);
+	}
+	copied = captures[1] > copied ? captures[1] : copied;
+	if (!all)
+	    break;
+    }
+
+    if (replaced) {
+	guile_pcre_append_subject(&out, &out_size, &out_len, subject, copied,
+				  subject->len);
+	if (scm_is_bytevector(string)) {
+	    rv = scm_c_make_bytevector(out_len);
+	    memcpy(SCM_BYTEVECTOR_CONTENTS(rv), out, out_len);
+	} else
+	    rv = scm_from_utf8_stringn(out, out_len);
+    }
+
+    scm_dynwind_end();
+    scm_remember_upto_here_2(pcre_smob, string);
+
+    return rv;
+}
+
+static SCM guile_pcre_substitute(SCM pcre_smob, SCM string, SCM replacement,
+				 SCM options)
+{
+    return guile_pcre_replace("pcre-substitute", pcre_smob, string,
+			      replacement, options, 0);
+}
+
+static SCM guile_pcre_substitute_all(SCM pcre_smob, SCM string,
+				     SCM replacement, SCM options)
+{
+    return guile_pcre_replace("pcre-substitute-all", pcre_smob, string,
+			      replacement, options, 1);
+}
+
+static void guile_pcre_push_span(char **spans, size_t *size, size_t *len,
+				 long start, long end)
+{
+    long span[2];
+
+    span[0] = start;
+    span[1] = end;
+    guile_pcre_append(spans, size, len, (const char *) span, sizeof(span));
+}
+
+static SCM guile_pcre_span_list(SCM string, const char *spans, size_t len)
+{
+    const long *span = (const long *) spans;
+    size_t i = len / sizeof(span[0]);
+    SCM rv = SCM_EOL;
+
+    for (; i > 0; i -= 2)
+	rv = scm_cons(span[i - 2] < 0 ? SCM_BOOL_F :
+		      guile_pcre_subject_slice(string, span[i - 2],
+					       span[i - 1]),
+		      rv);
+    return rv;
+}
+
+static SCM guile_pcre_split(SCM pcre_smob, SCM string, SCM limit, SCM groups,
+			    SCM options)
+{
+    struct guile_pcre_matches matches;
+    struct guile_pcre_subject *subject = &matches.subject;
+    SCM rv;
+    int flags = guile_pcre_flags(options);
+    int with_groups = !SCM_UNBNDP(groups) && scm_is_true(groups);
+    int max_fields = INT_MAX;
+    int fields = 1;
+    int capture_count;
+    int *captures;
+    long field_start = 0;
+    char *spans = NULL;
+    size_t spans_size = 0;
+    size_t spans_len = 0;
+    int i;
+    int rc;
+
+    if (!SCM_UNBNDP(limit) && scm_is_true(limit))
+	max_fields = scm_to_signed_integer(limit, 1, INT_MAX);
+
+    scm_dynwind_begin(0);
+    scm_dynwind_unwind_handler(free_port_buffer, &spans,
+			       SCM_F_WIND_EXPLICITLY);
+    guile_pcre_matches_init(&matches, "pcre-split", pcre_smob, string, flags);
+    capture_count = matches.regexp->capture_count;
+    captures = matches.captures;
+
+    while (fields < max_fields &&
+	   (rc = guile_pcre_matches_next(&matches)) > 0) {
+	guile_pcre_push_span(&spans, &spans_size, &spans_len, field_start,
+			     guile_pcre_char_index(subject, captures[0]));
+	for (i = 1; with_groups && i <= capture_count; ++i) {
+	    if (i < rc && captures[2 * i] >= 0)
+		guile_pcre_push_span(&spans, &spans_size, &spans_len,
+				     guile_pcre_char_index(subject,
+							   captures[2 * i]),
+				     guile_pcre_char_index(subject,
+							   captures[2 * i + 1]));
+	    else
+		guile_pcre_push_span(&spans, &spans_size, &spans_len, -1, -1);
+	}
+	field_start = guile_pcre_char_index(subject, captures[1]);
+	++fields;
+    }
+    guile_pcre_push_span(&spans, &spans_size, &spans_len, field_start,
+			 guile_pcre_char_index(subject, subject->len));
+    rv = guile_pcre_span_list(string, spans, spans_len);
+
+    scm_dynwind_end();
+    scm_remember_upto_here_2(pcre_smob, string);
+
+    return rv;
+}
+
+static SCM guile_pcre_tokenize(SCM pcre_smob, SCM string, SCM options)
+{
+    struct guile_pcre_matches matches;
+    struct guile_pcre_subject *subject = &matches.subject;
+    SCM rv;
+    int flags = guile_pcre_flags(options) | PCRE_ANCHORED |
+	PCRE_NOTEMPTY_ATSTART;
+    int *captures;
+    long start;
+    char *spans = NULL;
+    size_t spans_size = 0;
+    size_t spans_len = 0;
+    long *span;
+    size_t i;
+    int kind;
+    int rc;
+
+    scm_dynwind_begin(0);
+    scm_dynwind_unwind_handler(free_port_buffer, &spans,
+			       SCM_F_WIND_EXPLICITLY);
+    guile_pcre_matches_init(&matches, "pcre-tokenize", pcre_smob, string,
+			    flags);
+    captures = matches.captures;
+
+	    /* Each token is kept as its kind and its span, in turn.  Being
+	     * anchored and non-empty, each match starts where the last
+	     * ended. */
+    while (matches.offset < subject->len) {
+	rc = guile_pcre_matches_next(&matches);
+	if (rc == 0)
+	    scm_error_scm(scm_from_latin1_symbol("pcre-error"),
+			  scm_from_latin1_string("pcre-tokenize"),
+			  scm_from_latin1_string("no token at index ~A"),
+			  scm_list_1(scm_from_size_t
+				     (guile_pcre_char_index(subject,
+							    matches.offset))),
+			  SCM_BOOL_F);
+
+	for (kind = 1; kind < rc && captures[2 * kind] < 0; ++kind)
+	    ;
+	start = guile_pcre_char_index(subject, captures[0]);
+	guile_pcre_push_span(&spans, &spans_size, &spans_len,
+			     kind < rc ? kind : 0, start);
+	guile_pcre_push_span(&spans, &spans_size, &spans_len, start,
+			     guile_pcre_char_index(subject, captures[1]));
+    }
+
+    rv = SCM_EOL;
+    span = (long *) spans;
+    for (i = spans_len / sizeof(*span); i > 0; i -= 4)
+	rv = scm_cons(scm_cons(scm_from_long(span[i - 4]),
+			       scm_cons(scm_from_long(span[i - 2]),
+					scm_from_long(span[i - 1]))),
+		      rv);
+
+    scm_dynwind_end();
+    scm_remember_upto_here_2(pcre_smob, string);
+
+    return rv;
+}
+
+static SCM mark_pcre_template(SCM template_smob)
+{
+    struct guile_pcre_template *template =
+	(struct guile_pcre_template *) SCM_SMOB_DATA(template_smob);
+
+    scm_gc_mark(template->source);
+    return template->regexp;
+}
+
+struct guile_pcre_batch_subject
+{
+    const char *bytes;		/* NULL until resolved into ARENA */
+    size_t arena_offset;
+    int  len;
+    int  mapped;
+    int  wide;			/* BYTES holds 32-bit characters */
+};
+
+struct guile_pcre_batch
+{
+    struct guile_pcre *regexp;
+    pcre_extra extra;
+    const pcre_extra *extrap;
+#ifdef GUILE_PCRE_WIDE
+    pcre32_extra extra32;	/* for the wide subjects */
+#endif
+    int  flags;
+    int  count;
+    struct guile_pcre_batch_subject *subjects;
+    char *arena;		/* UTF-8 of the string subjects */
+    int  *rcs;
+    int  *offsets;		/* PAIRS pairs per subject, or NULL */
+    int  pairs;
+    int  threads;
+    int  next;
+    struct guile_pcre_counters *counters;	/* if instrumented */
+};
+
+#define GUILE_PCRE_BATCH_CHUNK 64
+
+#define GUILE_PCRE_POOL_MAX 64
+
+struct guile_pcre_pool_job
+{
+    void *(*run)(void *);
+    void *data;
+    int  wanted;
+    int  running;
+};
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static struct guile_pcre_pool_job *pool_job;
+static int pool_threads;
+
+static void *guile_pcre_pool_thread(void *unused)
+{
+    struct guile_pcre_pool_job *job;
+
+    (void) unused;
+    pthread_mutex_lock(&pool_mutex);
+    for (;;) {
+	while (pool_job == NULL || pool_job->wanted == 0)
+	    pthread_cond_wait(&pool_work, &pool_mutex);
+	job = pool_job;
+	--job->wanted;
+	pthread_mutex_unlock(&pool_mutex);
+	job->run(job->data);
+	pthread_mutex_lock(&pool_mutex);
+	if (--job->running == 0)
+	    pthread_cond_broadcast(&pool_done);
+    }
+    return NULL;
+}
+
+static void guile_pcre_pool_run(void *(*run)(void *), void *data,
+				int helpers)
+{
+    struct guile_pcre_pool_job job;
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    job.run = run;
+    job.data = data;
+    job.wanted = 0;
+    job.running = 0;
+    if (helpers > GUILE_PCRE_POOL_MAX)
+	helpers = GUILE_PCRE_POOL_MAX;
+    pthread_mutex_lock(&pool_mutex);
+    if (pool_job == NULL && helpers > 0) {
+	if (pool_threads < helpers && pthread_attr_init(&attr) == 0) {
+	    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	    while (pool_threads < helpers &&
+		   pthread_create(&thread, &attr, guile_pcre_pool_thread,
+				  NULL) == 0)
+		++pool_threads;
+	    pthread_attr_destroy(&attr);
+	}
+	job.wanted = helpers < pool_threads ? helpers : pool_threads;
+	job.running = job.wanted;
+	if (job.wanted > 0) {
+	    pool_job = &job;
+	    pthread_cond_broadcast(&pool_work);
+	}
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    run(data);
+
+	/* Workers that have not yet picked the job up would find nothing
+	 * left to do. */
+    pthread_mutex_lock(&pool_mutex);
+    job.running -= job.wanted;
+    job.wanted = 0;
+    while (job.running > 0)
+	pthread_cond_wait(&pool_done, &pool_mutex);
+    if (pool_job == &job)
+	pool_job = NULL;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+static void *guile_pcre_batch_worker(void *data)
+{
+    struct guile_pcre_batch *batch = data;
+    struct guile_pcre_scratch *scratch = guile_pcre_thread_scratch();
+    int ovec_count = batch->pairs * 3;
+    int *ovector = NULL;
+    int i;
+    int end;
+
+    if (scratch == NULL)
+	return NULL;
+    if (batch->offsets) {
+	ovector = guile_pcre_grow_ovector(scratch, ovec_count);
+	if (ovector == NULL)
+	    return NULL;
+    }
+    scratch->pooled_jit_stack = 1;
+    for (;;) {
+	i = __atomic_fetch_add(&batch->next, GUILE_PCRE_BATCH_CHUNK,
+			       __ATOMIC_RELAXED);
+	if (i >= batch->count)
+	    break;
+	end = batch->count - i < GUILE_PCRE_BATCH_CHUNK ? batch->count
+	    : i + GUILE_PCRE_BATCH_CHUNK;
+	for (; i < end; ++i) {
+	    const struct guile_pcre_batch_subject *subject =
+		&batch->subjects[i];
+	    uint64_t start = 0;
+	    int rc;
+
+	    if (!subject->wide &&
+		guile_pcre_prefilter_rejects(batch->regexp, subject->bytes,
+					     subject->len, 0, batch->flags))
+		rc = PCRE_ERROR_NOMATCH;
+	    else {
+		size_t bytes = (size_t) subject->len * (subject->wide ? 4 : 1);
+
+		if (batch->counters)
+		    start = guile_pcre_now_ns();
+#ifdef GUILE_PCRE_WIDE
+		if (subject->wide)
+		    rc = pcre32_exec(batch->regexp->regexp32, &batch->extra32,
+				     (PCRE_SPTR32) subject->bytes, subject->len,
+				     0, batch->flags, ovector,
+				     ovector ? ovec_count : 0);
+		else
+#endif
+		rc = pcre_exec(batch->regexp->regexp, batch->extrap,
+			       subject->bytes, subject->len, 0, batch->flags,
+			       ovector, ovector ? ovec_count : 0);
+		if (batch->counters) {
+		    uint64_t ns = guile_pcre_now_ns() - start;
+
+		    guile_pcre_count(batch->counters, rc, bytes, ns);
+		    guile_pcre_count(&global_counters, rc, bytes, ns);
+		}
+	    }
+	    if (rc > 0 && ovector)
+		memcpy(batch->offsets + (size_t) i * batch->pairs * 2,
+		       ovector, rc * 2 * sizeof(*ovector));
+	    batch->rcs[i] = rc;
+	}
+    }
+    scratch->pooled_jit_stack = 0;
+    return NULL;
+}
+
+static void *guile_pcre_run_batch(void *data)
+{
+    struct guile_pcre_batch *batch = data;
+
+    guile_pcre_pool_run(guile_pcre_batch_worker, batch, batch->threads - 1);
+    return NULL;
+}
+
+static void free_batch(void *data)
+{
+    struct guile_pcre_batch *batch = data;
+
+    free(batch->subjects);
+    free(batch->arena);
+    free(batch->rcs);
+    free(batch->offsets);
+    __atomic_fetch_sub(&batch->regexp->detached_users, 1, __ATOMIC_RELEASE);
+}
+
+static SCM guile_pcre_exec_batch(SCM pcre_smob, SCM subjects, SCM mode,
+				 SCM threads, SCM options)
+{
+    struct guile_pcre_batch batch;
+    struct guile_pcre_subject subject;
+    const pcre_extra *extrap;
+    char *buffer = NULL;
+    size_t size = 0;
+    size_t arena_size = 0;
+    size_t arena_len = 0;
+    size_t len;
+    SCM rv;
+    int booleans = 0;
+    int indices = 0;
+    int i;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    if (scm_is_pair(subjects) || scm_is_null(subjects))
+	subjects = scm_vector(subjects);
+    SCM_ASSERT(scm_is_vector(subjects), subjects, SCM_ARG2, "pcre-exec-batch");
+    if (!SCM_UNBNDP(mode) && scm_is_true(mode)) {
+	booleans = scm_is_eq(mode, scm_from_latin1_symbol("boolean"));
+	indices = scm_is_eq(mode, scm_from_latin1_symbol("index"));
+	if (!booleans && !indices &&
+	    !scm_is_eq(mode, scm_from_latin1_symbol("match")))
+	    scm_wrong_type_arg_msg("pcre-exec-batch", SCM_ARG3, mode,
+				   "match, boolean or index");
+    }
+
+    memset(&batch, 0, sizeof(batch));
+    batch.regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    batch.flags = guile_pcre_flags(options);
+    guile_pcre_check_exec_flags("pcre-exec-batch", batch.regexp, batch.flags);
+    batch.count = scm_c_vector_length(subjects);
+    batch.pairs = batch.regexp->capture_count + 1;
+    if (SCM_UNBNDP(threads) || scm_is_false(threads))
+	batch.threads = scm_to_int(scm_current_processor_count());
+    else
+	batch.threads = scm_to_int(threads);
+    if (batch.threads > (batch.count + GUILE_PCRE_BATCH_CHUNK - 1) /
+	GUILE_PCRE_BATCH_CHUNK)
+	batch.threads = (batch.count + GUILE_PCRE_BATCH_CHUNK - 1) /
+	    GUILE_PCRE_BATCH_CHUNK;
+    if (batch.threads < 1)
+	batch.threads = 1;
+
+    scm_dynwind_begin(0);
+    __atomic_fetch_add(&batch.regexp->detached_users, 1, __ATOMIC_ACQUIRE);
+    scm_dynwind_unwind_handler(free_batch, &batch, SCM_F_WIND_EXPLICITLY);
+    scm_dynwind_unwind_handler(free_port_buffer, &buffer,
+			       SCM_F_WIND_EXPLICITLY);
+
+    batch.subjects = scm_malloc((batch.count + 1) * sizeof(*batch.subjects));
+    batch.rcs = scm_malloc((batch.count + 1) * sizeof(*batch.rcs));
+    if (!booleans && !indices)
+	batch.offsets = scm_malloc(((size_t) batch.count * batch.pairs + 1) *
+				   2 * sizeof(*batch.offsets));
+    for (i = 0; i < batch.count; ++i) {
+	SCM string = scm_c_vector_ref(subjects, i);
+	struct guile_pcre_batch_subject *s = &batch.subjects[i];
+
+	s->wide = 0;
+	if (scm_is_bytevector(string)) {
+	    len = SCM_BYTEVECTOR_LENGTH(string);
+	    s->bytes = (const char *) SCM_BYTEVECTOR_CONTENTS(string);
+	    s->mapped = 0;
+#ifdef GUILE_PCRE_WIDE
+	} else if (scm_is_string(string) &&
+		   guile_pcre_own_wide(string, batch.regexp, &subject)) {
+		/* Copied as 32-bit characters, released by the dynwind
+		 * once the workers are done. */
+	    len = subject.len;
+	    s->bytes = subject.bytes;
+	    s->mapped = 0;
+	    s->wide = 1;
+#endif
+	} else if (scm_is_string(string)) {
+	    s->mapped = !guile_pcre_encode_utf8(string, &buffer, &size, &len);
+	    if (arena_size < arena_len + len) {
+		arena_size = arena_len + len > arena_size * 2 ?
+		    arena_len + len : arena_size * 2;
+		batch.arena = scm_realloc(batch.arena, arena_size);
+	    }
+	    memcpy(batch.arena + arena_len, buffer, len);
+	    s->bytes = NULL;
+	    s->arena_offset = arena_len;
+	    arena_len += len;
+	} else
+	    scm_wrong_type_arg_msg("pcre-exec-batch", SCM_ARG2, string,
+				   "string or bytevector");
+	if (len > INT_MAX)
+	    scm_out_of_range("pcre-exec-batch", string);
+	s->len = len;
+    }
+    free(buffer);
+    buffer = NULL;
+    for (i = 0; i < batch.count; ++i)
+	if (batch.subjects[i].bytes == NULL)
+	    batch.subjects[i].bytes = batch.arena +
+		batch.subjects[i].arena_offset;
+
+	    /* A private copy, so later changes to the regexp's limits
+	     * don't race with the workers. */
+    extrap = guile_pcre_exec_extra(batch.regexp, &batch.extra);
+    if (extrap && extrap != &batch.extra)
+	batch.extra = *extrap;
+    batch.extrap = extrap ? &batch.extra : NULL;
+#ifdef GUILE_PCRE_WIDE
+    if (batch.regexp->regexp32)
+	guile_pcre_extra32(batch.regexp, batch.extrap, &batch.extra32);
+#endif
+    if (instrumentation) {
+	if (batch.regexp->counters == NULL)
+	    guile_pcre_instrument(pcre_smob, batch.regexp);
+	batch.counters = batch.regexp->counters;
+    }
+
+    for (i = 0; i < batch.count; ++i)
+	batch.rcs[i] = PCRE_ERROR_NOMEMORY;
+    scm_without_guile(guile_pcre_run_batch, &batch);
+
+    for (i = 0; i < batch.count; ++i)
+	if (batch.rcs[i] < 0 && batch.rcs[i] != PCRE_ERROR_NOMATCH)
+	    guile_pcre_exec_error("pcre-exec-batch", batch.rcs[i]);
+
+    if (indices) {
+	rv = SCM_EOL;
+	for (i = batch.count - 1; i >= 0; --i)
+	    if (batch.rcs[i] >= 0)
+		rv = scm_cons(scm_from_int(i), rv);
+    } else {
+	rv = scm_c_make_vector(batch.count, SCM_BOOL_F);
+	for (i = 0; i < batch.count; ++i) {
+	    if (batch.rcs[i] < 0)
+		continue;
+	    if (booleans) {
+		scm_c_vector_set_x(rv, i, SCM_BOOL_T);
+		continue;
+	    }
+	    guile_pcre_init_subject(&subject, batch.subjects[i].bytes,
+				    batch.subjects[i].len,
+				    batch.subjects[i].mapped);
+	    subject.wide = batch.subjects[i].wide;
+	    scm_c_vector_set_x(rv, i,
+			       guile_pcre_make_match(pcre_smob,
+						     scm_c_vector_ref(subjects, i),
+						     batch.offsets + (size_t) i *
+						     batch.pairs * 2,
+						     batch.rcs[i], &subject));
+	}
+    }
+
+    scm_dynwind_end();
+    scm_remember_upto_here_2(pcre_smob, subjects);
+
+    return rv;
+}
+
+struct guile_pcre_grep_hit
+{
+    size_t line_start;
+    size_t line_end;		/* the newline ending the line, or EOF */
+    size_t line;		/* newlines in the range before LINE_START */
+    int  rc;
+};
+
+struct guile_pcre_grep_range
+{
+    size_t start;
+    size_t end;
+    size_t pos;			/* where the next search begins */
+    size_t counted;		/* a line start; newlines before it ... */
+    size_t lines;		/* ... in the range number LINES */
+    size_t checked;		/* UTF-8 validated up to here */
+    struct guile_pcre_grep_hit *hits;
+    int  *offsets;		/* PAIRS pairs per hit */
+    size_t hit_count;
+    size_t hit_size;
+    int  rc;
+};
+
+struct guile_pcre_grep
+{
+    struct guile_pcre *regexp;
+    pcre_extra extra;
+    const pcre_extra *extrap;
+    pcre_extra *partial_extra;	/* JIT code for PCRE_PARTIAL_HARD */
+    const char *bytes;
+    size_t len;
+    void *map;			/* BYTES when the file is mapped ... */
+    char *buffer;		/* ... and when it is read */
+    size_t lookbehind;
+    int  flags;
+    int  pairs;
+    int  threads;
+    int  detached;		/* holding the regexp's detached_users */
+    struct guile_pcre_grep_range *ranges;
+    int  range_count;
+    int  next;
+    struct guile_pcre_counters *counters;	/* if instrumented */
+};
+
+#define GUILE_PCRE_GREP_BLOCK (1 << 20)
+#define GUILE_PCRE_GREP_MIN_RANGE (1 << 16)
+
+static void free_grep(void *data)
+{
+    struct guile_pcre_grep *grep = data;
+    int i;
+
+    if (grep->map)
+	munmap(grep->map, grep->len);
+    free(grep->buffer);
+    for (i = 0; grep->ranges && i < grep->range_count; ++i) {
+	free(grep->ranges[i].hits);
+	free(grep->ranges[i].offsets);
+    }
+    free(grep->ranges);
+    if (grep->partial_extra)
+	pcre_free_study(grep->partial_extra);
+    if (grep->detached)
+	__atomic_fetch_sub(&grep->regexp->detached_users, 1,
+			   __ATOMIC_RELEASE);
+}
+
+static void guile_pcre_grep_open(struct guile_pcre_grep *grep, SCM filename)
+{
+    struct stat st;
+    char *path;
+    size_t size = 0;
+    ssize_t n = 0;
+    int  fd;
+    int  err;
+
+    path = scm_to_locale_string(filename);
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0)
+	scm_syserror("pcre-grep-file");
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (addr != MAP_FAILED) {
+	    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+	    close(fd);
+	    grep->map = addr;
+	    grep->bytes = addr;
+	    grep->len = st.st_size;
+	    return;
+	}
+    }
+    for (;;) {
+	if (size - grep->len < GUILE_PCRE_GREP_BLOCK) {
+	    size_t new_size = size ? size * 2 : GUILE_PCRE_GREP_BLOCK;
+	    char *buffer = realloc(grep->buffer, new_size);
+
+	    if (buffer == NULL) {
+		errno = ENOMEM;
+		n = -1;
+		break;
+	    }
+	    grep->buffer = buffer;
+	    size = new_size;
+	}
+	n = read(fd, grep->buffer + grep->len, size - grep->len);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    break;
+	grep->len += n;
+    }
+    err = errno;
+    close(fd);
+    if (n < 0) {
+	errno = err;
+	scm_syserror("pcre-grep-file");
+    }
+    grep->bytes = grep->buffer;
+}
+
+static size_t guile_pcre_count_lines(const char *bytes, size_t len,
+				     size_t *after)
+{
+    const char *p = bytes;
+    const char *end = bytes + len;
+    size_t count = 0;
+
+    *after = 0;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+	++count;
+	*after = ++p - bytes;
+    }
+    return count;
+}
+
+static int guile_pcre_grep_exec(struct guile_pcre_grep *grep,
+				struct guile_pcre_grep_range *range,
+				size_t start, size_t end, size_t pos,
+				int options, int *ovector)
+{
+    const char *subject = grep->bytes + start;
+    int  flags = grep->flags | options;
+    int  rc;
+
+    if (end < grep->len)
+	flags |= PCRE_PARTIAL_HARD;
+    if (grep->regexp->utf8 && end <= range->checked)
+	flags |= PCRE_NO_UTF8_CHECK;
+    if (guile_pcre_prefilter_rejects(grep->regexp, subject, end - start,
+				     pos - start, flags))
+	return PCRE_ERROR_NOMATCH;
+    if (grep->threads == 1)
+	rc = guile_pcre_call_exec(grep->regexp, grep->extrap, subject,
+				  end - start, pos - start, flags, ovector,
+				  grep->pairs * 3);
+    else {
+	uint64_t ns = grep->counters ? guile_pcre_now_ns() : 0;
+
+	rc = pcre_exec(grep->regexp->regexp, grep->extrap, subject,
+		       end - start, pos - start, flags, ovector,
+		       grep->pairs * 3);
+	if (grep->counters) {
+	    ns = guile_pcre_now_ns() - ns;
+	    guile_pcre_count(grep->counters, rc, end - start, ns);
+	    guile_pcre_count(&global_counters, rc, end - start, ns);
+	}
+    }
+    if ((rc >= 0 || rc == PCRE_ERROR_NOMATCH || rc == PCRE_ERROR_PARTIAL) &&
+	end > range->checked)
+	range->checked = end;
+    return rc;
+}
+
+static int guile_pcre_grep_next(struct guile_pcre_grep *grep,
+				struct guile_pcre_grep_range *range,
+				struct guile_pcre_grep_hit *hit, int *ovector)
+{
+    const char *bytes = grep->bytes;
+    const char *nl;
+    size_t start;
+    size_t end;
+    size_t first;
+    size_t last;
+    size_t after;
+    size_t offset;
+    int  utf8 = grep->regexp->utf8;
+    int  rc;
+    int  i;
+
+    for (;;) {
+	if (range->pos >= range->end)
+	    return PCRE_ERROR_NOMATCH;
+	start = range->pos > grep->lookbehind ?
+	    range->pos - grep->lookbehind : 0;
+	while (utf8 && start > 0 && (bytes[start] & 0xc0) == 0x80)
+	    --start;
+	end = range->end - start > INT_MAX ? start + INT_MAX : range->end;
+	while (utf8 && end < range->end && (bytes[end] & 0xc0) == 0x80)
+	    --end;
+	rc = guile_pcre_grep_exec(grep, range, start, end, range->pos, 0,
+				  ovector);
+	if (rc == PCRE_ERROR_PARTIAL && start + ovector[0] > range->pos) {
+		/* Begin again at the partial match, with as much ahead
+		 * of it as pcre will take. */
+	    range->pos = start + ovector[0];
+	    continue;
+	}
+	if (rc == PCRE_ERROR_PARTIAL && end == range->end) {
+		/* It may end beyond the range: try it there alone. */
+	    end = grep->len - start > INT_MAX ? start + INT_MAX : grep->len;
+	    while (utf8 && end < grep->len && (bytes[end] & 0xc0) == 0x80)
+		--end;
+	    rc = guile_pcre_grep_exec(grep, range, start, end, range->pos,
+				      PCRE_ANCHORED, ovector);
+	}
+	if (rc == PCRE_ERROR_PARTIAL ||
+	    (rc == PCRE_ERROR_NOMATCH && end > range->end)) {
+		/* No match there after all, or one longer than pcre
+		 * can take: go on from the next character. */
+	    ++range->pos;
+	    while (utf8 && range->pos < grep->len &&
+		   (bytes[range->pos] & 0xc0) == 0x80)
+		++range->pos;
+	    continue;
+	}
+	if (rc == PCRE_ERROR_NOMATCH && end < range->end) {
+	    range->pos = end;
+	    continue;
+	}
+	if (rc == PCRE_ERROR_NOMATCH)
+	    range->pos = range->end;
+	if (rc < 0)
+	    return rc;
+	break;
+    }
+    if (rc == 0)
+	rc = grep->pairs;
+
+	/* A match from the end of the range on is the next range's, and
+	 * one at the end of the file starts a line only when the file
+	 * doesn't end with a newline. */
+    first = start + ovector[0];
+    if (first > range->end ||
+	(first == range->end &&
+	 (first < grep->len || grep->len == 0 ||
+	  bytes[grep->len - 1] == '\n'))) {
+	range->pos = range->end;
+	return PCRE_ERROR_NOMATCH;
+    }
+    last = start + ovector[1] > first ? start + ovector[1] - 1 : first;
+
+    range->lines += guile_pcre_count_lines(bytes + range->counted,
+					   first - range->counted, &after);
+    range->counted += after;
+    hit->line_start = range->counted;
+    hit->line = range->lines;
+    nl = memchr(bytes + last, '\n', grep->len - last);
+    hit->line_end = nl ? (size_t) (nl - bytes) : grep->len;
+    range->pos = hit->line_end + 1;
+    if (grep->regexp->crlf_newline && hit->line_end > hit->line_start &&
+	bytes[hit->line_end - 1] == '\r')
+	--hit->line_end;
+    hit->rc = rc;
+
+    for (i = 0; i < rc * 2; ++i) {
+	if (ovector[i] < 0)
+	    continue;
+	offset = start + ovector[i];
+	offset = offset < hit->line_start ? hit->line_start
+	    : offset > hit->line_end ? hit->line_end : offset;
+	ovector[i] = offset - hit->line_start;
+    }
+    return rc;
+}
+
+static int guile_pcre_grep_keep(const struct guile_pcre_grep *grep,
+				struct guile_pcre_grep_range *range,
+				const struct guile_pcre_grep_hit *hit,
+				const int *ovector)
+{
+    size_t pairs = grep->pairs;
+
+    if (range->hit_count == range->hit_size) {
+	size_t size = range->hit_size ? range->hit_size * 2 : 64;
+	struct guile_pcre_grep_hit *hits;
+	int *offsets;
+
+	hits = realloc(range->hits, size * sizeof(*hits));
+	if (hits == NULL)
+	    return 0;
+	range->hits = hits;
+	offsets = realloc(range->offsets, size * pairs * 2 * sizeof(*offsets));
+	if (offsets == NULL)
+	    return 0;
+	range->offsets = offsets;
+	range->hit_size = size;
+    }
+    range->hits[range->hit_count] = *hit;
+    memcpy(range->offsets + range->hit_count * pairs * 2, ovector,
+	   hit->rc * 2 * sizeof(*ovector));
+    ++range->hit_count;
+    return 1;
+}
+
+static void *guile_pcre_grep_worker(void *data)
+{
+    struct guile_pcre_grep *grep = data;
+    struct guile_pcre_scratch *scratch = guile_pcre_thread_scratch();
+    struct guile_pcre_grep_range *range;
+    struct guile_pcre_grep_hit hit;
+    int *ovector;
+    size_t after;
+    int i;
+
+    if (scratch == NULL)
+	return NULL;
+    ovector = guile_pcre_grow_ovector(scratch, grep->pairs * 3);
+    if (ovector == NULL)
+	return NULL;
+    scratch->pooled_jit_stack = 1;
+    while ((i = __atomic_fetch_add(&grep->next, 1, __ATOMIC_RELAXED)) <
+	   grep->range_count) {
+	range = &grep->ranges[i];
+	while ((range->rc = guile_pcre_grep_next(grep, range, &hit,
+						 ovector)) >= 0)
+	    if (!guile_pcre_grep_keep(grep, range, &hit, ovector)) {
+		range->rc = PCRE_ERROR_NOMEMORY;
+		break;
+	    }
+	range->lines += guile_pcre_count_lines(grep->bytes + range->counted,
+					       range->end - range->counted,
+					       &after);
+    }
+    scratch->pooled_jit_stack = 0;
+    return NULL;
+}
+
+static void *guile_pcre_run_grep(void *data)
+{
+    struct guile_pcre_grep *grep = data;
+
+    guile_pcre_pool_run(guile_pcre_grep_worker, grep, grep->threads - 1);
+    return NULL;
+}
+
+static const pcre_extra *guile_pcre_grep_study(struct guile_pcre_grep *grep,
+					       const pcre_extra *extra)
+{
+    int  limits = PCRE_EXTRA_MATCH_LIMIT | PCRE_EXTRA_MATCH_LIMIT_RECURSION;
+    const char *error_ptr = NULL;
+    pcre_extra *partial;
+    int  jit = 0;
+
+    if (extra == NULL ||
+	pcre_fullinfo(grep->regexp->regexp, extra, PCRE_INFO_JIT, &jit) ||
+	!jit)
+	return extra;
+    partial = pcre_study(grep->regexp->regexp, PCRE_STUDY_JIT_COMPILE |
+			 PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE, &error_ptr);
+    if (partial == NULL)
+	return extra;
+    if (pcre_fullinfo(grep->regexp->regexp, partial, PCRE_INFO_JIT, &jit) ||
+	!jit) {
+	pcre_free_study(partial);
+	return extra;
+    }
+    grep->partial_extra = partial;
+    pcre_assign_jit_stack(partial, guile_pcre_jit_stack, grep->regexp);
+    partial->flags |= extra->flags & limits;
+    partial->match_limit = extra->match_limit;
+    partial->match_limit_recursion = extra->match_limit_recursion;
+    return partial;
+}
+
+static SCM guile_pcre_grep_deliver(SCM pcre_smob,
+				   const struct guile_pcre_grep *grep,
+				   const struct guile_pcre_grep_hit *hit,
+				   const int *ovector, size_t base, SCM proc,
+				   SCM seed)
+{
+    struct guile_pcre_subject subject;
+    SCM line;
+
+    guile_pcre_init_subject(&subject, grep->bytes + hit->line_start,
+			    hit->line_end - hit->line_start, 1);
+    line = scm_from_utf8_stringn(subject.bytes, subject.len);
+    return scm_call_4(proc, scm_from_size_t(base + hit->line + 1), line,
+		      guile_pcre_make_match(pcre_smob, line, ovector, hit->rc,
+					    &subject),
+		      seed);
+}
+
+static SCM guile_pcre_grep_file(SCM pcre_smob, SCM filename, SCM init,
+				SCM proc, SCM threads, SCM options)
+{
+    struct guile_pcre_grep grep;
+    struct guile_pcre_grep_hit hit;
+    const pcre_extra *extrap;
+    const char *nl;
+    SCM rv = init;
+    int lookbehind = 0;
+    int *ovector;
+    size_t base;
+    size_t prev;
+    size_t end;
+    size_t j;
+    int rc;
+    int i;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    memset(&grep, 0, sizeof(grep));
+    grep.regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    grep.flags = guile_pcre_flags(options);
+    guile_pcre_check_exec_flags("pcre-grep-file", grep.regexp, grep.flags);
+    grep.pairs = grep.regexp->capture_count + 1;
+    if (SCM_UNBNDP(threads) || scm_is_false(threads))
+	grep.threads = 1;
+    else
+	grep.threads = scm_to_int(threads);
+    if (grep.threads < 1)
+	grep.threads = 1;
+    pcre_fullinfo(grep.regexp->regexp, NULL, PCRE_INFO_MAXLOOKBEHIND,
+		  &lookbehind);
+    grep.lookbehind = (size_t) (lookbehind + 1) * (grep.regexp->utf8 ? 4 : 1);
+    if (instrumentation && grep.regexp->counters == NULL)
+	guile_pcre_instrument(pcre_smob, grep.regexp);
+
+    scm_dynwind_begin(0);
+    scm_dynwind_unwind_handler(free_grep, &grep, SCM_F_WIND_EXPLICITLY);
+    guile_pcre_grep_open(&grep, filename);
+
+    grep.range_count = 1;
+    if (grep.threads > 1 &&
+	grep.len / GUILE_PCRE_GREP_MIN_RANGE > 1)
+	grep.range_count = grep.len / GUILE_PCRE_GREP_MIN_RANGE <
+	    (size_t) grep.threads * 4 ? grep.len / GUILE_PCRE_GREP_MIN_RANGE
+	    : grep.threads * 4;
+    if (grep.threads > grep.range_count)
+	grep.threads = grep.range_count;
+    grep.ranges = scm_calloc(grep.range_count * sizeof(*grep.ranges));
+    for (i = 0, prev = 0; i < grep.range_count; ++i) {
+	end = grep.len / grep.range_count * (i + 1);
+	if (i == grep.range_count - 1 || end >= grep.len)
+	    end = grep.len;
+	else if (end < prev)
+	    end = prev;
+	else {
+	    nl = memchr(grep.bytes + end, '\n', grep.len - end);
+	    end = nl ? (size_t) (nl - grep.bytes) + 1 : grep.len;
+	}
+	grep.ranges[i].start = grep.ranges[i].pos = prev;
+	grep.ranges[i].counted = grep.ranges[i].checked = prev;
+	grep.ranges[i].end = end;
+	grep.ranges[i].rc = PCRE_ERROR_NOMEMORY;
+	prev = end;
+    }
+
+    extrap = guile_pcre_exec_extra(grep.regexp, &grep.extra);
+    if (grep.range_count > 1 || grep.len > INT_MAX)
+	extrap = guile_pcre_grep_study(&grep, extrap);
+    if (grep.threads == 1) {
+	ovector = scm_malloc(grep.pairs * 3 * sizeof(*ovector));
+	scm_dynwind_free(ovector);
+	grep.extrap = extrap;
+	while ((rc = guile_pcre_grep_next(&grep, &grep.ranges[0], &hit,
+					  ovector)) >= 0)
+	    rv = guile_pcre_grep_deliver(pcre_smob, &grep, &hit, ovector, 0,
+					 proc, rv);
+	if (rc != PCRE_ERROR_NOMATCH)
+	    guile_pcre_exec_error("pcre-grep-file", rc);
+    } else {
+	    /* A private copy of the limits, as for a batch. */
+	if (extrap && extrap != &grep.extra)
+	    grep.extra = *extrap;
+	grep.extrap = extrap ? &grep.extra : NULL;
+	if (instrumentation)
+	    grep.counters = grep.regexp->counters;
+	grep.detached = 1;
+	__atomic_fetch_add(&grep.regexp->detached_users, 1, __ATOMIC_ACQUIRE);
+	scm_without_guile(guile_pcre_run_grep, &grep);
+	grep.detached = 0;
+	__atomic_fetch_sub(&grep.regexp->detached_users, 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < grep.range_count; ++i)
+	    if (grep.ranges[i].rc != PCRE_ERROR_NOMATCH)
+		guile_pcre_exec_error("pcre-grep-file", grep.ranges[i].rc);
+	for (i = 0, base = 0; i < grep.range_count; ++i) {
+	    const struct guile_pcre_grep_range *range = &grep.ranges[i];
+
+	    for (j = 0; j < range->hit_count; ++j)
+		rv = guile_pcre_grep_deliver(pcre_smob, &grep,
+					     &range->hits[j],
+					     range->offsets +
+					     j * grep.pairs * 2,
+					     base, proc, rv);
+	    base += range->lines;
+	}
+    }
+
+    scm_dynwind_end();
+    scm_remember_upto_here_1(pcre_smob);
+
+    return rv;
+}
+
+static int guile_pcre_set_key(const struct guile_pcre *regexp, int what,
+			      int flags_what)
+{
+    uint32_t c;
+    int flags = 0;
+
+    if (pcre_fullinfo(regexp->regexp, regexp->extra, flags_what, &flags) ||
+	flags != 1 ||
+	pcre_fullinfo(regexp->regexp, regexp->extra, what, &c))
+	return -1;
+    if (c > 0xff || (regexp->utf8 && c > 0x7f))
+	return -1;
+    if (c >= 'A' && c <= 'Z')
+	c += 'a' - 'A';
+    if (regexp->utf8 && (c == 'k' || c == 's'))
+	return -1;
+    return c;
+}
+
+static int guile_pcre_set_hash(const unsigned char *p, int mask)
+{
+    return ((((unsigned int) p[0] << 8) | p[1]) * 2654435761U >> 16) & mask;
+}
+
+static SCM guile_pcre_make_set(SCM regexps)
+{
+    struct guile_pcre_set *set;
+    size_t count;
+    size_t i;
+    size_t literals_size = 64;
+    int literals_len = 0;
+    int fill[256];
+    int with_literal = 0;
+    int buckets = 16;
+    int keyed = 0;
+    int any = 0;
+    int h;
+    int c;
+
+    SCM_ASSERT_TYPE(scm_is_vector(regexps), regexps, SCM_ARG1,
+		    "%make-pcre-set", "vector");
+    count = scm_c_vector_length(regexps);
+    if (count > INT_MAX)
+	scm_out_of_range("%make-pcre-set", regexps);
+
+    set = scm_gc_malloc(sizeof(*set), "pcre-set");
+    set->regexps = regexps;
+    set->count = count;
+    set->entries = scm_gc_malloc_pointerless(count * sizeof(*set->entries) + 1,
+					     "pcre-set");
+    set->literals = scm_gc_malloc_pointerless(literals_size, "pcre-set");
+    set->ids = scm_gc_malloc_pointerless(count * sizeof(*set->ids) + 1,
+					 "pcre-set");
+    memset(set->bucket, 0, sizeof(set->bucket));
+
+    for (i = 0; i < count; ++i) {
+	SCM smob = scm_c_vector_ref(regexps, i);
+	struct guile_pcre_set_entry *entry = &set->entries[i];
+	const struct guile_pcre *regexp;
+	const char *literal;
+	int min_length = -1;
+	int len;
+
+	scm_assert_smob_type(pcre_tag, smob);
+	regexp = (const struct guile_pcre *) SCM_SMOB_DATA(smob);
+	entry->first = guile_pcre_set_key(regexp, PCRE_INFO_FIRSTCHARACTER,
+					  PCRE_INFO_FIRSTCHARACTERFLAGS);
+	entry->required = guile_pcre_set_key(regexp, PCRE_INFO_REQUIREDCHAR,
+					     PCRE_INFO_REQUIREDCHARFLAGS);
+	if (regexp->extra)
+	    pcre_fullinfo(regexp->regexp, regexp->extra, PCRE_INFO_MINLENGTH,
+			  &min_length);
+	entry->min_length = min_length;
+	entry->literal = -1;
+	entry->literal_len = 0;
+	entry->window = 0;
+
+	literal = guile_pcre_literal(regexp, &len);
+	if (len == 1 && entry->required < 0) {
+	    c = (unsigned char) literal[0];
+	    entry->required = c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+	}
+	if (len >= 2) {
+	    if (literals_len + len > literals_size) {
+		char *grown;
+
+		literals_size = 2 * (literals_len + len);
+		grown = scm_gc_malloc_pointerless(literals_size, "pcre-set");
+		memcpy(grown, set->literals, literals_len);
+		set->literals = grown;
+	    }
+	    memcpy(set->literals + literals_len, literal, len);
+	    entry->literal = literals_len;
+	    entry->literal_len = len;
+	    literals_len += len;
+	    ++with_literal;
+	    continue;
+	}
+
+	    /* Index each pattern under one of its bytes, the required
+	     * one by preference as it is less often a common leading
+	     * character. */
+	c = entry->required >= 0 ? entry->required : entry->first;
+	if (c >= 0) {
+	    ++set->bucket[c + 1];
+	    ++keyed;
+	}
+    }
+
+	/* Hash each literal at its least crowded pair of bytes. */
+    while (buckets < 2 * with_literal && buckets < 65536)
+	buckets *= 2;
+    set->hash_mask = buckets - 1;
+    set->hash = scm_gc_malloc_pointerless((buckets + 1) * sizeof(*set->hash),
+					  "pcre-set");
+    memset(set->hash, 0, (buckets + 1) * sizeof(*set->hash));
+    set->literal_ids =
+	scm_gc_malloc_pointerless(with_literal * sizeof(*set->literal_ids) + 1,
+				  "pcre-set");
+    for (i = 0; i < count; ++i) {
+	struct guile_pcre_set_entry *entry = &set->entries[i];
+	const unsigned char *literal;
+	int best = 0;
+	int k;
+
+	if (entry->literal < 0)
+	    continue;
+	literal = (const unsigned char *) set->literals + entry->literal;
+	for (k = 1; k + 1 < entry->literal_len; ++k)
+	    if (set->hash[guile_pcre_set_hash(literal + k, set->hash_mask) + 1] <
+		set->hash[guile_pcre_set_hash(literal + best,
+					      set->hash_mask) + 1])
+		best = k;
+	entry->window = best;
+	++set->hash[guile_pcre_set_hash(literal + best, set->hash_mask) + 1];
+    }
+    for (h = 0; h < buckets; ++h)
+	set->hash[h + 1] += set->hash[h];
+    for (i = 0; i < count; ++i) {
+	const struct guile_pcre_set_entry *entry = &set->entries[i];
+
+	if (entry->literal < 0)
+	    continue;
+	h = guile_pcre_set_hash((const unsigned char *) set->literals +
+				entry->literal + entry->window,
+				set->hash_mask);
+	set->literal_ids[set->hash[h]++] = i;
+    }
+    for (h = buckets; h > 0; --h)
+	set->hash[h] = set->hash[h - 1];
+    set->hash[0] = 0;
+
+	/* Keyed patterns come first in IDS, bucket by bucket; the rest,
+	 * which must be tried on every subject, follow. */
+    for (c = 0; c < 256; ++c) {
+	set->bucket[c + 1] += set->bucket[c];
+	fill[c] = set->bucket[c];
+    }
+    for (i = 0; i < count; ++i) {
+	const struct guile_pcre_set_entry *entry = &set->entries[i];
+
+	if (entry->literal >= 0)
+	    continue;
+	c = entry->required >= 0 ? entry->required : entry->first;
+	if (c >= 0)
+	    set->ids[fill[c]++] = i;
+	else
+	    set->ids[keyed + any++] = i;
+    }
+    set->unkeyed_end = keyed + any;
+
+    SCM_RETURN_NEWSMOB(pcre_set_tag, set);
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+    return *(const int *) a - *(const int *) b;
+}
+
+static SCM guile_pcre_set_run(const char *subr, SCM set_smob, SCM string,
+			      int matches)
+{
+    struct guile_pcre_set *set;
+    struct guile_pcre_scratch *scratch;
+    struct guile_pcre_subject subject;
+    unsigned char present[256];
+    const unsigned char *p;
+    unsigned char *seen;
+    int *candidates;
+    int ncandidates = 0;
+    int ovec_count = 0;
+    int *ovector = NULL;
+    SCM rv = SCM_EOL;
+    int c;
+    int i;
+    int j;
+
+    scm_assert_smob_type(pcre_set_tag, set_smob);
+    set = (struct guile_pcre_set *) SCM_SMOB_DATA(set_smob);
+    scratch = guile_pcre_scratch();
+    guile_pcre_get_subject(subr, string, scratch, &subject, NULL);
+    candidates = guile_pcre_scratch_ids(scratch, set->count);
+    seen = guile_pcre_scratch_seen(scratch, set->count);
+
+	/* Note the bytes present and find the literals, each once. */
+    memset(present, 0, sizeof(present));
+    p = (const unsigned char *) subject.bytes;
+    for (i = 0; i < subject.len; ++i) {
+	c = p[i];
+	present[c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c] = 1;
+	if (i + 1 == subject.len)
+	    break;
+	c = guile_pcre_set_hash(p + i, set->hash_mask);
+	for (j = set->hash[c]; j < set->hash[c + 1]; ++j) {
+	    int id = set->literal_ids[j];
+	    const struct guile_pcre_set_entry *entry = &set->entries[id];
+	    int at = i - entry->window;
+
+	    if (!seen[id] && at >= 0 &&
+		entry->literal_len <= subject.len - at &&
+		memcmp(p + at, set->literals + entry->literal,
+		       entry->literal_len) == 0) {
+		seen[id] = 1;
+		candidates[ncandidates++] = id;
+	    }
+	}
+    }
+    for (i = 0; i < ncandidates; ++i)
+	seen[candidates[i]] = 0;
+
+    for (c = 0; c < 256; ++c)
+	if (present[c])
+	    for (i = set->bucket[c]; i < set->bucket[c + 1]; ++i)
+		candidates[ncandidates++] = set->ids[i];
+    for (i = set->bucket[256]; i < set->unkeyed_end; ++i)
+	candidates[ncandidates++] = set->ids[i];
+    qsort(candidates, ncandidates, sizeof(*candidates), compare_ids);
+
+    if (matches) {
+	for (i = 0; i < ncandidates; ++i) {
+	    const struct guile_pcre *regexp = (const struct guile_pcre *)
+		SCM_SMOB_DATA(scm_c_vector_ref(set->regexps, candidates[i]));
+
+	    if ((regexp->capture_count + 1) * 3 > ovec_count)
+		ovec_count = (regexp->capture_count + 1) * 3;
+	}
+	ovector = guile_pcre_scratch_ovector(scratch, ovec_count);
+    }
+
+    for (i = ncandidates - 1; i >= 0; --i) {
+	const struct guile_pcre_set_entry *entry =
+	    &set->entries[candidates[i]];
+	SCM smob = scm_c_vector_ref(set->regexps, candidates[i]);
+	struct guile_pcre *regexp = (struct guile_pcre *) SCM_SMOB_DATA(smob);
+	pcre_extra extra;
+	int rc;
+
+	if ((entry->first >= 0 && !present[entry->first]) ||
+	    (entry->required >= 0 && !present[entry->required]) ||
+	    entry->min_length > subject.len)
+	    continue;
+	rc = guile_pcre_subject_exec(regexp,
+				     guile_pcre_exec_extra(regexp, &extra),
+				     &subject, 0, 0, ovector,
+				     matches ? (regexp->capture_count + 1) * 3
+				     : 0);
+	if (rc == PCRE_ERROR_NOMATCH)
+	    continue;
+	if (rc < 0)
+	    guile_pcre_exec_error(subr, rc);
+	if (matches)
+	    rv = scm_cons(scm_cons(scm_from_int(candidates[i]),
+				   guile_pcre_make_match(smob, string, ovector,
+							 rc, &subject)),
+			  rv);
+	else
+	    rv = scm_cons(scm_from_int(candidates[i]), rv);
+    }
+
+    scm_remember_upto_here_2(set_smob, string);
+    return rv;
+}
+
+static SCM guile_pcre_set_match(SCM set_smob, SCM string)
+{
+    return guile_pcre_set_run("pcre-set-match", set_smob, string, 0);
+}
+
+static SCM guile_pcre_set_exec(SCM set_smob, SCM string)
+{
+    return guile_pcre_set_run("pcre-set-exec", set_smob, string, 1);
+}
+
+static SCM guile_pcre_set_p(SCM obj)
+{
+    return scm_from_bool(SCM_SMOB_PREDICATE(pcre_set_tag, obj));
+}
+
+static SCM guile_pcre_set_regexps(SCM set_smob)
+{
+    scm_assert_smob_type(pcre_set_tag, set_smob);
+    return ((struct guile_pcre_set *) SCM_SMOB_DATA(set_smob))->regexps;
+}
+
+static SCM mark_pcre_set(SCM set_smob)
+{
+    return ((struct guile_pcre_set *) SCM_SMOB_DATA(set_smob))->regexps;
+}
+
+static int value_lookup_by_name(const struct name_value *table, size_t count,
+				const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+	if (strcmp(table[i].name, name) == 0)
+	    return i;
+    return -1;
+}
+
+static SCM guile_pcre_config(SCM config_name)
+{
+    SCM rv = SCM_BOOL_F;
+    int parm = scm_to_int(config_name);
+    int bool_value;
+    int int_value;
+    long long_value;
+    const char *s;
+    int rc;
+
+    switch (parm) {
+    case PCRE_CONFIG_UTF8:
+    case PCRE_CONFIG_UTF16:
+    case PCRE_CONFIG_UTF32:
+    case PCRE_CONFIG_UNICODE_PROPERTIES:
+    case PCRE_CONFIG_JIT:
+    case PCRE_CONFIG_BSR:
+	rc = pcre_config(parm, &bool_value);
+	if (rc == PCRE_ERROR_BADOPTION)
+	    return SCM_BOOL_F;
+
+	if (rc == 0)
+	    return bool_value == 1 ? SCM_BOOL_T : SCM_BOOL_F;
+	break;
+
+    case PCRE_CONFIG_NEWLINE:
+    case PCRE_CONFIG_LINK_SIZE:
+    case PCRE_CONFIG_POSIX_MALLOC_THRESHOLD:
+    case PCRE_CONFIG_STACKRECURSE:
+	rc = pcre_config(parm, &int_value);
+	if (rc == 0)
+	    return scm_from_signed_integer(int_value);
+	break;
+
+    case PCRE_CONFIG_MATCH_LIMIT:
+    case PCRE_CONFIG_MATCH_LIMIT_RECURSION:
+	rc = pcre_config(parm, &long_value);
+	if (rc == 0)
+	    return scm_from_long(long_value);
+	break;
+
+    case PCRE_CONFIG_JITTARGET:
+	rc = pcre_config(parm, &s);
+	if (rc != 0)
+	    break;
+	return s == NULL ? SCM_BOOL_F : scm_from_latin1_string(s);
+    default:
+	scm_error_scm(scm_from_latin1_symbol("pcre-error"),
+		      scm_from_latin1_string("pcre-config"),
+		      scm_from_latin1_string("Unrecognized parameter name ~S"),
+		      scm_cons(config_name, SCM_EOL),
+		      SCM_BOOL_F);
+    }
+    if (rc < 0)
+	scm_error_scm(scm_from_latin1_symbol("pcre-error"),
+		      scm_from_latin1_string("pcre-config"),
+		      pcre_error_to_string(rc),
+		      scm_cons(config_name, SCM_EOL),
+		      SCM_BOOL_F);
+    return rv;
+}
+
+static SCM guile_pcre_fullinfo(SCM pcre_smob, SCM what)
+{
+    struct guile_pcre *regexp;
+    SCM rv = SCM_BOOL_F;
+    int bool_value;
+    int int_value;
+    uint32_t uint32_value;
+    size_t size_value;
+    long long_value;
+    const char *s;
+    int parm;
+    int rc;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    parm = scm_to_int(what);
+	    /* currently unsupported: */
+	    /* PCRE_INFO_DEFAULT_TABLES */
+	    /* PCRE_INFO_FIRSTTABLE */
+    switch (parm) {
+    case PCRE_INFO_BACKREFMAX:
+    case PCRE_INFO_CAPTURECOUNT:
+    case PCRE_INFO_FIRSTBYTE:
+    case PCRE_INFO_HASCRORLF:
+    case PCRE_INFO_JITSIZE:
+    case PCRE_INFO_LASTLITERAL:
+    case PCRE_INFO_MAXLOOKBEHIND:
+    case PCRE_INFO_MINLENGTH:
+    case PCRE_INFO_NAMECOUNT:
+    case PCRE_INFO_NAMEENTRYSIZE:
+    case PCRE_INFO_OPTIONS:
+    case PCRE_INFO_FIRSTCHARACTERFLAGS:
+    case PCRE_INFO_REQUIREDCHARFLAGS:
+	rc = pcre_fullinfo(regexp->regexp, regexp->extra, parm, &int_value);
+	if (rc == 0)
+	    return scm_from_signed_integer(int_value);
+	break;
+
+    case PCRE_INFO_SIZE:
+    case PCRE_INFO_STUDYSIZE:
+	rc = pcre_fullinfo(regexp->regexp, regexp->extra, parm, &size_value);
+	if (rc == 0)
+	    return scm_from_size_t(size_value);
+	break;
+
+    case PCRE_INFO_FIRSTCHARACTER:
+    case PCRE_INFO_REQUIREDCHAR:
+	rc = pcre_fullinfo(regexp->regexp, regexp->extra, parm, &uint32_value);
+	if (rc == 0)
+	    return scm_from_unsigned_integer(uint32_value);
+	break;
+
+    case PCRE_INFO_JCHANGED:
+    case PCRE_INFO_JIT:
+    case PCRE_INFO_OKPARTIAL:
+	rc = pcre_config(parm, &bool_value);
+	if (rc == 0)
+	    return bool_value == 1 ? SCM_BOOL_T : SCM_BOOL_F;
+	break;
+    case PCRE_INFO_NAMETABLE:
+	return guile_pcre_build_name_alist(regexp);
+	break;
+
+    default:
+	scm_error_scm(scm_from_latin1_symbol("pcre-error"),
+		      scm_from_latin1_string("pcre-fullinfo"),
+		      scm_from_latin1_string("Unrecognized parameter what: ~S"),
+		      scm_cons(what, SCM_EOL),
+		      SCM_BOOL_F);
+    }
+    if (rc < 0)
+	scm_error_scm(scm_from_latin1_symbol("pcre-error"),
+		      scm_from_latin1_string("pcre-fullinfo"),
+		      pcre_error_to_string(rc), SCM_EOL, SCM_BOOL_F);
+
+    return rv;
+}
+
+static SCM guile_pcre_p(SCM pcre_smob)
+{
+    return scm_from_bool(SCM_SMOB_PREDICATE(pcre_tag, pcre_smob));
+}
+
+static SCM pcre_library_version(void)
+{
+    return scm_from_latin1_string(pcre_version());
+}
+
+static SCM guile_pcre_version(void)
+{
+    return scm_from_latin1_string(PACKAGE_VERSION);
+}
+
+static SCM guile_pcre_memory_stats(SCM pcre_smob)
+{
+    const size_t *memory = live_memory;
+    SCM rv = SCM_EOL;
+
+    if (!SCM_UNBNDP(pcre_smob)) {
+	scm_assert_smob_type(pcre_tag, pcre_smob);
+	memory = ((struct guile_pcre *) SCM_SMOB_DATA(pcre_smob))->memory;
+    } else
+	rv = scm_list_3(scm_cons(scm_from_latin1_symbol("heap"),
+				 scm_from_size_t(__atomic_load_n
+						 (&heap_live,
+						  __ATOMIC_RELAXED))),
+			scm_cons(scm_from_latin1_symbol("frames"),
+				 scm_from_size_t(__atomic_load_n
+						 (&frames_live,
+						  __ATOMIC_RELAXED))),
+			scm_cons(scm_from_latin1_symbol("frame-pool"),
+				 scm_from_size_t(__atomic_load_n
+						 (&frames_pooled,
+						  __ATOMIC_RELAXED))));
+    return scm_cons(scm_cons(scm_from_latin1_symbol("code"),
+			     scm_from_size_t(memory[GUILE_PCRE_MEMORY_CODE])),
+		    scm_cons(scm_cons(scm_from_latin1_symbol("study"),
+				      scm_from_size_t
+				      (memory[GUILE_PCRE_MEMORY_STUDY])),
+			     scm_cons(scm_cons(scm_from_latin1_symbol("jit"),
+					       scm_from_size_t
+					       (memory[GUILE_PCRE_MEMORY_JIT])),
+				      rv)));
+}
+
+static SCM guile_pcre_set_limit(SCM pcre_smob, SCM limit, int recursion)
+{
+    struct guile_pcre *regexp;
+    pcre_extra *extra;
+    int flag = recursion ? PCRE_EXTRA_MATCH_LIMIT_RECURSION
+	: PCRE_EXTRA_MATCH_LIMIT;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    guile_pcre_check_unshared(recursion ? "pcre-set-recursion-limit!"
+			      : "pcre-set-match-limit!", regexp);
+    extra = guile_pcre_extra(regexp);
+    if (scm_is_false(limit))
+	extra->flags &= ~flag;
+    else if (recursion) {
+	extra->match_limit_recursion = scm_to_ulong(limit);
+	extra->flags |= flag;
+    } else {
+	extra->match_limit = scm_to_ulong(limit);
+	extra->flags |= flag;
+    }
+    return pcre_smob;
+}
+
+static SCM guile_pcre_set_match_limit(SCM pcre_smob, SCM limit)
+{
+    return guile_pcre_set_limit(pcre_smob, limit, 0);
+}
+
+static SCM guile_pcre_set_recursion_limit(SCM pcre_smob, SCM limit)
+{
+    return guile_pcre_set_limit(pcre_smob, limit, 1);
+}
+
+static SCM guile_pcre_limits(SCM pcre_smob)
+{
+    struct guile_pcre *regexp;
+    const pcre_extra *extra;
+    SCM match = SCM_BOOL_F;
+    SCM recursion = SCM_BOOL_F;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    extra = regexp->extra;
+    if (extra && (extra->flags & PCRE_EXTRA_MATCH_LIMIT))
+	match = scm_from_ulong(extra->match_limit);
+    if (extra && (extra->flags & PCRE_EXTRA_MATCH_LIMIT_RECURSION))
+	recursion = scm_from_ulong(extra->match_limit_recursion);
+    return scm_cons(match, recursion);
+}
+
+static SCM guile_pcre_prefilter_stats(SCM pcre_smob)
+{
+    struct guile_pcre *regexp;
+    SCM literal = SCM_BOOL_F;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    if (!regexp->prefilter)
+	return SCM_BOOL_F;
+    if (regexp->literal)
+	literal = scm_from_utf8_stringn(regexp->literal, regexp->literal_len);
+    return scm_list_4(scm_cons(scm_from_latin1_symbol("literal"), literal),
+		      scm_cons(scm_from_latin1_symbol("min-length"),
+			       scm_from_int(regexp->min_length)),
+		      scm_cons(scm_from_latin1_symbol("rejects"),
+			       scm_from_ulong(__atomic_load_n(&regexp->prefilter_rejects,
+							      __ATOMIC_RELAXED))),
+		      scm_cons(scm_from_latin1_symbol("passes"),
+			       scm_from_ulong(__atomic_load_n(&regexp->prefilter_passes,
+							      __ATOMIC_RELAXED))));
+}
+
+static SCM guile_pcre_set_jit_stack(SCM pcre_smob, SCM size)
+{
+    struct guile_pcre *regexp;
+    pcre_jit_stack *stack = NULL;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    guile_pcre_check_unshared("pcre-set-jit-stack!", regexp);
+    if (scm_is_true(size)) {
+	int max = scm_to_int(size);
+
+	if (max <= 0)
+	    scm_out_of_range("pcre-set-jit-stack!", size);
+	stack = pcre_jit_stack_alloc(max < 32 * 1024 ? max : 32 * 1024, max);
+	if (stack == NULL)
+	    scm_memory_error("pcre-set-jit-stack!");
+    }
+    if (regexp->jit_stack)
+	pcre_jit_stack_free(regexp->jit_stack);
+    regexp->jit_stack = stack;
+    return pcre_smob;
+}
+
+static SCM guile_pcre_set_jit_stack_pool_size(SCM size)
+{
+    int n = scm_to_int(size);
+
+    if (n < 0)
+	scm_out_of_range("pcre-set-jit-stack-pool-size!", size);
+    jit_stack_pool_size = n;
+    return SCM_UNSPECIFIED;
+}
+
+static SCM guile_pcre_set_blocking_threshold(SCM size)
+{
+    int n = scm_is_false(size) ? 0 : scm_to_int(size);
+
+    if (n < 0)
+	scm_out_of_range("pcre-set-blocking-threshold!", size);
+    blocking_threshold = n;
+    return SCM_UNSPECIFIED;
+}
+
+static SCM guile_pcre_set_lazy_jit_threshold(SCM calls, SCM ns)
+{
+    lazy_jit_calls = scm_is_false(calls) ? 0 : scm_to_ulong(calls);
+    if (!SCM_UNBNDP(ns))
+	lazy_jit_ns = scm_is_false(ns) ? 0 : scm_to_uint64(ns);
+    return SCM_UNSPECIFIED;
+}
+
+static SCM guile_pcre_counters_alist(const struct guile_pcre_counters *counters)
+{
+    static const struct guile_pcre_counters zero;
+    SCM errors = SCM_EOL;
+    SCM histogram;
+    int  last;
+    int  i;
+
+    if (counters == NULL)
+	counters = &zero;
+    for (i = GUILE_PCRE_ERROR_CODES - 1; i >= 0; --i)
+	if (counters->errors[i])
+	    errors = scm_acons(i ? pcre_error_to_string(-i)
+			       : scm_from_latin1_string("other"),
+			       scm_from_ulong(counters->errors[i]), errors);
+    for (last = 64; last > 0 && counters->histogram[last - 1] == 0; --last)
+	;
+    histogram = scm_c_make_vector(last, SCM_INUM0);
+    for (i = 0; i < last; ++i)
+	scm_c_vector_set_x(histogram, i,
+			   scm_from_ulong(counters->histogram[i]));
+
+    return scm_list_n(scm_cons(scm_from_latin1_symbol("calls"),
+			       scm_from_ulong(counters->calls)),
+		      scm_cons(scm_from_latin1_symbol("matches"),
+			       scm_from_ulong(counters->matches)),
+		      scm_cons(scm_from_latin1_symbol("no-matches"),
+			       scm_from_ulong(counters->no_matches)),
+		      scm_cons(scm_from_latin1_symbol("errors"), errors),
+		      scm_cons(scm_from_latin1_symbol("subject-bytes"),
+			       scm_from_uint64(counters->subject_bytes)),
+		      scm_cons(scm_from_latin1_symbol("total-ns"),
+			       scm_from_uint64(counters->total_ns)),
+		      scm_cons(scm_from_latin1_symbol("max-ns"),
+			       scm_from_uint64(counters->max_ns)),
+		      scm_cons(scm_from_latin1_symbol("histogram"), histogram),
+		      SCM_UNDEFINED);
+}
+
+static SCM guile_pcre_stats(SCM pcre_smob)
+{
+    struct guile_pcre *regexp;
+    const pcre_extra *extra;
+    SCM jit;
+    SCM lazy;
+
+    if (SCM_UNBNDP(pcre_smob)) {
+	lazy = scm_list_3(scm_cons(scm_from_latin1_symbol("jit-promotions"),
+				   scm_from_ulong(jit_promotions)),
+			  scm_cons(scm_from_latin1_symbol("jit-promoted-size"),
+				   scm_from_size_t(jit_promoted_size)),
+			  scm_cons(scm_from_latin1_symbol("detached-calls"),
+				   scm_from_ulong(__atomic_load_n(&detached_calls,
+								  __ATOMIC_RELAXED))));
+	return scm_append(scm_list_2(lazy,
+				     guile_pcre_counters_alist(&global_counters)));
+    }
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    extra = __atomic_load_n(&regexp->extra, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&regexp->jit_pending, __ATOMIC_ACQUIRE))
+	jit = scm_from_latin1_symbol("pending");
+    else
+	jit = scm_from_bool(extra && (extra->flags & PCRE_EXTRA_EXECUTABLE_JIT));
+    lazy = scm_list_4(scm_cons(scm_from_latin1_symbol("jit"), jit),
+		      scm_cons(scm_from_latin1_symbol("jit-size"),
+			       scm_from_size_t(regexp->jit_size)),
+		      scm_cons(scm_from_latin1_symbol("interpreted-calls"),
+			       scm_from_ulong(regexp->interpreted_calls)),
+		      scm_cons(scm_from_latin1_symbol("interpreted-ns"),
+			       scm_from_uint64(regexp->interpreted_ns)));
+    return scm_append(scm_list_2(lazy,
+				 guile_pcre_counters_alist(regexp->counters)));
+}
+
+static SCM guile_pcre_set_instrumentation(SCM on)
+{
+    instrumentation = scm_is_true(on);
+    return SCM_UNSPECIFIED;
+}
+
+static void guile_pcre_zero_counters(struct guile_pcre_counters *counters)
+{
+    int  i;
+
+    __atomic_store_n(&counters->calls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&counters->matches, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&counters->no_matches, 0, __ATOMIC_RELAXED);
+    for (i = 0; i < GUILE_PCRE_ERROR_CODES; ++i)
+	__atomic_store_n(&counters->errors[i], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&counters->subject_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&counters->total_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&counters->max_ns, 0, __ATOMIC_RELAXED);
+    for (i = 0; i < 64; ++i)
+	__atomic_store_n(&counters->histogram[i], 0, __ATOMIC_RELAXED);
+}
+
+static SCM guile_pcre_reset_counters(void *closure, SCM pcre_smob, SCM value,
+				     SCM result)
+{
+    struct guile_pcre *regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+
+    (void) closure;
+    (void) value;
+    if (regexp->counters)
+	guile_pcre_zero_counters(regexp->counters);
+    return result;
+}
+
+static SCM guile_pcre_reset_stats(SCM pcre_smob)
+{
+    if (SCM_UNBNDP(pcre_smob)) {
+	guile_pcre_zero_counters(&global_counters);
+	scm_internal_hash_fold(guile_pcre_reset_counters, NULL, SCM_EOL,
+			       instrumented_regexps);
+    } else {
+	scm_assert_smob_type(pcre_tag, pcre_smob);
+	guile_pcre_reset_counters(NULL, pcre_smob, SCM_BOOL_T, SCM_EOL);
+    }
+    return SCM_UNSPECIFIED;
+}
+
+static SCM guile_pcre_cons_regexp(void *closure, SCM pcre_smob, SCM value,
+				  SCM result)
+{
+    (void) closure;
+    (void) value;
+    return scm_cons(pcre_smob, result);
+}
+
+static SCM guile_pcre_instrumented_regexps(void)
+{
+    return scm_internal_hash_fold(guile_pcre_cons_regexp, NULL, SCM_EOL,
+				  instrumented_regexps);
+}
+
+static SCM guile_pcre_regex_call(int which, SCM match, SCM n)
+{
+    SCM proc = scm_variable_ref(regex_procs[which]);
+
+    return SCM_UNBNDP(n) ? scm_call_1(proc, match)
+	: scm_call_2(proc, match, n);
+}
+
+static int guile_pcre_match_bounds(const char *subr, SCM match, SCM n,
+				   int *start, int *end)
+{
+    const struct guile_pcre_match *m =
+	(const struct guile_pcre_match *) SCM_SMOB_DATA(match);
+    int groups = m->count;
+    int i = 0;
+
+    if (SCM_SMOB_PREDICATE(pcre_tag, m->regexp)) {
+	const struct guile_pcre *regexp =
+	    (const struct guile_pcre *) SCM_SMOB_DATA(m->regexp);
+
+	if (regexp->capture_count >= groups)
+	    groups = regexp->capture_count + 1;
+    }
+    if (!SCM_UNBNDP(n)) {
+	i = scm_to_int(n);
+	if (i < 0 || i >= groups)
+	    scm_out_of_range(subr, n);
+    }
+    if (i >= m->count || m->offsets[i * 2] < 0)
+	return 0;
+    *start = m->offsets[i * 2];
+    *end = m->offsets[i * 2 + 1];
+    return 1;
+}
+
+static SCM guile_pcre_subject_slice(SCM subject, size_t start, size_t end)
+{
+    if (scm_is_bytevector(subject))
+	return scm_from_utf8_stringn((const char *)
+				     SCM_BYTEVECTOR_CONTENTS(subject) + start,
+				     end - start);
+    return scm_c_substring(subject, start, end);
+}
+
+static size_t guile_pcre_subject_length(SCM subject)
+{
+    if (scm_is_bytevector(subject))
+	return SCM_BYTEVECTOR_LENGTH(subject);
+    return scm_c_string_length(subject);
+}
+
+static SCM guile_pcre_match_object_p(SCM obj)
+{
+    return scm_from_bool(SCM_SMOB_PREDICATE(pcre_match_tag, obj));
+}
+
+static SCM guile_pcre_regexp_match_p(SCM obj)
+{
+    if (SCM_SMOB_PREDICATE(pcre_match_tag, obj))
+	return SCM_BOOL_T;
+    return guile_pcre_regex_call(REGEX_MATCH_P, obj, SCM_UNDEFINED);
+}
+
+static SCM guile_pcre_match_count(SCM match)
+{
+    if (!SCM_SMOB_PREDICATE(pcre_match_tag, match))
+	return guile_pcre_regex_call(REGEX_COUNT, match, SCM_UNDEFINED);
+    return scm_from_int(((struct guile_pcre_match *)
+			 SCM_SMOB_DATA(match))->count);
+}
+
+static SCM guile_pcre_match_string(SCM match)
+{
+    if (!SCM_SMOB_PREDICATE(pcre_match_tag, match))
+	return guile_pcre_regex_call(REGEX_STRING, match, SCM_UNDEFINED);
+    return ((struct guile_pcre_match *) SCM_SMOB_DATA(match))->subject;
+}
+
+static SCM guile_pcre_match_start(SCM match, SCM n)
+{
+    int start, end;
+
+    if (!SCM_SMOB_PREDICATE(pcre_match_tag, match))
+	return guile_pcre_regex_call(REGEX_START, match, n);
+    if (!guile_pcre_match_bounds("match:start", match, n, &start, &end))
+	return SCM_BOOL_F;
+    return scm_from_size_t(((struct guile_pcre_match *)
+			    SCM_SMOB_DATA(match))->base + start);
+}
+
+static SCM guile_pcre_match_end(SCM match, SCM n)
+{
+    int start, end;
+
+    if (!SCM_SMOB_PREDICATE(pcre_match_tag, match))
+	return guile_pcre_regex_call(REGEX_END, match, n);
+    if (!guile_pcre_match_bounds("match:end", match, n, &start, &end))
+	return SCM_BOOL_F;
+    return scm_from_size_t(((struct guile_pcre_match *)
+			    SCM_SMOB_DATA(match))->base + end);
+}
+
+static SCM guile_pcre_match_substring(SCM match, SCM n)
+{
+    int start, end;
+
+    if (!SCM_SMOB_PREDICATE(pcre_match_tag, match))
+	return guile_pcre_regex_call(REGEX_SUBSTRING, match, n);
+    if (!guile_pcre_match_bounds("match:substring", match, n, &start, &end))
+	return SCM_BOOL_F;
+    return guile_pcre_subject_slice(guile_pcre_match_string(match),
+				    start, end);
+}
+
+static SCM guile_pcre_match_prefix(SCM match)
+{
+    int start, end;
+
+    if (!SCM_SMOB_PREDICATE(pcre_match_tag, match))
+	return guile_pcre_regex_call(REGEX_PREFIX, match, SCM_UNDEFINED);
+    guile_pcre_match_bounds("match:prefix", match, SCM_UNDEFINED,
+			    &start, &end);
+    return guile_pcre_subject_slice(guile_pcre_match_string(match),
+				    0, start);
+}
+
+static SCM guile_pcre_match_suffix(SCM match)
+{
+    SCM subject;
+    int start, end;
+
+    if (!SCM_SMOB_PREDICATE(pcre_match_tag, match))
+	return guile_pcre_regex_call(REGEX_SUFFIX, match, SCM_UNDEFINED);
+    guile_pcre_match_bounds("match:suffix", match, SCM_UNDEFINED,
+			    &start, &end);
+    subject = guile_pcre_match_string(match);
+    return guile_pcre_subject_slice(subject, end,
+				    guile_pcre_subject_length(subject));
+}
+
+static SCM guile_pcre_name_alist(struct guile_pcre *regexp)
+{
+    if (scm_is_false(regexp->name_alist))
+	regexp->name_alist = guile_pcre_build_name_alist(regexp);
+    return regexp->name_alist;
+}
+
+static SCM guile_pcre_name_table(struct guile_pcre *regexp)
+{
+    SCM table;
+    SCM names;
+
+    if (scm_is_false(regexp->name_table)) {
+	names = guile_pcre_name_alist(regexp);
+	table = scm_c_make_hash_table(scm_ilength(names) + 1);
+	for (; scm_is_pair(names); names = scm_cdr(names))
+	    scm_hashq_set_x(table, scm_caar(names), scm_cdar(names));
+	regexp->name_table = table;
+    }
+    return regexp->name_table;
+}
+
+static SCM guile_pcre_match_named(SCM match, SCM name)
+{
+    struct guile_pcre_match *m;
+    SCM index;
+    int start, end;
+
+    scm_assert_smob_type(pcre_match_tag, match);
+    m = (struct guile_pcre_match *) SCM_SMOB_DATA(match);
+    if (!SCM_SMOB_PREDICATE(pcre_tag, m->regexp))
+	return SCM_BOOL_F;
+    if (scm_is_string(name))
+	name = scm_string_to_symbol(name);
+    index = scm_hashq_ref(guile_pcre_name_table((struct guile_pcre *)
+						SCM_SMOB_DATA(m->regexp)),
+			  name, SCM_BOOL_F);
+    if (scm_is_false(index) ||
+	!guile_pcre_match_bounds("match:named", match, index, &start, &end))
+	return SCM_BOOL_F;
+    return guile_pcre_subject_slice(m->subject, start, end);
+}
+
+static SCM guile_pcre_match_to_vector(SCM match)
+{
+    struct guile_pcre_match *m;
+    SCM rv;
+    int i;
+
+    scm_assert_smob_type(pcre_match_tag, match);
+    m = (struct guile_pcre_match *) SCM_SMOB_DATA(match);
+    rv = scm_c_make_vector(m->count + 1, SCM_UNSPECIFIED);
+    scm_c_vector_set_x(rv, 0, m->subject);
+    for (i = 0; i < m->count; ++i)
+	scm_c_vector_set_x(rv, i + 1,
+			   scm_cons(scm_from_int(m->offsets[i * 2]),
+				    scm_from_int(m->offsets[i * 2 + 1])));
+    return rv;
+}
 
-    for (i = 0; i < name_count; ++i) {
-	entry_number = guile_pcre_match_entry_number(name_table, utf);
-	value = scm_cons(scm_cons(scm_from_locale_symbol(name_table + offset),
-				  scm_from_signed_integer(entry_number)),
-			 value);
-	name_table += entry_size;
+static SCM guile_pcre_capture(SCM string, struct guile_pcre_subject *subject,
+			      int start, int end)
+{
+    SCM bv;
+
+    if (scm_is_bytevector(string)) {
+	bv = scm_c_make_bytevector(end - start);
+	memcpy(SCM_BYTEVECTOR_CONTENTS(bv), subject->bytes + start,
+	       end - start);
+	return bv;
     }
-    return value;
+    return scm_c_substring_shared(string,
+				  guile_pcre_char_index(subject, start),
+				  guile_pcre_char_index(subject, end));
 }
 
-static SCM guile_pcre_exec(SCM pcre_smob, SCM string)
+static SCM guile_pcre_exec_to_captures(SCM pcre_smob, SCM string, SCM start,
+				       SCM options)
 {
     struct guile_pcre *regexp;
+    struct guile_pcre_subject subject;
     SCM rv = SCM_BOOL_F;
-    int rc;
-    int capture_count = 0;
-    int *captures = NULL;
+    int *captures;
     int ovec_count;
-    size_t len = scm_c_string_length(string);
-    char *cstr = alloca(len + 1);
+    int rc;
+    int i;
 
     scm_assert_smob_type(pcre_tag, pcre_smob);
-
-    scm_to_locale_stringbuf(string, cstr, len);
-    cstr[len] = 0;
     regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
-    pcre_fullinfo(regexp->regexp, NULL, PCRE_INFO_CAPTURECOUNT, &capture_count);
-    ovec_count = (capture_count + 1) * 3;
+    ovec_count = (regexp->capture_count + 1) * 3;
+    captures = guile_pcre_scratch_ovector(guile_pcre_scratch(), ovec_count);
 
-    captures = alloca(ovec_count * sizeof(*captures));
-    memset(captures, 0, ovec_count * sizeof(*captures));
+    rc = guile_pcre_match("pcre-exec->captures", pcre_smob, string, start,
+			  options, &subject, captures, ovec_count);
+    if (rc > 0) {
+	rv = scm_c_make_vector(regexp->capture_count + 1, SCM_BOOL_F);
+	for (i = 0; i < rc; ++i)
+	    if (captures[i * 2] >= 0)
+		scm_c_vector_set_x(rv, i,
+				   guile_pcre_capture(string, &subject,
+						      captures[i * 2],
+						      captures[i * 2 + 1]));
+    }
 
-    rc = pcre_exec(regexp->regexp, regexp->extra, cstr, len, 0, 0, captures,
-		   ovec_count);
-    if (rc < 0 && rc != PCRE_ERROR_NOMATCH) {
-	scm_error_scm(scm_from_latin1_symbol("pcre-error"),
-		      scm_from_latin1_string("pcre-exec"),
-		      pcre_error_to_string(rc), SCM_EOL, SCM_BOOL_F);
-    } else if (rc > 0) {
-	int match_count = rc;
-	int i;
+    scm_remember_upto_here_2(pcre_smob, string);
+
+    return rv;
+}
+
+static SCM guile_pcre_exec_to_alist(SCM pcre_smob, SCM string, SCM start,
+				    SCM options)
+{
+    struct guile_pcre *regexp;
+    struct guile_pcre_subject subject;
+    SCM rv = SCM_BOOL_F;
+    SCM names;
+    SCM value;
+    int *captures;
+    int ovec_count;
+    int rc;
+    int n;
+
+    scm_assert_smob_type(pcre_tag, pcre_smob);
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    ovec_count = (regexp->capture_count + 1) * 3;
+    captures = guile_pcre_scratch_ovector(guile_pcre_scratch(), ovec_count);
 
-	rv = scm_c_make_vector(match_count + 1, SCM_UNSPECIFIED);
-	scm_c_vector_set_x(rv, 0, string);
-	for (i = 0; i < match_count; ++i) {
-	    SCM start = scm_from_signed_integer(captures[i * 2]);
-	    SCM end = scm_from_signed_integer(captures[i * 2 + 1]);
-	    scm_c_vector_set_x(rv, i + 1, scm_cons(start, end));
+    rc = guile_pcre_match("pcre-exec->alist", pcre_smob, string, start,
+			  options, &subject, captures, ovec_count);
+    if (rc > 0) {
+	rv = SCM_EOL;
+	    /* The names come last to first, so duplicates come highest
+	     * group first. */
+	for (names = guile_pcre_name_alist(regexp); scm_is_pair(names);
+	     names = scm_cdr(names)) {
+	    n = scm_to_int(scm_cdar(names));
+	    value = SCM_BOOL_F;
+	    if (n < rc && captures[n * 2] >= 0)
+		value = guile_pcre_capture(string, &subject, captures[n * 2],
+					   captures[n * 2 + 1]);
+	    if (scm_is_pair(rv) && scm_is_eq(scm_caar(rv), scm_caar(names))) {
+		if (scm_is_true(value))
+		    scm_set_cdr_x(scm_car(rv), value);
+	    } else
+		rv = scm_acons(scm_caar(names), value, rv);
 	}
-	scm_hashq_set_x(match_regexp_hash_table, rv, pcre_smob);
     }
 
-    scm_remember_upto_here_1(pcre_smob);
+    scm_remember_upto_here_2(pcre_smob, string);
 
     return rv;
 }
 
-static int value_lookup_by_name(const struct name_value *table, size_t count,
-				const char *name)
+static SCM guile_pcre_match_to_regexp(SCM match)
 {
-    size_t i;
-
-    for (i = 0; i < count; ++i)
-	if (strcmp(table[i].name, name) == 0)
-	    return i;
-    return -1;
+    scm_assert_smob_type(pcre_match_tag, match);
+    return ((struct guile_pcre_match *) SCM_SMOB_DATA(match))->regexp;
 }
 
-static SCM guile_pcre_config(SCM config_name)
+struct guile_pcre_image
 {
-    SCM rv = SCM_BOOL_F;
-    int parm = scm_to_int(config_name);
-    int bool_value;
-    int int_value;
-    long long_value;
-    const char *s;
-    int rc;
+    char magic[4];		/* "GPCR" */
+    uint32_t byte_order;	/* GUILE_PCRE_BYTE_ORDER */
+    uint32_t format;		/* GUILE_PCRE_IMAGE_FORMAT */
+    uint32_t link_size;		/* PCRE_CONFIG_LINK_SIZE */
+    char version[32];		/* pcre_version() */
+    uint32_t study_flags;
+    uint32_t pattern_size;
+    uint32_t code_size;
+    uint32_t study_size;
+    uint32_t compile_options;	/* PCRE_INFO_OPTIONS */
+};
 
-    switch (parm) {
-    case PCRE_CONFIG_UTF8:
-    case PCRE_CONFIG_UTF16:
-    case PCRE_CONFIG_UTF32:
-    case PCRE_CONFIG_UNICODE_PROPERTIES:
-    case PCRE_CONFIG_JIT:
-    case PCRE_CONFIG_BSR:
-	rc = pcre_config(parm, &bool_value);
-	if (rc == PCRE_ERROR_BADOPTION)
-	    return SCM_BOOL_F;
+struct guile_pcre_bundle
+{
+    char magic[4];		/* "GPCB" */
+    uint32_t byte_order;
+    uint32_t count;
+    uint32_t reserved;
+};
 
-	if (rc == 0)
-	    return bool_value == 1 ? SCM_BOOL_T : SCM_BOOL_F;
-	break;
+#define GUILE_PCRE_BYTE_ORDER 0x01020304
+#define GUILE_PCRE_IMAGE_FORMAT 2
+#define GUILE_PCRE_ALIGN(n) (((n) + 7) & ~(size_t) 7)
 
-    case PCRE_CONFIG_NEWLINE:
-    case PCRE_CONFIG_LINK_SIZE:
-    case PCRE_CONFIG_POSIX_MALLOC_THRESHOLD:
-    case PCRE_CONFIG_STACKRECURSE:
-	rc = pcre_config(parm, &int_value);
-	if (rc == 0)
-	    return scm_from_signed_integer(int_value);
-	break;
+static uint32_t guile_pcre_u32(uint32_t value, int swap)
+{
+    return swap ? __builtin_bswap32(value) : value;
+}
 
-    case PCRE_CONFIG_MATCH_LIMIT:
-    case PCRE_CONFIG_MATCH_LIMIT_RECURSION:
-	rc = pcre_config(parm, &long_value);
-	if (rc == 0)
-	    return scm_from_long(long_value);
-	break;
+static uint64_t guile_pcre_u64(uint64_t value, int swap)
+{
+    return swap ? __builtin_bswap64(value) : value;
+}
 
-    case PCRE_CONFIG_JITTARGET:
-	rc = pcre_config(parm, &s);
-	if (rc != 0)
-	    break;
-	return s == NULL ? SCM_BOOL_F : scm_from_latin1_string(s);
-    default:
-	scm_error_scm(scm_from_latin1_symbol("pcre-error"),
-		      scm_from_latin1_string("pcre-config"),
-		      scm_from_latin1_string("Unrecognized parameter name ~S"),
-		      scm_cons(config_name, SCM_EOL),
-		      SCM_BOOL_F);
-    }
-    if (rc < 0)
-	scm_error_scm(scm_from_latin1_symbol("pcre-error"),
-		      scm_from_latin1_string("pcre-config"),
-		      pcre_error_to_string(rc),
-		      scm_cons(config_name, SCM_EOL),
-		      SCM_BOOL_F);
-    return rv;
+static void guile_pcre_image_error(const char *subr, const char *message)
+{
+    scm_error_scm(scm_from_latin1_symbol("pcre-error"),
+		  scm_from_latin1_string(subr),
+		  scm_from_latin1_string(message), SCM_EOL, SCM_BOOL_F);
 }
 
-static SCM guile_pcre_fullinfo(SCM pcre_smob, SCM what)
+static SCM guile_pcre_to_bytevector(SCM pcre_smob)
 {
     struct guile_pcre *regexp;
-    SCM rv = SCM_BOOL_F;
-    int bool_value;
-    int int_value;
-    uint32_t uint32_value;
-    size_t size_value;
-    long long_value;
-    const char *s;
-    int parm;
-    int rc;
+    struct guile_pcre_image header;
+    size_t pattern_size;
+    size_t code_size = 0;
+    size_t study_size = 0;
+    unsigned long options = 0;
+    unsigned char *code;
+    char *pattern;
+    char *p;
+    SCM bv;
 
     scm_assert_smob_type(pcre_tag, pcre_smob);
     regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
-    parm = scm_to_int(what);
-	    /* currently unsupported: */
-	    /* PCRE_INFO_DEFAULT_TABLES */
-	    /* PCRE_INFO_FIRSTTABLE */
-    switch (parm) {
-    case PCRE_INFO_BACKREFMAX:
-    case PCRE_INFO_CAPTURECOUNT:
-    case PCRE_INFO_FIRSTBYTE:
-    case PCRE_INFO_HASCRORLF:
-    case PCRE_INFO_JITSIZE:
-    case PCRE_INFO_LASTLITERAL:
-    case PCRE_INFO_MAXLOOKBEHIND:
-    case PCRE_INFO_MINLENGTH:
-    case PCRE_INFO_NAMECOUNT:
-    case PCRE_INFO_NAMEENTRYSIZE:
-    case PCRE_INFO_OPTIONS:
-    case PCRE_INFO_FIRSTCHARACTERFLAGS:
-    case PCRE_INFO_REQUIREDCHARFLAGS:
-	rc = pcre_fullinfo(regexp->regexp, regexp->extra, parm, &int_value);
-	if (rc == 0)
-	    return scm_from_signed_integer(int_value);
-	break;
+#ifdef GUILE_PCRE_PCRE2
+    if (guile_pcre2_serialize(regexp->regexp, &code, &code_size) < 0)
+	guile_pcre_image_error("pcre->bytevector",
+			       "cannot serialize compiled pattern");
+#else
+    code = (unsigned char *) regexp->regexp;
+    pcre_fullinfo(regexp->regexp, NULL, PCRE_INFO_SIZE, &code_size);
+#endif
+    if (regexp->extra && (regexp->extra->flags & PCRE_EXTRA_STUDY_DATA))
+	pcre_fullinfo(regexp->regexp, regexp->extra, PCRE_INFO_STUDYSIZE,
+		      &study_size);
 
-    case PCRE_INFO_SIZE:
-    case PCRE_INFO_STUDYSIZE:
-	rc = pcre_fullinfo(regexp->regexp, regexp->extra, parm, &size_value);
-	if (rc == 0)
-	    return scm_from_size_t(size_value);
-	break;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "GPCR", 4);
+    header.byte_order = GUILE_PCRE_BYTE_ORDER;
+    header.format = GUILE_PCRE_IMAGE_FORMAT;
+    pcre_config(PCRE_CONFIG_LINK_SIZE, &header.link_size);
+    strncpy(header.version, pcre_version(), sizeof(header.version));
+    header.study_flags = regexp->study_flags;
+    header.code_size = code_size;
+    header.study_size = study_size;
+    pcre_fullinfo(regexp->regexp, NULL, PCRE_INFO_OPTIONS, &options);
+    header.compile_options = options;
 
-    case PCRE_INFO_FIRSTCHARACTER:
-    case PCRE_INFO_REQUIREDCHAR:
-	rc = pcre_fullinfo(regexp->regexp, regexp->extra, parm, &uint32_value);
-	if (rc == 0)
-	    return scm_from_unsigned_integer(uint32_value);
-	break;
+    pattern = scm_to_utf8_stringn(regexp->pattern, &pattern_size);
+    header.pattern_size = pattern_size;
+    bv = scm_c_make_bytevector(sizeof(header) + GUILE_PCRE_ALIGN(pattern_size)
+			       + GUILE_PCRE_ALIGN(code_size) + study_size);
+    p = (char *) SCM_BYTEVECTOR_CONTENTS(bv);
+    memset(p, 0, SCM_BYTEVECTOR_LENGTH(bv));
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, pattern, pattern_size);
+    p += GUILE_PCRE_ALIGN(pattern_size);
+    memcpy(p, code, code_size);
+    p += GUILE_PCRE_ALIGN(code_size);
+    if (study_size)
+	memcpy(p, regexp->extra->study_data, study_size);
+    free(pattern);
+#ifdef GUILE_PCRE_PCRE2
+    pcre2_serialize_free(code);
+#endif
 
-    case PCRE_INFO_JCHANGED:
-    case PCRE_INFO_JIT:
-    case PCRE_INFO_OKPARTIAL:
-	rc = pcre_config(parm, &bool_value);
-	if (rc == 0)
-	    return bool_value == 1 ? SCM_BOOL_T : SCM_BOOL_F;
-	break;
-    case PCRE_INFO_NAMETABLE:
-	return guile_pcre_build_name_alist(regexp);
-	break;
+    scm_remember_upto_here_1(pcre_smob);
+    return bv;
+}
 
-    default:
-	scm_error_scm(scm_from_latin1_symbol("pcre-error"),
-		      scm_from_latin1_string("pcre-fullinfo"),
-		      scm_from_latin1_string("Unrecognized parameter what: ~S"),
-		      scm_cons(what, SCM_EOL),
-		      SCM_BOOL_F);
+static SCM guile_pcre_load_image(const char *subr, const char *image,
+				 size_t len, SCM owner, int verify)
+{
+    struct guile_pcre_image header;
+    struct guile_pcre *regexp;
+    const char *code;
+    size_t pattern_size;
+    size_t code_size;
+    size_t study_size;
+#ifndef GUILE_PCRE_PCRE2
+    size_t info_size = 0;
+#endif
+    int  link_size = 0;
+    int  study_flags;
+    int  swap;
+    pcre *re;
+    pcre_extra *extra = NULL;
+    SCM pattern;
+    SCM smob;
+
+    if (len < sizeof(header))
+	guile_pcre_image_error(subr, "truncated compiled pattern");
+    memcpy(&header, image, sizeof(header));
+    swap = header.byte_order != GUILE_PCRE_BYTE_ORDER;
+    if (memcmp(header.magic, "GPCR", 4) != 0 ||
+	guile_pcre_u32(header.byte_order, swap) != GUILE_PCRE_BYTE_ORDER)
+	guile_pcre_image_error(subr, "not a compiled pattern");
+    if (guile_pcre_u32(header.format, swap) != GUILE_PCRE_IMAGE_FORMAT)
+	guile_pcre_image_error(subr, "unsupported compiled pattern format");
+    pcre_config(PCRE_CONFIG_LINK_SIZE, &link_size);
+    if (guile_pcre_u32(header.link_size, swap) != (uint32_t) link_size)
+	guile_pcre_image_error(subr, "pattern compiled with another link size");
+    if (strncmp(header.version, pcre_version(), sizeof(header.version)) != 0)
+	guile_pcre_image_error(subr, "pattern compiled by another pcre version");
+
+    pattern_size = guile_pcre_u32(header.pattern_size, swap);
+    code_size = guile_pcre_u32(header.code_size, swap);
+    study_size = guile_pcre_u32(header.study_size, swap);
+    study_flags = guile_pcre_u32(header.study_flags, swap);
+    if (len < sizeof(header) + GUILE_PCRE_ALIGN(pattern_size) +
+	GUILE_PCRE_ALIGN(code_size) + study_size)
+	guile_pcre_image_error(subr, "truncated compiled pattern");
+    code = image + sizeof(header) + GUILE_PCRE_ALIGN(pattern_size);
+    pattern = scm_from_utf8_stringn(image + sizeof(header), pattern_size);
+
+    if (verify) {
+	uint32_t options = guile_pcre_u32(header.compile_options, swap);
+	size_t fresh_size = 0;
+#ifdef GUILE_PCRE_PCRE2
+	unsigned char *fresh;
+#endif
+
+	smob = guile_pcre_compile(pattern, scm_from_uint32(options));
+	regexp = (struct guile_pcre *) SCM_SMOB_DATA(smob);
+#ifdef GUILE_PCRE_PCRE2
+	if (guile_pcre2_serialize(regexp->regexp, &fresh, &fresh_size) < 0)
+	    guile_pcre_image_error(subr, "cannot serialize compiled pattern");
+	pcre2_serialize_free(fresh);
+#else
+	pcre_fullinfo(regexp->regexp, NULL, PCRE_INFO_SIZE, &fresh_size);
+#endif
+	if (fresh_size != code_size)
+	    guile_pcre_image_error(subr, "corrupt compiled pattern");
+	return guile_pcre_study(smob, scm_from_int(study_flags));
     }
-    if (rc < 0)
-	scm_error_scm(scm_from_latin1_symbol("pcre-error"),
-		      scm_from_latin1_string("pcre-fullinfo"),
-		      pcre_error_to_string(rc), SCM_EOL, SCM_BOOL_F);
 
-    return rv;
+#ifdef GUILE_PCRE_PCRE2
+    owner = SCM_BOOL_F;
+    re = swap ? NULL :
+	guile_pcre2_deserialize((const unsigned char *) code, code_size);
+    if (re == NULL || study_size)
+	guile_pcre_image_error(subr, "corrupt compiled pattern");
+#else
+    if (swap)
+	owner = SCM_BOOL_F;
+    if (scm_is_false(owner)) {
+	re = pcre_malloc(code_size);
+	if (re == NULL)
+	    scm_report_out_of_memory();
+	memcpy(re, code, code_size);
+    } else
+	re = (pcre *) code;
+    if (study_size) {
+	const char *study = code + GUILE_PCRE_ALIGN(code_size);
+
+	extra = pcre_malloc(sizeof(*extra) +
+			    (scm_is_false(owner) ? study_size : 0));
+	if (extra == NULL) {
+	    if (scm_is_false(owner))
+		pcre_free(re);
+	    scm_report_out_of_memory();
+	}
+	memset(extra, 0, sizeof(*extra));
+	extra->flags = PCRE_EXTRA_STUDY_DATA;
+	if (scm_is_false(owner)) {
+	    extra->study_data = extra + 1;
+	    memcpy(extra->study_data, study, study_size);
+	} else
+	    extra->study_data = (void *) study;
+    }
+    if ((swap && pcre_pattern_to_host_byte_order(re, extra, NULL) < 0) ||
+	pcre_fullinfo(re, NULL, PCRE_INFO_SIZE, &info_size) < 0 ||
+	info_size != code_size) {
+	if (scm_is_false(owner))
+	    pcre_free(re);
+	pcre_free(extra);
+	guile_pcre_image_error(subr, "corrupt compiled pattern");
+    }
+#endif
+
+    smob = guile_pcre_new(pattern, re, owner);
+    regexp = (struct guile_pcre *) SCM_SMOB_DATA(smob);
+    regexp->extra = extra;
+    regexp->study_flags = study_flags;
+    guile_pcre_account(regexp, 1);
+    if (study_flags & (GUILE_PCRE_STUDY_JIT_FLAGS | GUILE_PCRE_STUDY_JIT_LAZY))
+	guile_pcre_study(smob, scm_from_int(study_flags));
+    else if (study_flags & GUILE_PCRE_STUDY_PREFILTER)
+	guile_pcre_prepare_prefilter(regexp);
+    return smob;
 }
 
-static SCM guile_pcre_p(SCM pcre_smob)
+static SCM guile_pcre_from_bytevector(SCM bv, SCM verify)
 {
-    return scm_from_bool(SCM_SMOB_PREDICATE(pcre_tag, pcre_smob));
+    SCM smob;
+
+    SCM_ASSERT(scm_is_bytevector(bv), bv, SCM_ARG1, "bytevector->pcre");
+    smob = guile_pcre_load_image("bytevector->pcre",
+				 (const char *) SCM_BYTEVECTOR_CONTENTS(bv),
+				 SCM_BYTEVECTOR_LENGTH(bv), SCM_BOOL_F,
+				 !SCM_UNBNDP(verify) && scm_is_true(verify));
+    scm_remember_upto_here_1(bv);
+    return smob;
 }
 
-static SCM pcre_library_version(void)
+static SCM guile_pcre_write_bundle(SCM filename, SCM regexps)
 {
-    return scm_from_latin1_string(pcre_version());
+    struct guile_pcre_bundle header;
+    static const char padding[8];
+    uint64_t offset;
+    size_t count;
+    size_t i;
+    SCM images;
+    char *path;
+    FILE *file;
+    int  ok;
+
+    if (scm_is_pair(regexps) || scm_is_null(regexps))
+	regexps = scm_vector(regexps);
+    SCM_ASSERT(scm_is_vector(regexps), regexps, SCM_ARG2,
+	       "pcre-write-bundle");
+    count = scm_c_vector_length(regexps);
+    images = scm_c_make_vector(count, SCM_BOOL_F);
+    for (i = 0; i < count; ++i)
+	scm_c_vector_set_x(images, i,
+			   guile_pcre_to_bytevector(scm_c_vector_ref(regexps,
+								     i)));
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "GPCB", 4);
+    header.byte_order = GUILE_PCRE_BYTE_ORDER;
+    header.count = count;
+
+    path = scm_to_locale_string(filename);
+    file = fopen(path, "wb");
+    free(path);
+    if (file == NULL)
+	scm_syserror("pcre-write-bundle");
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    offset = sizeof(header) + count * sizeof(offset);
+    for (i = 0; ok && i < count; ++i) {
+	SCM image = scm_c_vector_ref(images, i);
+
+	ok = fwrite(&offset, sizeof(offset), 1, file) == 1;
+	offset += GUILE_PCRE_ALIGN(SCM_BYTEVECTOR_LENGTH(image));
+    }
+    for (i = 0; ok && i < count; ++i) {
+	SCM image = scm_c_vector_ref(images, i);
+	size_t len = SCM_BYTEVECTOR_LENGTH(image);
+
+	ok = fwrite(SCM_BYTEVECTOR_CONTENTS(image), 1, len, file) == len &&
+	    fwrite(padding, 1, GUILE_PCRE_ALIGN(len) - len, file) ==
+	    GUILE_PCRE_ALIGN(len) - len;
+    }
+    if (fclose(file) != 0 || !ok)
+	scm_syserror("pcre-write-bundle");
+
+    scm_remember_upto_here_1(images);
+    return SCM_UNSPECIFIED;
 }
 
-static SCM guile_pcre_version(void)
+struct guile_pcre_mapping
 {
-    return scm_from_latin1_string(PACKAGE_VERSION);
-}
+    void *addr;
+    size_t len;
+};
 
-static SCM guile_pcre_set_names(SCM pcre_smob, SCM name_table)
+static void unmap_bundle(void *data)
 {
-    struct guile_pcre *regexp;
+    struct guile_pcre_mapping *mapping = data;
 
-    scm_assert_smob_type(pcre_tag, pcre_smob);
-    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
-    regexp->name_table = name_table;
-    return name_table;
+    munmap(mapping->addr, mapping->len);
+    free(mapping);
 }
 
-static SCM guile_pcre_get_names(SCM pcre_smob)
+static SCM guile_pcre_load_bundle(SCM filename, SCM verify)
 {
-    struct guile_pcre *regexp;
+    struct guile_pcre_bundle header;
+    struct guile_pcre_mapping *mapping;
+    struct stat st;
+    char *path;
+    void *addr;
+    size_t count;
+    size_t i;
+    int  fd;
+    int  err;
+    int  swap;
+    SCM owner;
+    SCM rv;
 
-    scm_assert_smob_type(pcre_tag, pcre_smob);
-    regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
-    return regexp->name_table;
-}
+    path = scm_to_locale_string(filename);
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0)
+	scm_syserror("pcre-load-bundle");
+    if (fstat(fd, &st) < 0) {
+	err = errno;
+	close(fd);
+	errno = err;
+	scm_syserror("pcre-load-bundle");
+    }
+    if ((size_t) st.st_size < sizeof(header)) {
+	close(fd);
+	guile_pcre_image_error("pcre-load-bundle", "not a pattern bundle");
+    }
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    err = errno;
+    close(fd);
+    if (addr == MAP_FAILED) {
+	errno = err;
+	scm_syserror("pcre-load-bundle");
+    }
+    mapping = scm_malloc(sizeof(*mapping));
+    mapping->addr = addr;
+    mapping->len = st.st_size;
+    owner = scm_from_pointer(mapping, unmap_bundle);
 
-static SCM guile_pcre_match_to_regexp(SCM match)
-{
-    return scm_hashq_ref(match_regexp_hash_table, match, SCM_BOOL_F);
+    memcpy(&header, addr, sizeof(header));
+    swap = header.byte_order != GUILE_PCRE_BYTE_ORDER;
+    if (memcmp(header.magic, "GPCB", 4) != 0 ||
+	guile_pcre_u32(header.byte_order, swap) != GUILE_PCRE_BYTE_ORDER)
+	guile_pcre_image_error("pcre-load-bundle", "not a pattern bundle");
+    count = guile_pcre_u32(header.count, swap);
+    if (count > (mapping->len - sizeof(header)) / sizeof(uint64_t))
+	guile_pcre_image_error("pcre-load-bundle", "truncated pattern bundle");
+
+    rv = scm_c_make_vector(count, SCM_BOOL_F);
+    for (i = 0; i < count; ++i) {
+	uint64_t offset;
+
+	memcpy(&offset, (char *) addr + sizeof(header) + i * sizeof(offset),
+	       sizeof(offset));
+	offset = guile_pcre_u64(offset, swap);
+	if (offset > mapping->len)
+	    guile_pcre_image_error("pcre-load-bundle",
+				   "truncated pattern bundle");
+	scm_c_vector_set_x(rv, i,
+			   guile_pcre_load_image("pcre-load-bundle",
+						 (char *) addr + offset,
+						 mapping->len - offset, owner,
+						 !SCM_UNBNDP(verify) &&
+						 scm_is_true(verify)));
+    }
+
+    scm_remember_upto_here_1(owner);
+    return rv;
 }
 
 static int print_pcre(SCM pcre_smob, SCM port, scm_print_state *pstate)
@@ -482,22 +5349,98 @@ static SCM mark_pcre(SCM pcre_smob)
     struct guile_pcre *regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
 
     scm_gc_mark(regexp->pattern);
-    return SCM_BOOL_F;
+    scm_gc_mark(regexp->owner);
+    scm_gc_mark(regexp->template);
+    scm_gc_mark(regexp->name_alist);
+    return regexp->name_table;
 }
 
 static size_t free_pcre(SCM pcre_smob)
 {
     struct guile_pcre *regexp = (struct guile_pcre *) SCM_SMOB_DATA(pcre_smob);
+    int i;
 
+    for (i = 0; i < GUILE_PCRE_MEMORY_KINDS; ++i)
+	__atomic_fetch_sub(&live_memory[i], regexp->memory[i],
+			   __ATOMIC_RELAXED);
     pcre_free_study(regexp->extra);
     regexp->extra = NULL;
-    pcre_free(regexp->regexp);
+    while (regexp->retired) {
+	struct guile_pcre_retired *retired = regexp->retired;
+
+	regexp->retired = retired->next;
+	pcre_free_study(retired->extra);
+#ifdef GUILE_PCRE_WIDE
+	pcre32_free_study(retired->extra32);
+#endif
+	free(retired);
+    }
+    __atomic_fetch_sub(&jit_promoted_size, regexp->jit_size,
+		       __ATOMIC_RELAXED);
+    if (regexp->jit_stack)
+	pcre_jit_stack_free(regexp->jit_stack);
+    regexp->jit_stack = NULL;
+#ifdef GUILE_PCRE_PCRE2
+    pcre2_code_free(regexp->regexp);
+#else
+    if (scm_is_false(regexp->owner))
+	pcre_free(regexp->regexp);
+#endif
     regexp->regexp = NULL;
+#ifdef GUILE_PCRE_WIDE
+    pcre32_free_study(regexp->extra32);
+    regexp->extra32 = NULL;
+    pcre32_free(regexp->regexp32);
+    regexp->regexp32 = NULL;
+#endif
     regexp->pattern = NULL;
     scm_gc_free(regexp, sizeof(*regexp), "pcre");
     return 0;
 }
 
+static int print_pcre_match(SCM match, SCM port, scm_print_state *pstate)
+{
+    struct guile_pcre_match *m =
+	(struct guile_pcre_match *) SCM_SMOB_DATA(match);
+
+    (void) pstate;
+    scm_puts("#<pcre-match ", port);
+    if (scm_is_bytevector(m->subject)) {
+	    /* Raw bytes: a slice need not be valid UTF-8. */
+	SCM bv = scm_c_make_bytevector(m->offsets[1] - m->offsets[0]);
+
+	memcpy(SCM_BYTEVECTOR_CONTENTS(bv),
+	       SCM_BYTEVECTOR_CONTENTS(m->subject) + m->offsets[0],
+	       m->offsets[1] - m->offsets[0]);
+	scm_write(bv, port);
+    } else
+	scm_write(guile_pcre_subject_slice(m->subject, m->offsets[0],
+					   m->offsets[1]), port);
+    scm_puts(">", port);
+    return 1;
+}
+
+static SCM mark_pcre_match(SCM match)
+{
+    struct guile_pcre_match *m =
+	(struct guile_pcre_match *) SCM_SMOB_DATA(match);
+
+    scm_gc_mark(m->subject);
+    return m->regexp;
+}
+
+static SCM equalp_pcre_match(SCM a, SCM b)
+{
+    struct guile_pcre_match *ma = (struct guile_pcre_match *) SCM_SMOB_DATA(a);
+    struct guile_pcre_match *mb = (struct guile_pcre_match *) SCM_SMOB_DATA(b);
+
+    if (ma->count != mb->count || ma->base != mb->base ||
+	memcmp(ma->offsets, mb->offsets,
+	       ma->count * 2 * sizeof(ma->offsets[0])) != 0)
+	return SCM_BOOL_F;
+    return scm_equal_p(ma->subject, mb->subject);
+}
+
 static SCM equalp_pcre(SCM a, SCM b)
 {
     struct guile_pcre *ra = (struct guile_pcre *) SCM_SMOB_DATA(a);
@@ -566,6 +5509,8 @@ void init_pcre(void)
 	{ "PCRE_STUDY_JIT_PARTIAL_SOFT_COMPILE", PCRE_STUDY_JIT_PARTIAL_SOFT_COMPILE },
 	{ "PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE", PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE },
 	{ "PCRE_STUDY_EXTRA_NEEDED", PCRE_STUDY_EXTRA_NEEDED },
+	{ "GUILE_PCRE_STUDY_PREFILTER", GUILE_PCRE_STUDY_PREFILTER },
+	{ "GUILE_PCRE_STUDY_JIT_LAZY", GUILE_PCRE_STUDY_JIT_LAZY },
 
 		/* Config values */
 	{ "PCRE_CONFIG_UTF8", PCRE_CONFIG_UTF8, },
@@ -603,30 +5548,131 @@ void init_pcre(void)
 	{ "PCRE_INFO_OKPARTIAL", PCRE_INFO_OKPARTIAL, },
 	{ "PCRE_INFO_NAMETABLE", PCRE_INFO_NAMETABLE, },
     };
-    SCM htref;
+    static const char *regex_proc_names[REGEX_PROC_COUNT] = {
+	"regexp-match?", "match:count", "match:string", "match:start",
+	"match:end", "match:substring", "match:prefix", "match:suffix"
+    };
     size_t i;
 
+    pthread_key_create(&scratch_key, free_scratch);
     pcre_tag = scm_make_smob_type ("pcre", sizeof(struct guile_pcre));
     scm_set_smob_print(pcre_tag, print_pcre);
     scm_set_smob_mark(pcre_tag, mark_pcre);
     scm_set_smob_free(pcre_tag, free_pcre);
     scm_set_smob_equalp(pcre_tag, equalp_pcre);
+    pcre_match_tag = scm_make_smob_type("pcre-match", 0);
+    scm_set_smob_print(pcre_match_tag, print_pcre_match);
+    scm_set_smob_mark(pcre_match_tag, mark_pcre_match);
+    scm_set_smob_equalp(pcre_match_tag, equalp_pcre_match);
+    pcre_set_tag = scm_make_smob_type("pcre-set", 0);
+    scm_set_smob_mark(pcre_set_tag, mark_pcre_set);
+    pcre_template_tag = scm_make_smob_type("pcre-template", 0);
+    scm_set_smob_mark(pcre_template_tag, mark_pcre_template);
+    for (i = 0; i < REGEX_PROC_COUNT; ++i)
+	regex_procs[i] = scm_c_public_variable("ice-9 regex",
+					       regex_proc_names[i]);
     scm_c_define_gsubr("pcre?", 1, 0, 0, guile_pcre_p);
     scm_c_define_gsubr("pcre-do-compile", 1, 1, 0, guile_pcre_compile);
     scm_c_define_gsubr("pcre-study", 1, 1, 0, guile_pcre_study);
-    scm_c_define_gsubr("pcre-exec", 2, 0, 0, guile_pcre_exec);
+    scm_c_define_gsubr("pcre-compile/cached", 2, 1, 0,
+		       guile_pcre_compile_cached);
+    scm_c_define_gsubr("pcre-cache-stats", 0, 0, 0, guile_pcre_cache_stats);
+    scm_c_define_gsubr("pcre-set-cache-capacity!", 1, 0, 0,
+		       guile_pcre_set_cache_capacity);
+    scm_c_define_gsubr("pcre-cache-clear!", 0, 0, 0, guile_pcre_cache_clear);
+    scm_c_define_gsubr("pcre-exec", 2, 1, 1, guile_pcre_exec);
+    scm_c_define_gsubr("pcre-exec/bytevector", 2, 1, 1,
+		       guile_pcre_exec_bytevector);
+    scm_c_define_gsubr("pcre-match?", 2, 1, 1, guile_pcre_match_p);
+    scm_c_define_gsubr("pcre-match-span", 2, 1, 1, guile_pcre_match_span);
+    scm_c_define_gsubr("pcre-exec->captures", 2, 1, 1,
+		       guile_pcre_exec_to_captures);
+    scm_c_define_gsubr("pcre-exec->alist", 2, 1, 1, guile_pcre_exec_to_alist);
+    scm_c_define_gsubr("make-pcre-ovector", 1, 0, 0, guile_pcre_make_ovector);
+    scm_c_define_gsubr("pcre-exec!", 3, 1, 1, guile_pcre_exec_x);
+    scm_c_define_gsubr("make-pcre-dfa-workspace", 0, 1, 0,
+		       guile_pcre_make_dfa_workspace);
+    scm_c_define_gsubr("pcre-dfa-exec", 2, 2, 1, guile_pcre_dfa_exec);
+    scm_c_define_gsubr("pcre-fold-matches", 4, 0, 1, guile_pcre_fold_matches);
+    scm_c_define_gsubr("pcre-fold-port", 4, 1, 1, guile_pcre_fold_port);
+    scm_c_define_gsubr("pcre-compile-template", 2, 0, 0,
+		       guile_pcre_compile_template);
+    scm_c_define_gsubr("pcre-template?", 1, 0, 0, guile_pcre_template_p);
+    scm_c_define_gsubr("pcre-substitute", 3, 0, 1, guile_pcre_substitute);
+    scm_c_define_gsubr("pcre-substitute-all", 3, 0, 1,
+		       guile_pcre_substitute_all);
+    scm_c_define_gsubr("pcre-split", 2, 2, 1, guile_pcre_split);
+    scm_c_define_gsubr("pcre-tokenize", 2, 0, 1, guile_pcre_tokenize);
+    scm_c_define_gsubr("pcre-exec-batch", 2, 2, 1, guile_pcre_exec_batch);
+    scm_c_define_gsubr("pcre-grep-file", 4, 1, 1, guile_pcre_grep_file);
+    scm_c_define_gsubr("%make-pcre-set", 1, 0, 0, guile_pcre_make_set);
+    scm_c_define_gsubr("pcre-set?", 1, 0, 0, guile_pcre_set_p);
+    scm_c_define_gsubr("pcre-set-regexps", 1, 0, 0, guile_pcre_set_regexps);
+    scm_c_define_gsubr("pcre-set-match", 2, 0, 0, guile_pcre_set_match);
+    scm_c_define_gsubr("pcre-set-exec", 2, 0, 0, guile_pcre_set_exec);
+    scm_c_define_gsubr("pcre->bytevector", 1, 0, 0, guile_pcre_to_bytevector);
+    scm_c_define_gsubr("bytevector->pcre", 1, 1, 0, guile_pcre_from_bytevector);
+    scm_c_define_gsubr("pcre-write-bundle", 2, 0, 0, guile_pcre_write_bundle);
+    scm_c_define_gsubr("pcre-load-bundle", 1, 1, 0, guile_pcre_load_bundle);
     scm_c_define_gsubr("pcre-config", 1, 0, 0, guile_pcre_config);
     scm_c_define_gsubr("pcre-get-fullinfo", 2, 0, 0, guile_pcre_fullinfo);
     scm_c_define_gsubr("pcre-version", 0, 0, 0, pcre_library_version);
     scm_c_define_gsubr("guile-pcre-version", 0, 0, 0, guile_pcre_version);
-    scm_c_define_gsubr("pcre-set-names!", 2, 0, 0, guile_pcre_set_names);
-    scm_c_define_gsubr("pcre-names", 1, 0, 0, guile_pcre_get_names);
+    scm_c_define_gsubr("pcre-match-object?", 1, 0, 0,
+		       guile_pcre_match_object_p);
     scm_c_define_gsubr("pcre-match->regexp", 1, 0, 0, guile_pcre_match_to_regexp);
+    scm_c_define_gsubr("pcre-match->vector", 1, 0, 0,
+		       guile_pcre_match_to_vector);
+    scm_c_define_gsubr("regexp-match?", 1, 0, 0, guile_pcre_regexp_match_p);
+    scm_c_define_gsubr("match:count", 1, 0, 0, guile_pcre_match_count);
+    scm_c_define_gsubr("match:string", 1, 0, 0, guile_pcre_match_string);
+    scm_c_define_gsubr("match:start", 1, 1, 0, guile_pcre_match_start);
+    scm_c_define_gsubr("match:end", 1, 1, 0, guile_pcre_match_end);
+    scm_c_define_gsubr("match:substring", 1, 1, 0,
+		       guile_pcre_match_substring);
+    scm_c_define_gsubr("match:prefix", 1, 0, 0, guile_pcre_match_prefix);
+    scm_c_define_gsubr("match:suffix", 1, 0, 0, guile_pcre_match_suffix);
+    scm_c_define_gsubr("match:named", 2, 0, 0, guile_pcre_match_named);
+    scm_c_define_gsubr("pcre-set-match-limit!", 2, 0, 0,
+		       guile_pcre_set_match_limit);
+    scm_c_define_gsubr("pcre-set-recursion-limit!", 2, 0, 0,
+		       guile_pcre_set_recursion_limit);
+    scm_c_define_gsubr("pcre-limits", 1, 0, 0, guile_pcre_limits);
+    scm_c_define_gsubr("pcre-prefilter-stats", 1, 0, 0,
+		       guile_pcre_prefilter_stats);
+    scm_c_define_gsubr("pcre-set-jit-stack!", 2, 0, 0,
+		       guile_pcre_set_jit_stack);
+    scm_c_define_gsubr("pcre-set-jit-stack-pool-size!", 1, 0, 0,
+		       guile_pcre_set_jit_stack_pool_size);
+    scm_c_define_gsubr("pcre-set-blocking-threshold!", 1, 0, 0,
+		       guile_pcre_set_blocking_threshold);
+    scm_c_define_gsubr("pcre-set-lazy-jit-threshold!", 1, 1, 0,
+		       guile_pcre_set_lazy_jit_threshold);
+    scm_c_define_gsubr("pcre-stats", 0, 1, 0, guile_pcre_stats);
+    scm_c_define_gsubr("pcre-memory-stats", 0, 1, 0,
+		       guile_pcre_memory_stats);
+    scm_c_define_gsubr("pcre-reset-stats!", 0, 1, 0, guile_pcre_reset_stats);
+    scm_c_define_gsubr("pcre-set-instrumentation!", 1, 0, 0,
+		       guile_pcre_set_instrumentation);
+    scm_c_define_gsubr("%pcre-instrumented-regexps", 0, 0, 0,
+		       guile_pcre_instrumented_regexps);
+    instrumented_regexps =
+	scm_permanent_object(scm_make_weak_key_hash_table(scm_from_int(31)));
+    exec_limits_fluid =
+	scm_permanent_object(scm_make_fluid_with_default(SCM_BOOL_F));
+    scm_c_define("%pcre-exec-limits", exec_limits_fluid);
     for (i = 0; i < ARRAY_SIZE(symbol_table); ++i) {
 	scm_c_define(symbol_table[i].name, scm_from_int(symbol_table[i].value));
 	scm_c_export(symbol_table[i].name, NULL);
     }
-    htref = scm_c_private_ref("guile-pcre", "pcre-match-regexp-hash-size");
-    match_regexp_hash_table = scm_make_weak_key_hash_table(htref);
-    pcre_malloc = scm_malloc;		/* No corresponding scm_free(). */
+    pcre_malloc = guile_pcre_malloc;
+    pcre_free = guile_pcre_free;
+    pcre_stack_malloc = guile_pcre_stack_malloc;
+    pcre_stack_free = guile_pcre_stack_free;
+#ifdef GUILE_PCRE_WIDE
+    pcre32_malloc = guile_pcre_malloc;
+    pcre32_free = guile_pcre_free;
+    pcre32_stack_malloc = guile_pcre_stack_malloc;
+    pcre32_stack_free = guile_pcre_stack_free;
+#endif
 }
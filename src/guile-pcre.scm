@@ -1,13 +1,35 @@
 (define-module (guile-pcre)
   #:export (pcre? guile-pcre-version pcre-version
-		  pcre-compile pcre-study pcre-exec
-		  pcre-config match:named)
-  #:export-syntax (make-pcre pcre-fullinfo))
-(use-modules (ice-9 regex))		; for match:substring
+		  pcre-compile pcre-study pcre-exec pcre-exec/bytevector
+		  pcre-match? pcre-match-span make-pcre-ovector pcre-exec!
+		  pcre-exec->captures pcre-exec->alist
+		  pcre-dfa-exec make-pcre-dfa-workspace
+		  pcre-compile/cached pcre-cache-stats
+		  pcre-set-cache-capacity! pcre-cache-clear!
+		  pcre-fold-matches pcre-for-each-match pcre-list-matches
+		  pcre-fold-port pcre-scan-port pcre-grep-file pcre-grep
+		  make-pcre-set pcre-set? pcre-set-regexps
+		  pcre-set-match pcre-set-exec pcre-exec-batch
+		  pcre-substitute pcre-substitute-all
+		  pcre-compile-template pcre-template?
+		  pcre-split pcre-tokenize
+		  pcre-set-match-limit! pcre-set-recursion-limit! pcre-limits
+		  call-with-pcre-limits pcre-prefilter-stats
+		  pcre-set-jit-stack! pcre-set-jit-stack-pool-size!
+		  pcre-set-blocking-threshold! pcre->bytevector bytevector->pcre
+		  pcre-write-bundle pcre-load-bundle
+		  pcre-set-lazy-jit-threshold! pcre-stats pcre-reset-stats!
+		  pcre-set-instrumentation! pcre-top-stats pcre-dump-stats
+		  pcre-memory-stats
+		  pcre-config pcre-match-object? pcre-match->regexp
+		  pcre-match->vector pcre-exec/vector match:named)
+  #:replace (regexp-match? match:count match:string match:start match:end
+			   match:substring match:prefix match:suffix)
+  #:export-syntax (make-pcre make-pcre/cached pcre-fullinfo)
+  #:use-module (ice-9 threads))
 
 (eval-when
  (compile load eval)
- (define pcre-match-regexp-hash-size 1024)
  (load-extension "libguile-pcre" "init_pcre"))
 
 (define-syntax make-helper
@@ -52,100 +74,224 @@
 		 PCRE_STUDY_JIT_COMPILE
 		 PCRE_STUDY_JIT_PARTIAL_SOFT_COMPILE
 		 PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE
-		 PCRE_STUDY_EXTRA_NEEDED)
-    ((_ compile-flags study-flags pattern)
-     (pcre-study (pcre-compile pattern compile-flags) study-flags))
-    ((_ compile-flags study-flags pattern PCRE_CASELESS flags ...)
-     (make-helper (logior compile-flags PCRE_CASELESS) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_MULTILINE flags ...)
-     (make-helper (logior compile-flags PCRE_MULTILINE) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_DOTALL flags ...)
-     (make-helper (logior compile-flags PCRE_DOTALL) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_EXTENDED flags ...)
-     (make-helper (logior compile-flags PCRE_EXTENDED) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_ANCHORED flags ...)
-     (make-helper (logior compile-flags PCRE_ANCHORED) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_DOLLAR_ENDONLY flags ...)
-     (make-helper (logior compile-flags PCRE_DOLLAR_ENDONLY) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_EXTRA flags ...)
-     (make-helper (logior compile-flags PCRE_EXTRA) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NOTBOL flags ...)
-     (make-helper (logior compile-flags PCRE_NOTBOL) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NOTEOL flags ...)
-     (make-helper (logior compile-flags PCRE_NOTEOL) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_UNGREEDY flags ...)
-     (make-helper (logior compile-flags PCRE_UNGREEDY) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NOTEMPTY flags ...)
-     (make-helper (logior compile-flags PCRE_NOTEMPTY) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_UTF8 flags ...)
-     (make-helper (logior compile-flags PCRE_UTF8) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_UTF16 flags ...)
-     (make-helper (logior compile-flags PCRE_UTF16) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_UTF32 flags ...)
-     (make-helper (logior compile-flags PCRE_UTF32) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NO_AUTO_CAPTURE flags ...)
-     (make-helper (logior compile-flags PCRE_NO_AUTO_CAPTURE) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NO_UTF8_CHECK flags ...)
-     (make-helper (logior compile-flags PCRE_NO_UTF8_CHECK) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NO_UTF16_CHECK flags ...)
-     (make-helper (logior compile-flags PCRE_NO_UTF16_CHECK) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NO_UTF32_CHECK flags ...)
-     (make-helper (logior compile-flags PCRE_NO_UTF32_CHECK) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_AUTO_CALLOUT flags ...)
-     (make-helper (logior compile-flags PCRE_AUTO_CALLOUT) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_PARTIAL_SOFT flags ...)
-     (make-helper (logior compile-flags PCRE_PARTIAL_SOFT) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_PARTIAL flags ...)
-     (make-helper (logior compile-flags PCRE_PARTIAL) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_DFA_SHORTEST flags ...)
-     (make-helper (logior compile-flags PCRE_DFA_SHORTEST) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_DFA_RESTART flags ...)
-     (make-helper (logior compile-flags PCRE_DFA_RESTART) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_FIRSTLINE flags ...)
-     (make-helper (logior compile-flags PCRE_FIRSTLINE) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_DUPNAMES flags ...)
-     (make-helper (logior compile-flags PCRE_DUPNAMES) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NEWLINE_CR flags ...)
-     (make-helper (logior compile-flags PCRE_NEWLINE_CR) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NEWLINE_LF flags ...)
-     (make-helper (logior compile-flags PCRE_NEWLINE_LF) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NEWLINE_CRLF flags ...)
-     (make-helper (logior compile-flags PCRE_NEWLINE_CRLF) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NEWLINE_ANY flags ...)
-     (make-helper (logior compile-flags PCRE_NEWLINE_ANY) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NEWLINE_ANYCRLF flags ...)
-     (make-helper (logior compile-flags PCRE_NEWLINE_ANYCRLF) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_BSR_ANYCRLF flags ...)
-     (make-helper (logior compile-flags PCRE_BSR_ANYCRLF) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_BSR_UNICODE flags ...)
-     (make-helper (logior compile-flags PCRE_BSR_UNICODE) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_JAVASCRIPT_COMPAT flags ...)
-     (make-helper (logior compile-flags PCRE_JAVASCRIPT_COMPAT) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NO_START_OPTIMIZE flags ...)
-     (make-helper (logior compile-flags PCRE_NO_START_OPTIMIZE) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NO_START_OPTIMISE flags ...)
-     (make-helper (logior compile-flags PCRE_NO_START_OPTIMISE) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_PARTIAL_HARD flags ...)
-     (make-helper (logior compile-flags PCRE_PARTIAL_HARD) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_NOTEMPTY_ATSTART flags ...)
-     (make-helper (logior compile-flags PCRE_NOTEMPTY_ATSTART) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_UCP flags ...)
-     (make-helper (logior compile-flags PCRE_UCP) study-flags pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_STUDY_JIT_COMPILE flags ...)
-     (make-helper compile-flags (logior study-flags PCRE_STUDY_JIT_COMPILE) pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_STUDY_JIT_PARTIAL_SOFT_COMPILE flags ...)
-     (make-helper compile-flags (logior study-flags PCRE_STUDY_JIT_PARTIAL_SOFT_COMPILE) pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE flags ...)
-     (make-helper compile-flags (logior study-flags PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE) pattern flags ...))
-    ((_ compile-flags study-flags pattern PCRE_STUDY_EXTRA_NEEDED flags ...)
-     (make-helper compile-flags (logior study-flags PCRE_STUDY_EXTRA_NEEDED) pattern flags ...))))
+		 PCRE_STUDY_EXTRA_NEEDED
+		 GUILE_PCRE_STUDY_PREFILTER
+		 GUILE_PCRE_STUDY_JIT_LAZY)
+    ((_ build compile-flags study-flags pattern)
+     (build pattern compile-flags study-flags))
+    ((_ build compile-flags study-flags pattern PCRE_CASELESS flags ...)
+     (make-helper build (logior compile-flags PCRE_CASELESS) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_MULTILINE flags ...)
+     (make-helper build (logior compile-flags PCRE_MULTILINE) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_DOTALL flags ...)
+     (make-helper build (logior compile-flags PCRE_DOTALL) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_EXTENDED flags ...)
+     (make-helper build (logior compile-flags PCRE_EXTENDED) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_ANCHORED flags ...)
+     (make-helper build (logior compile-flags PCRE_ANCHORED) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_DOLLAR_ENDONLY flags ...)
+     (make-helper build (logior compile-flags PCRE_DOLLAR_ENDONLY) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_EXTRA flags ...)
+     (make-helper build (logior compile-flags PCRE_EXTRA) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NOTBOL flags ...)
+     (make-helper build (logior compile-flags PCRE_NOTBOL) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NOTEOL flags ...)
+     (make-helper build (logior compile-flags PCRE_NOTEOL) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_UNGREEDY flags ...)
+     (make-helper build (logior compile-flags PCRE_UNGREEDY) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NOTEMPTY flags ...)
+     (make-helper build (logior compile-flags PCRE_NOTEMPTY) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_UTF8 flags ...)
+     (make-helper build (logior compile-flags PCRE_UTF8) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_UTF16 flags ...)
+     (make-helper build (logior compile-flags PCRE_UTF16) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_UTF32 flags ...)
+     (make-helper build (logior compile-flags PCRE_UTF32) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NO_AUTO_CAPTURE flags ...)
+     (make-helper build (logior compile-flags PCRE_NO_AUTO_CAPTURE) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NO_UTF8_CHECK flags ...)
+     (make-helper build (logior compile-flags PCRE_NO_UTF8_CHECK) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NO_UTF16_CHECK flags ...)
+     (make-helper build (logior compile-flags PCRE_NO_UTF16_CHECK) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NO_UTF32_CHECK flags ...)
+     (make-helper build (logior compile-flags PCRE_NO_UTF32_CHECK) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_AUTO_CALLOUT flags ...)
+     (make-helper build (logior compile-flags PCRE_AUTO_CALLOUT) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_PARTIAL_SOFT flags ...)
+     (make-helper build (logior compile-flags PCRE_PARTIAL_SOFT) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_PARTIAL flags ...)
+     (make-helper build (logior compile-flags PCRE_PARTIAL) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_DFA_SHORTEST flags ...)
+     (make-helper build (logior compile-flags PCRE_DFA_SHORTEST) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_DFA_RESTART flags ...)
+     (make-helper build (logior compile-flags PCRE_DFA_RESTART) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_FIRSTLINE flags ...)
+     (make-helper build (logior compile-flags PCRE_FIRSTLINE) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_DUPNAMES flags ...)
+     (make-helper build (logior compile-flags PCRE_DUPNAMES) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NEWLINE_CR flags ...)
+     (make-helper build (logior compile-flags PCRE_NEWLINE_CR) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NEWLINE_LF flags ...)
+     (make-helper build (logior compile-flags PCRE_NEWLINE_LF) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NEWLINE_CRLF flags ...)
+     (make-helper build (logior compile-flags PCRE_NEWLINE_CRLF) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NEWLINE_ANY flags ...)
+     (make-helper build (logior compile-flags PCRE_NEWLINE_ANY) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NEWLINE_ANYCRLF flags ...)
+     (make-helper build (logior compile-flags PCRE_NEWLINE_ANYCRLF) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_BSR_ANYCRLF flags ...)
+     (make-helper build (logior compile-flags PCRE_BSR_ANYCRLF) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_BSR_UNICODE flags ...)
+     (make-helper build (logior compile-flags PCRE_BSR_UNICODE) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_JAVASCRIPT_COMPAT flags ...)
+     (make-helper build (logior compile-flags PCRE_JAVASCRIPT_COMPAT) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NO_START_OPTIMIZE flags ...)
+     (make-helper build (logior compile-flags PCRE_NO_START_OPTIMIZE) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NO_START_OPTIMISE flags ...)
+     (make-helper build (logior compile-flags PCRE_NO_START_OPTIMISE) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_PARTIAL_HARD flags ...)
+     (make-helper build (logior compile-flags PCRE_PARTIAL_HARD) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_NOTEMPTY_ATSTART flags ...)
+     (make-helper build (logior compile-flags PCRE_NOTEMPTY_ATSTART) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_UCP flags ...)
+     (make-helper build (logior compile-flags PCRE_UCP) study-flags pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_STUDY_JIT_COMPILE flags ...)
+     (make-helper build compile-flags (logior study-flags PCRE_STUDY_JIT_COMPILE) pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_STUDY_JIT_PARTIAL_SOFT_COMPILE flags ...)
+     (make-helper build compile-flags (logior study-flags PCRE_STUDY_JIT_PARTIAL_SOFT_COMPILE) pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE flags ...)
+     (make-helper build compile-flags (logior study-flags PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE) pattern flags ...))
+    ((_ build compile-flags study-flags pattern PCRE_STUDY_EXTRA_NEEDED flags ...)
+     (make-helper build compile-flags (logior study-flags PCRE_STUDY_EXTRA_NEEDED) pattern flags ...))
+    ((_ build compile-flags study-flags pattern GUILE_PCRE_STUDY_PREFILTER flags ...)
+     (make-helper build compile-flags (logior study-flags GUILE_PCRE_STUDY_PREFILTER) pattern flags ...))
+    ((_ build compile-flags study-flags pattern GUILE_PCRE_STUDY_JIT_LAZY flags ...)
+     (make-helper build compile-flags (logior study-flags GUILE_PCRE_STUDY_JIT_LAZY) pattern flags ...))))
+
+(define (compile-and-study pattern compile-flags study-flags)
+  (pcre-study (pcre-compile pattern compile-flags) study-flags))
+
+;;; make-pcre forms whose pattern is a string literal and whose flags
+;;; are all flag names are compiled once per load rather than on every
+;;; evaluation.  The regexps are kept here, keyed on the form's source
+;;; location: that is a constant of the expanded code, so an eq? lookup
+;;; finds the regexp built the first time the form was run, and two
+;;; forms with the same pattern do not share a regexp that either may
+;;; go on to change.  The pattern and flags are part of the key in case
+;;; a macro puts several forms at one location.  The table is only
+;;; touched with LITERAL-MUTEX held; compiling happens outside it, and
+;;; if two threads race the first regexp stored wins.
+(define literal-regexps (make-weak-key-hash-table))
+(define literal-mutex (make-mutex))
+
+(define (literal-pcre site pattern compile-flags study-flags)
+  (let ((key (list pattern compile-flags study-flags)))
+    (define (lookup)
+      (assoc-ref (hashq-ref literal-regexps site '()) key))
+    (or (with-mutex literal-mutex (lookup))
+	(let ((regexp (compile-and-study pattern compile-flags study-flags)))
+	  (with-mutex literal-mutex
+	    (or (lookup)
+		(begin
+		  (hashq-set! literal-regexps site
+			      (acons key regexp
+				     (hashq-ref literal-regexps site '())))
+		  regexp)))))))
+
+;;; The source location of FORM as a vector, or #f if it has none.
+(define (literal-site form)
+  (let ((source (syntax-source form)))
+    (and source
+	 (vector (assq-ref source 'filename)
+		 (assq-ref source 'line)
+		 (assq-ref source 'column)))))
+
+(define pcre-module (current-module))
+
+(define study-flag-names
+  '(PCRE_STUDY_JIT_COMPILE
+    PCRE_STUDY_JIT_PARTIAL_SOFT_COMPILE
+    PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE
+    PCRE_STUDY_EXTRA_NEEDED
+    GUILE_PCRE_STUDY_PREFILTER
+    GUILE_PCRE_STUDY_JIT_LAZY))
+
+;;; Split the flags of a make-pcre form into compile flags, study
+;;; flags and the flags only known at run time.  A flag is folded only
+;;; when it is one of this module's own flag bindings, compared with
+;;; free-identifier=? so that a local binding of the same name is left
+;;; to run time; those are taken as compile flags, as a lone flag is.
+(define (split-flags flags)
+  (define (flag-value id)
+    (and (identifier? id)
+	 (let* ((name (syntax->datum id))
+		(var (and (or (memq name study-flag-names)
+			      (and (string-prefix? "PCRE_" (symbol->string name))
+				   (not (string-prefix? "PCRE_INFO_"
+							(symbol->string name)))
+				   (not (string-prefix? "PCRE_CONFIG_"
+							(symbol->string name)))))
+			  (module-local-variable pcre-module name))))
+	   (and var
+		(integer? (variable-ref var))
+		(free-identifier=? id (datum->syntax #'split-flags name))
+		(variable-ref var)))))
+  (let loop ((flags flags) (compile-flags 0) (study-flags 0) (others '()))
+    (cond ((null? flags) (list compile-flags study-flags (reverse others)))
+	  ((not (flag-value (car flags)))
+	   (loop (cdr flags) compile-flags study-flags
+		 (cons (car flags) others)))
+	  ((memq (syntax->datum (car flags)) study-flag-names)
+	   (loop (cdr flags) compile-flags
+		 (logior study-flags (flag-value (car flags))) others))
+	  (else
+	   (loop (cdr flags) (logior compile-flags (flag-value (car flags)))
+		 study-flags others)))))
+
+;;; Compile a literal pattern while expanding FORM, so that a bad
+;;; regular expression is reported with its source location.
+(define (check-literal-pattern form pattern compile-flags)
+  (catch 'make-pcre-error
+    (lambda () (pcre-do-compile (syntax->datum pattern) compile-flags))
+    (lambda (key subr message args rest)
+      (syntax-violation 'make-pcre
+			(format #f "~a at offset ~a" (car args) (cadr args))
+			form pattern))))
 
 (define-syntax make-pcre
+  (lambda (x)
+    (syntax-case x ()
+      ((make-pcre pattern flags ...)
+       (and (string? (syntax->datum #'pattern))
+	    (null? (caddr (split-flags #'(flags ...)))))
+       (let ((flags (split-flags #'(flags ...)))
+	     (site (literal-site x)))
+	 (check-literal-pattern x #'pattern (car flags))
+	 (if site
+	     #`(literal-pcre '#,(datum->syntax x site)
+			     pattern
+			     #,(datum->syntax x (car flags))
+			     #,(datum->syntax x (cadr flags)))
+	     #`(compile-and-study pattern
+				  #,(datum->syntax x (car flags))
+				  #,(datum->syntax x (cadr flags))))))
+      ((make-pcre pattern flag)
+       #'(pcre-study (pcre-compile pattern flag) 0))
+      ((make-pcre pattern flags ...)
+       (let ((flags (split-flags #'(flags ...))))
+	 #`(compile-and-study pattern
+			      (logior #,(datum->syntax x (car flags))
+				      #,@(caddr flags))
+			      #,(datum->syntax x (cadr flags))))))))
+
+;;; Like make-pcre, but returns the regexp shared through the
+;;; process-wide cache for identical pattern and flags.
+(define-syntax make-pcre/cached
   (syntax-rules ()
-    ((make-pcre pattern flag)
-     (pcre-study (pcre-compile pattern flag) 0))
-    ((make-pcre pattern flags ...)
-     (make-helper 0 0 pattern flags ...))))
+    ((make-pcre/cached pattern flag)
+     (pcre-compile/cached pattern flag 0))
+    ((make-pcre/cached pattern flags ...)
+     (make-helper pcre-compile/cached 0 0 pattern flags ...))))
 
 (define-syntax pcre-fullinfo
   (syntax-rules (PCRE_INFO_BACKREFMAX
@@ -212,26 +358,77 @@
 (define (pcre-compile pattern . flags)
   (pcre-do-compile pattern flags))
 
-;;; memoize name list -> hash table
-(define (name-hash-table regexp)
-  (let ((name-hash (pcre-names regexp)))
-    (if (hash-table? name-hash) name-hash
-					; convert alist to hash table
-	(let* ((name-list (pcre-get-fullinfo regexp PCRE_INFO_NAMETABLE))
-	       (len (length name-list))
-	       (name-hash (if (> len 0) (make-hash-table (* 2 len)) #f)))
-	  (let loop ((names name-list))
-	    (when (pair? names)
-	      (hashq-set! name-hash (caar names) (cdar names))
-	      (loop (cdr names))))
-	  (pcre-set-names! regexp name-hash)))))
-
-(define (match:named match name)
-  (let* ((regexp (pcre-match->regexp match))
-	 (name-hash (and regexp (name-hash-table regexp)))
-	 (index (and name-hash (hashq-ref name-hash
-					   (if (symbol? name)
-					       name
-					       (string->symbol name))
-					   #f))))
-    (if index (match:substring match index) #f)))
+;;; For code written when pcre-exec returned string-match's vector.
+(define (pcre-exec/vector regexp string . args)
+  (let ((match (apply pcre-exec regexp string args)))
+    (and match (pcre-match->vector match))))
+
+;;; pcre-fold-matches walks the subject in C; these mirror list-matches
+;;; and friends from (ice-9 regex).
+(define (pcre-list-matches regexp string . flags)
+  (reverse! (apply pcre-fold-matches regexp string '() cons flags)))
+
+(define (pcre-for-each-match regexp string proc . flags)
+  (apply pcre-fold-matches regexp string *unspecified*
+	 (lambda (match prev) (proc match) prev)
+	 flags)
+  *unspecified*)
+
+(define (pcre-scan-port regexp port proc . args)
+  (apply pcre-fold-port regexp port *unspecified*
+	 (lambda (match prev) (proc match) prev)
+	 args)
+  *unspecified*)
+
+(define (pcre-grep regexp filename proc . args)
+  (apply pcre-grep-file regexp filename *unspecified*
+	 (lambda (line-number line match prev)
+	   (proc line-number line match)
+	   prev)
+	 args)
+  *unspecified*)
+
+;;; Build a set from SPECS, each a compiled regexp, a pattern or a list
+;;; of a pattern and its compile flags.  A pattern's id in the set is
+;;; its position in SPECS.
+(define (make-pcre-set specs)
+  (%make-pcre-set
+   (list->vector
+    (map (lambda (spec)
+	   (cond ((pcre? spec) spec)
+		 ((string? spec) (compile-and-study spec 0 0))
+		 (else (compile-and-study (car spec) (apply logior (cdr spec))
+					  0))))
+	 specs))))
+
+;;; Run THUNK with every match made in its dynamic extent limited to
+;;; MATCH-LIMIT calls of pcre's internal match function and
+;;; RECURSION-LIMIT levels of recursion, overriding the limits of the
+;;; regexp.  Either limit may be #f to keep the regexp's own.
+(define (call-with-pcre-limits match-limit recursion-limit thunk)
+  (with-fluids ((%pcre-exec-limits (cons match-limit recursion-limit)))
+    (thunk)))
+
+;;; The N instrumented regexps that have spent longest in pcre_exec,
+;;; each paired with its pcre-stats, costliest first.
+(define (pcre-top-stats n)
+  (let ((ranked (sort (map (lambda (re) (cons re (pcre-stats re)))
+			   (%pcre-instrumented-regexps))
+		      (lambda (a b)
+			(> (assq-ref (cdr a) 'total-ns)
+			   (assq-ref (cdr b) 'total-ns))))))
+    (list-head ranked (min n (length ranked)))))
+
+;;; Print the top N regexps by time, one per line: total and maximum
+;;; nanoseconds, calls, matches, subject bytes and the regexp.
+(define* (pcre-dump-stats #:optional (n 10) (port (current-output-port)))
+  (for-each (lambda (entry)
+	      (let ((stats (cdr entry)))
+		(simple-format port "~A\t~A\t~A\t~A\t~A\t~A\n"
+			       (assq-ref stats 'total-ns)
+			       (assq-ref stats 'max-ns)
+			       (assq-ref stats 'calls)
+			       (assq-ref stats 'matches)
+			       (assq-ref stats 'subject-bytes)
+			       (car entry))))
+	    (pcre-top-stats n)))
@@ -0,0 +1,734 @@
+/* pcre2-compat.c -*- c-basic-offset: 4 -*-
+ *
+ * Copyright (C) 2026 the guile-pcre contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; see the file COPYING.LESSER.  If
+ * not, write to the Free Software Foundation, Inc., 51 Franklin
+ * Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "pcre2-compat.h"
+
+#if !defined(ARRAY_SIZE)
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
+#endif
+
+#define PCRE_NEWLINE_BITS	0x00700000
+#define PCRE_BSR_BITS		(PCRE_BSR_ANYCRLF | PCRE_BSR_UNICODE)
+#define PCRE_STUDY_JIT_BITS	(PCRE_STUDY_JIT_COMPILE |		\
+				 PCRE_STUDY_JIT_PARTIAL_SOFT_COMPILE |	\
+				 PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE)
+
+void *(*pcre_malloc)(size_t) = malloc;
+void (*pcre_free)(void *) = free;
+void *(*pcre_stack_malloc)(size_t) = malloc;
+void (*pcre_stack_free)(void *) = free;
+
+struct guile_pcre2_option
+{
+    int  pcre;
+    uint32_t pcre2;
+};
+
+static const struct guile_pcre2_option compile_options[] = {
+    { PCRE_CASELESS, PCRE2_CASELESS },
+    { PCRE_MULTILINE, PCRE2_MULTILINE },
+    { PCRE_DOTALL, PCRE2_DOTALL },
+    { PCRE_EXTENDED, PCRE2_EXTENDED },
+    { PCRE_ANCHORED, PCRE2_ANCHORED },
+    { PCRE_DOLLAR_ENDONLY, PCRE2_DOLLAR_ENDONLY },
+    { PCRE_UNGREEDY, PCRE2_UNGREEDY },
+    { PCRE_UTF8, PCRE2_UTF },
+    { PCRE_NO_AUTO_CAPTURE, PCRE2_NO_AUTO_CAPTURE },
+    { PCRE_NO_UTF8_CHECK, PCRE2_NO_UTF_CHECK },
+    { PCRE_AUTO_CALLOUT, PCRE2_AUTO_CALLOUT },
+    { PCRE_NEVER_UTF, PCRE2_NEVER_UTF },
+    { PCRE_NO_AUTO_POSSESS, PCRE2_NO_AUTO_POSSESS },
+    { PCRE_FIRSTLINE, PCRE2_FIRSTLINE },
+    { PCRE_DUPNAMES, PCRE2_DUPNAMES },
+    { PCRE_JAVASCRIPT_COMPAT, PCRE2_ALT_BSUX | PCRE2_ALLOW_EMPTY_CLASS |
+      PCRE2_MATCH_UNSET_BACKREF },
+    { PCRE_NO_START_OPTIMIZE, PCRE2_NO_START_OPTIMIZE },
+    { PCRE_UCP, PCRE2_UCP },
+};
+
+static const struct guile_pcre2_option exec_options[] = {
+    { PCRE_ANCHORED, PCRE2_ANCHORED },
+    { PCRE_NOTBOL, PCRE2_NOTBOL },
+    { PCRE_NOTEOL, PCRE2_NOTEOL },
+    { PCRE_NOTEMPTY, PCRE2_NOTEMPTY },
+    { PCRE_NOTEMPTY_ATSTART, PCRE2_NOTEMPTY_ATSTART },
+    { PCRE_NO_UTF8_CHECK, PCRE2_NO_UTF_CHECK },
+    { PCRE_PARTIAL_SOFT, PCRE2_PARTIAL_SOFT },
+    { PCRE_PARTIAL_HARD, PCRE2_PARTIAL_HARD },
+};
+
+static const struct guile_pcre2_option dfa_options[] = {
+    { PCRE_DFA_SHORTEST, PCRE2_DFA_SHORTEST },
+    { PCRE_DFA_RESTART, PCRE2_DFA_RESTART },
+};
+
+static const int newline_options[] = {
+    0, PCRE_NEWLINE_CR, PCRE_NEWLINE_LF, PCRE_NEWLINE_CRLF,
+    PCRE_NEWLINE_ANY, PCRE_NEWLINE_ANYCRLF
+};
+static const int newline_config[] = {
+    0, '\r', '\n', '\r' << 8 | '\n', -1, -2
+};
+
+static pcre2_general_context *general_context;
+static uint32_t default_match_limit;
+static uint32_t default_depth_limit;
+static uint32_t default_newline;
+static uint32_t default_bsr;
+static char version[64];
+static char jit_target[64];
+static uint32_t jit_available;
+static pthread_key_t thread_key;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+struct guile_pcre2_thread
+{
+    pcre2_match_context *context;
+    pcre2_match_data *match_data;
+    uint32_t pairs;
+    char message[120];
+};
+
+static void *guile_pcre2_malloc(PCRE2_SIZE size, void *data)
+{
+    (void) data;
+    return pcre_malloc(size);
+}
+
+static void guile_pcre2_free(void *block, void *data)
+{
+    (void) data;
+    if (block)
+	pcre_free(block);
+}
+
+static void guile_pcre2_free_thread(void *data)
+{
+    struct guile_pcre2_thread *thread = data;
+
+    pcre2_match_data_free(thread->match_data);
+    pcre2_match_context_free(thread->context);
+    free(thread);
+}
+
+static void guile_pcre2_init(void)
+{
+    general_context = pcre2_general_context_create(guile_pcre2_malloc,
+						   guile_pcre2_free, NULL);
+    pcre2_config(PCRE2_CONFIG_MATCHLIMIT, &default_match_limit);
+    pcre2_config(PCRE2_CONFIG_DEPTHLIMIT, &default_depth_limit);
+    pcre2_config(PCRE2_CONFIG_NEWLINE, &default_newline);
+    pcre2_config(PCRE2_CONFIG_BSR, &default_bsr);
+    pcre2_config(PCRE2_CONFIG_VERSION, version);
+    pcre2_config(PCRE2_CONFIG_JIT, &jit_available);
+    if (jit_available)
+	pcre2_config(PCRE2_CONFIG_JITTARGET, jit_target);
+    pthread_key_create(&thread_key, guile_pcre2_free_thread);
+}
+
+static struct guile_pcre2_thread *guile_pcre2_thread(void)
+{
+    struct guile_pcre2_thread *thread;
+
+    pthread_once(&once, guile_pcre2_init);
+    thread = pthread_getspecific(thread_key);
+    if (thread == NULL) {
+	thread = calloc(1, sizeof(*thread));
+	if (thread == NULL)
+	    return NULL;
+	thread->context = pcre2_match_context_create(general_context);
+	if (thread->context == NULL) {
+	    free(thread);
+	    return NULL;
+	}
+	pthread_setspecific(thread_key, thread);
+    }
+    return thread;
+}
+
+static int64_t guile_pcre2_options(const struct guile_pcre2_option *table,
+				   size_t count, int options, int allowed)
+{
+    uint32_t rv = 0;
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+	if (options & table[i].pcre) {
+	    rv |= table[i].pcre2;
+	    options &= ~table[i].pcre;
+	}
+    return (options & ~allowed) ? -1 : rv;
+}
+
+static int guile_pcre2_error(int rc)
+{
+    if (rc <= PCRE2_ERROR_UTF8_ERR1 && rc >= PCRE2_ERROR_UTF8_ERR21)
+	return PCRE_ERROR_BADUTF8;
+    switch (rc) {
+    case PCRE2_ERROR_NOMATCH:		return PCRE_ERROR_NOMATCH;
+    case PCRE2_ERROR_PARTIAL:		return PCRE_ERROR_PARTIAL;
+    case PCRE2_ERROR_BADMAGIC:		return PCRE_ERROR_BADMAGIC;
+    case PCRE2_ERROR_BADMODE:		return PCRE_ERROR_BADMODE;
+    case PCRE2_ERROR_BADOFFSET:		return PCRE_ERROR_BADOFFSET;
+    case PCRE2_ERROR_BADOPTION:		return PCRE_ERROR_BADOPTION;
+    case PCRE2_ERROR_BADUTFOFFSET:	return PCRE_ERROR_BADUTF8_OFFSET;
+    case PCRE2_ERROR_CALLOUT:		return PCRE_ERROR_CALLOUT;
+    case PCRE2_ERROR_DFA_BADRESTART:	return PCRE_ERROR_DFA_BADRESTART;
+    case PCRE2_ERROR_DFA_RECURSE:	return PCRE_ERROR_DFA_RECURSE;
+    case PCRE2_ERROR_DFA_UCOND:		return PCRE_ERROR_DFA_UCOND;
+    case PCRE2_ERROR_DFA_UFUNC:
+    case PCRE2_ERROR_DFA_UITEM:		return PCRE_ERROR_DFA_UITEM;
+    case PCRE2_ERROR_DFA_WSSIZE:	return PCRE_ERROR_DFA_WSSIZE;
+    case PCRE2_ERROR_JIT_BADOPTION:	return PCRE_ERROR_JIT_BADOPTION;
+    case PCRE2_ERROR_JIT_STACKLIMIT:	return PCRE_ERROR_JIT_STACKLIMIT;
+    case PCRE2_ERROR_HEAPLIMIT:
+    case PCRE2_ERROR_MATCHLIMIT:	return PCRE_ERROR_MATCHLIMIT;
+    case PCRE2_ERROR_DEPTHLIMIT:	return PCRE_ERROR_RECURSIONLIMIT;
+    case PCRE2_ERROR_NOMEMORY:		return PCRE_ERROR_NOMEMORY;
+    case PCRE2_ERROR_NOSUBSTRING:
+    case PCRE2_ERROR_NOUNIQUESUBSTRING:	return PCRE_ERROR_NOSUBSTRING;
+    case PCRE2_ERROR_NULL:		return PCRE_ERROR_NULL;
+    case PCRE2_ERROR_RECURSELOOP:	return PCRE_ERROR_RECURSELOOP;
+    case PCRE2_ERROR_UNSET:		return PCRE_ERROR_UNSET;
+    default:				return PCRE_ERROR_INTERNAL;
+    }
+}
+
+pcre *pcre_compile2(const char *pattern, int options, int *errorcode,
+		    const char **errptr, int *erroffset,
+		    const unsigned char *tables)
+{
+    struct guile_pcre2_thread *thread = guile_pcre2_thread();
+    pcre2_compile_context *context;
+    int64_t flags;
+    int  newline = (options & PCRE_NEWLINE_BITS) >> 20;
+    int  error = 0;
+    PCRE2_SIZE offset = 0;
+    pcre2_code *code = NULL;
+
+    *errptr = NULL;
+    *erroffset = 0;
+    if (thread == NULL) {
+	*errptr = "failed to get memory";
+	return NULL;
+    }
+    flags = guile_pcre2_options(compile_options, ARRAY_SIZE(compile_options),
+				options, PCRE_EXTRA | PCRE_NEWLINE_BITS |
+				PCRE_BSR_BITS);
+    if (flags < 0 || tables != NULL ||
+	(size_t) newline >= ARRAY_SIZE(newline_options) ||
+	(options & PCRE_BSR_BITS) == PCRE_BSR_BITS) {
+	if (errorcode)
+	    *errorcode = 17;
+	*errptr = "unknown option bit(s) set";
+	return NULL;
+    }
+
+    context = pcre2_compile_context_create(general_context);
+    if (context == NULL) {
+	*errptr = "failed to get memory";
+	return NULL;
+    }
+    if (newline)
+	pcre2_set_newline(context, newline);
+    if (options & PCRE_BSR_ANYCRLF)
+	pcre2_set_bsr(context, PCRE2_BSR_ANYCRLF);
+    else if (options & PCRE_BSR_UNICODE)
+	pcre2_set_bsr(context, PCRE2_BSR_UNICODE);
+    code = pcre2_compile((PCRE2_SPTR) pattern, PCRE2_ZERO_TERMINATED,
+			 (uint32_t) flags, &error, &offset, context);
+    pcre2_compile_context_free(context);
+    if (code == NULL) {
+	    /* pcre2's compile errors are pcre's, less a few, plus 100. */
+	if (errorcode)
+	    *errorcode = error - 100;
+	pcre2_get_error_message(error, (PCRE2_UCHAR *) thread->message,
+				sizeof(thread->message));
+	*errptr = thread->message;
+	*erroffset = (int) offset;
+    }
+    return code;
+}
+
+pcre *pcre_compile(const char *pattern, int options, const char **errptr,
+		   int *erroffset, const unsigned char *tables)
+{
+    return pcre_compile2(pattern, options, NULL, errptr, erroffset, tables);
+}
+
+pcre_extra *pcre_study(const pcre *code, int options, const char **errptr)
+{
+    pcre_extra *extra;
+    pcre2_code *jit = NULL;
+    uint32_t jit_options = 0;
+
+    pthread_once(&once, guile_pcre2_init);
+    *errptr = NULL;
+    if (code == NULL) {
+	*errptr = "argument is NULL";
+	return NULL;
+    }
+    if (options & ~(PCRE_STUDY_JIT_BITS | PCRE_STUDY_EXTRA_NEEDED)) {
+	*errptr = "unknown or incorrect option bit(s) set";
+	return NULL;
+    }
+    if (options & PCRE_STUDY_JIT_COMPILE)
+	jit_options |= PCRE2_JIT_COMPLETE;
+    if (options & PCRE_STUDY_JIT_PARTIAL_SOFT_COMPILE)
+	jit_options |= PCRE2_JIT_PARTIAL_SOFT;
+    if (options & PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE)
+	jit_options |= PCRE2_JIT_PARTIAL_HARD;
+    if (jit_options && jit_available) {
+	jit = pcre2_code_copy(code);
+	if (jit && pcre2_jit_compile(jit, jit_options) != 0) {
+	    pcre2_code_free(jit);
+	    jit = NULL;
+	}
+    }
+    if (jit == NULL && !(options & PCRE_STUDY_EXTRA_NEEDED))
+	return NULL;
+
+    extra = pcre_malloc(sizeof(*extra));
+    if (extra == NULL) {
+	pcre2_code_free(jit);
+	*errptr = "failed to get memory";
+	return NULL;
+    }
+    memset(extra, 0, sizeof(*extra));
+    if (jit) {
+	extra->executable_jit = jit;
+	extra->flags = PCRE_EXTRA_EXECUTABLE_JIT;
+    }
+    return extra;
+}
+
+void pcre_free_study(pcre_extra *extra)
+{
+    if (extra == NULL)
+	return;
+    pcre2_code_free(extra->executable_jit);
+    pcre_free(extra);
+}
+
+static uint32_t guile_pcre2_info(const pcre *code, uint32_t what)
+{
+    uint32_t value = 0;
+
+    pcre2_pattern_info(code, what, &value);
+    return value;
+}
+
+static int64_t guile_pcre2_exec_compiled(const pcre *code, int options)
+{
+    uint32_t newline = (options & PCRE_NEWLINE_BITS) >> 20;
+    int  bsr = options & PCRE_BSR_BITS;
+
+    if (newline && (newline >= ARRAY_SIZE(newline_options) ||
+		    newline != guile_pcre2_info(code, PCRE2_INFO_NEWLINE)))
+	return -1;
+    if (bsr && (bsr == PCRE_BSR_BITS ||
+		guile_pcre2_info(code, PCRE2_INFO_BSR) !=
+		(bsr == PCRE_BSR_ANYCRLF ? PCRE2_BSR_ANYCRLF :
+		 PCRE2_BSR_UNICODE)))
+	return -1;
+    return options & ~(PCRE_NEWLINE_BITS | PCRE_BSR_BITS |
+		       PCRE_NO_START_OPTIMIZE);
+}
+
+static int guile_pcre2_prepare(struct guile_pcre2_thread *thread,
+			       const pcre_extra *extra, uint32_t pairs)
+{
+    if (pairs == 0)
+	pairs = 1;
+    if (pairs > thread->pairs) {
+	pcre2_match_data_free(thread->match_data);
+	thread->match_data = pcre2_match_data_create(pairs, general_context);
+	thread->pairs = thread->match_data ? pairs : 0;
+	if (thread->match_data == NULL)
+	    return PCRE_ERROR_NOMEMORY;
+    }
+    pcre2_set_match_limit(thread->context,
+			  extra && (extra->flags & PCRE_EXTRA_MATCH_LIMIT) ?
+			  (uint32_t) extra->match_limit : default_match_limit);
+    pcre2_set_depth_limit(thread->context,
+			  extra && (extra->flags &
+				    PCRE_EXTRA_MATCH_LIMIT_RECURSION) ?
+			  (uint32_t) extra->match_limit_recursion :
+			  default_depth_limit);
+    pcre2_jit_stack_assign(thread->context,
+			   extra ? extra->jit_callback : NULL,
+			   extra ? extra->jit_callback_data : NULL);
+    return 0;
+}
+
+static int guile_pcre2_result(struct guile_pcre2_thread *thread, int rc,
+			      int *ovector, uint32_t pairs)
+{
+    PCRE2_SIZE *offsets = pcre2_get_ovector_pointer(thread->match_data);
+    uint32_t count = 0;
+    uint32_t i;
+
+	    /* Zero means the match data was too small, so every pair
+	     * asked for is filled. */
+    if (rc > 0)
+	count = (uint32_t) rc < pairs ? (uint32_t) rc : pairs;
+    else if (rc == 0)
+	count = pairs;
+    else if (rc == PCRE2_ERROR_PARTIAL)
+	count = pairs ? 1 : 0;
+    else if (rc <= PCRE2_ERROR_UTF8_ERR1 && rc >= PCRE2_ERROR_UTF8_ERR21) {
+	if (pairs) {
+	    ovector[0] = (int) pcre2_get_startchar(thread->match_data);
+	    ovector[1] = PCRE2_ERROR_UTF8_ERR1 - rc + 1;
+	}
+	return PCRE_ERROR_BADUTF8;
+    }
+    for (i = 0; i < count * 2; ++i)
+	ovector[i] = offsets[i] == PCRE2_UNSET ? -1 : (int) offsets[i];
+    if (rc > 0 && (uint32_t) rc > pairs)
+	return 0;
+    return rc < 0 ? guile_pcre2_error(rc) : rc;
+}
+
+int pcre_exec(const pcre *code, const pcre_extra *extra, const char *subject,
+	      int length, int start_offset, int options, int *ovector,
+	      int ovecsize)
+{
+    struct guile_pcre2_thread *thread = guile_pcre2_thread();
+    uint32_t pairs = ovecsize > 0 ? (uint32_t) ovecsize / 3 : 0;
+    int64_t flags;
+    int  rc;
+
+    if (code == NULL || (subject == NULL && length > 0) ||
+	(ovector == NULL && ovecsize > 0))
+	return PCRE_ERROR_NULL;
+    if (length < 0 || ovecsize < 0)
+	return PCRE_ERROR_BADLENGTH;
+    flags = guile_pcre2_exec_compiled(code, options);
+    if (flags >= 0)
+	flags = guile_pcre2_options(exec_options, ARRAY_SIZE(exec_options),
+				    (int) flags, 0);
+    if (flags < 0)
+	return PCRE_ERROR_BADOPTION;
+    if (thread == NULL)
+	return PCRE_ERROR_NOMEMORY;
+    rc = guile_pcre2_prepare(thread, extra, pairs);
+    if (rc < 0)
+	return rc;
+
+	    /* Given the JIT compiled copy, pcre2_match() uses the JIT
+	     * unless the options call for the interpreter. */
+    if (extra && (extra->flags & PCRE_EXTRA_EXECUTABLE_JIT))
+	code = extra->executable_jit;
+    rc = pcre2_match(code, (PCRE2_SPTR) subject, length, start_offset,
+		     (uint32_t) flags, thread->match_data, thread->context);
+    return guile_pcre2_result(thread, rc, ovector, pairs);
+}
+
+int pcre_dfa_exec(const pcre *code, const pcre_extra *extra,
+		  const char *subject, int length, int start_offset,
+		  int options, int *ovector, int ovecsize, int *workspace,
+		  int wscount)
+{
+    struct guile_pcre2_thread *thread = guile_pcre2_thread();
+    int64_t dfa_flags = guile_pcre2_options(dfa_options,
+					    ARRAY_SIZE(dfa_options),
+					    options & (PCRE_DFA_SHORTEST |
+						       PCRE_DFA_RESTART), 0);
+    uint32_t pairs = ovecsize > 0 ? (uint32_t) ovecsize / 2 : 0;
+    int64_t flags;
+    int  rc;
+
+    if (code == NULL || (subject == NULL && length > 0) ||
+	(ovector == NULL && ovecsize > 0) || workspace == NULL)
+	return PCRE_ERROR_NULL;
+    if (length < 0 || ovecsize < 0)
+	return PCRE_ERROR_BADLENGTH;
+    flags = guile_pcre2_exec_compiled(code, options & ~(PCRE_DFA_SHORTEST |
+							PCRE_DFA_RESTART));
+    if (flags >= 0)
+	flags = guile_pcre2_options(exec_options, ARRAY_SIZE(exec_options),
+				    (int) flags, 0);
+    if (flags < 0 || dfa_flags < 0)
+	return PCRE_ERROR_BADOPTION;
+    if (thread == NULL)
+	return PCRE_ERROR_NOMEMORY;
+    rc = guile_pcre2_prepare(thread, extra, pairs);
+    if (rc < 0)
+	return rc;
+    rc = pcre2_dfa_match(code, (PCRE2_SPTR) subject, length, start_offset,
+			 (uint32_t) (flags | dfa_flags), thread->match_data,
+			 thread->context, workspace, wscount);
+    return guile_pcre2_result(thread, rc, ovector, pairs);
+}
+
+static unsigned long guile_pcre2_compiled_options(const pcre *code)
+{
+    uint32_t all = guile_pcre2_info(code, PCRE2_INFO_ALLOPTIONS);
+    uint32_t newline = guile_pcre2_info(code, PCRE2_INFO_NEWLINE);
+    uint32_t bsr = guile_pcre2_info(code, PCRE2_INFO_BSR);
+    unsigned long rv = 0;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(compile_options); ++i)
+	if ((all & compile_options[i].pcre2) == compile_options[i].pcre2)
+	    rv |= compile_options[i].pcre;
+    if (newline != default_newline && newline < ARRAY_SIZE(newline_options))
+	rv |= newline_options[newline];
+    if (bsr != default_bsr)
+	rv |= bsr == PCRE2_BSR_ANYCRLF ? PCRE_BSR_ANYCRLF : PCRE_BSR_UNICODE;
+    return rv;
+}
+
+int pcre_fullinfo(const pcre *code, const pcre_extra *extra, int what,
+		  void *where)
+{
+    const pcre2_code *jit = extra && (extra->flags &
+				      PCRE_EXTRA_EXECUTABLE_JIT) ?
+	extra->executable_jit : NULL;
+    uint32_t value;
+    size_t size;
+    uint32_t first;
+    uint32_t last;
+
+    if (code == NULL || where == NULL)
+	return PCRE_ERROR_NULL;
+    pthread_once(&once, guile_pcre2_init);
+    first = guile_pcre2_info(code, PCRE2_INFO_FIRSTCODETYPE);
+    last = guile_pcre2_info(code, PCRE2_INFO_LASTCODETYPE);
+    switch (what) {
+    case PCRE_INFO_OPTIONS:
+	*(unsigned long *) where = guile_pcre2_compiled_options(code);
+	break;
+    case PCRE_INFO_SIZE:
+	pcre2_pattern_info(code, PCRE2_INFO_SIZE, where);
+	break;
+    case PCRE_INFO_STUDYSIZE:
+	*(size_t *) where = 0;
+	break;
+	    /* The JIT compiled copy of the pattern counts as JIT code. */
+    case PCRE_INFO_JITSIZE:
+	size = 0;
+	if (jit) {
+	    pcre2_pattern_info(jit, PCRE2_INFO_JITSIZE, &size);
+	    *(size_t *) where = size;
+	    pcre2_pattern_info(jit, PCRE2_INFO_SIZE, &size);
+	    *(size_t *) where += size;
+	} else
+	    *(size_t *) where = 0;
+	break;
+    case PCRE_INFO_CAPTURECOUNT:
+	*(int *) where = guile_pcre2_info(code, PCRE2_INFO_CAPTURECOUNT);
+	break;
+    case PCRE_INFO_BACKREFMAX:
+	*(int *) where = guile_pcre2_info(code, PCRE2_INFO_BACKREFMAX);
+	break;
+    case PCRE_INFO_FIRSTBYTE:
+	*(int *) where = first == 1 ?
+	    (int) guile_pcre2_info(code, PCRE2_INFO_FIRSTCODEUNIT) :
+	    first == 2 ? -1 : -2;
+	break;
+    case PCRE_INFO_FIRSTCHARACTER:
+	*(uint32_t *) where = first == 1 ?
+	    guile_pcre2_info(code, PCRE2_INFO_FIRSTCODEUNIT) : 0;
+	break;
+    case PCRE_INFO_FIRSTCHARACTERFLAGS:
+	*(int *) where = first;
+	break;
+    case PCRE_INFO_LASTLITERAL:
+	*(int *) where = last == 1 ?
+	    (int) guile_pcre2_info(code, PCRE2_INFO_LASTCODEUNIT) : -1;
+	break;
+    case PCRE_INFO_REQUIREDCHAR:
+	*(uint32_t *) where = last == 1 ?
+	    guile_pcre2_info(code, PCRE2_INFO_LASTCODEUNIT) : 0;
+	break;
+    case PCRE_INFO_REQUIREDCHARFLAGS:
+	*(int *) where = last;
+	break;
+    case PCRE_INFO_NAMEENTRYSIZE:
+	*(int *) where = guile_pcre2_info(code, PCRE2_INFO_NAMEENTRYSIZE);
+	break;
+    case PCRE_INFO_NAMECOUNT:
+	*(int *) where = guile_pcre2_info(code, PCRE2_INFO_NAMECOUNT);
+	break;
+    case PCRE_INFO_NAMETABLE:
+	pcre2_pattern_info(code, PCRE2_INFO_NAMETABLE, where);
+	break;
+    case PCRE_INFO_OKPARTIAL:
+	*(int *) where = 1;
+	break;
+    case PCRE_INFO_JCHANGED:
+	*(int *) where = guile_pcre2_info(code, PCRE2_INFO_JCHANGED);
+	break;
+    case PCRE_INFO_HASCRORLF:
+	*(int *) where = guile_pcre2_info(code, PCRE2_INFO_HASCRORLF);
+	break;
+    case PCRE_INFO_MINLENGTH:
+	*(int *) where = guile_pcre2_info(code, PCRE2_INFO_MINLENGTH);
+	break;
+    case PCRE_INFO_JIT:
+	*(int *) where = jit != NULL;
+	break;
+    case PCRE_INFO_MAXLOOKBEHIND:
+	*(int *) where = guile_pcre2_info(code, PCRE2_INFO_MAXLOOKBEHIND);
+	break;
+    case PCRE_INFO_MATCHLIMIT:
+	if (pcre2_pattern_info(code, PCRE2_INFO_MATCHLIMIT, &value) < 0)
+	    return PCRE_ERROR_UNSET;
+	*(uint32_t *) where = value;
+	break;
+    case PCRE_INFO_RECURSIONLIMIT:
+	if (pcre2_pattern_info(code, PCRE2_INFO_DEPTHLIMIT, &value) < 0)
+	    return PCRE_ERROR_UNSET;
+	*(uint32_t *) where = value;
+	break;
+    case PCRE_INFO_MATCH_EMPTY:
+	*(int *) where = guile_pcre2_info(code, PCRE2_INFO_MATCHEMPTY);
+	break;
+	    /* pcre2 works out the starting bitmap as it compiles. */
+    case PCRE_INFO_FIRSTTABLE:
+	pcre2_pattern_info(code, PCRE2_INFO_FIRSTBITMAP, where);
+	break;
+	    /* pcre2's built-in tables are not to be had, and so neither
+	     * is PCRE_INFO_DEFAULT_TABLES. */
+    default:
+	return PCRE_ERROR_BADOPTION;
+    }
+    return 0;
+}
+
+int pcre_config(int what, void *where)
+{
+    uint32_t value = 0;
+
+    pthread_once(&once, guile_pcre2_init);
+    switch (what) {
+    case PCRE_CONFIG_UTF8:
+    case PCRE_CONFIG_UNICODE_PROPERTIES:
+	pcre2_config(PCRE2_CONFIG_UNICODE, &value);
+	*(int *) where = (int) value;
+	break;
+    case PCRE_CONFIG_UTF16:
+    case PCRE_CONFIG_UTF32:
+    case PCRE_CONFIG_POSIX_MALLOC_THRESHOLD:
+    case PCRE_CONFIG_STACKRECURSE:
+	*(int *) where = 0;
+	break;
+    case PCRE_CONFIG_JIT:
+	*(int *) where = (int) jit_available;
+	break;
+    case PCRE_CONFIG_JITTARGET:
+	*(const char **) where = jit_available ? jit_target : NULL;
+	break;
+    case PCRE_CONFIG_NEWLINE:
+	*(int *) where = default_newline < ARRAY_SIZE(newline_config) ?
+	    newline_config[default_newline] : 0;
+	break;
+    case PCRE_CONFIG_BSR:
+	*(int *) where = default_bsr == PCRE2_BSR_ANYCRLF;
+	break;
+    case PCRE_CONFIG_LINK_SIZE:
+	pcre2_config(PCRE2_CONFIG_LINKSIZE, &value);
+	*(int *) where = (int) value;
+	break;
+    case PCRE_CONFIG_MATCH_LIMIT:
+	*(unsigned long *) where = default_match_limit;
+	break;
+    case PCRE_CONFIG_MATCH_LIMIT_RECURSION:
+	*(unsigned long *) where = default_depth_limit;
+	break;
+    case PCRE_CONFIG_PARENS_LIMIT:
+	pcre2_config(PCRE2_CONFIG_PARENSLIMIT, &value);
+	*(unsigned long *) where = value;
+	break;
+    default:
+	return PCRE_ERROR_BADOPTION;
+    }
+    return 0;
+}
+
+const char *pcre_version(void)
+{
+    pthread_once(&once, guile_pcre2_init);
+    return version;
+}
+
+int pcre_get_stringnumber(const pcre *code, const char *name)
+{
+    int  rc = pcre2_substring_number_from_name(code, (PCRE2_SPTR) name);
+
+    return rc < 0 ? guile_pcre2_error(rc) : rc;
+}
+
+pcre_jit_stack *pcre_jit_stack_alloc(int startsize, int maxsize)
+{
+    pthread_once(&once, guile_pcre2_init);
+    return pcre2_jit_stack_create(startsize, maxsize, general_context);
+}
+
+void pcre_jit_stack_free(pcre_jit_stack *stack)
+{
+    pcre2_jit_stack_free(stack);
+}
+
+void pcre_assign_jit_stack(pcre_extra *extra, pcre_jit_callback callback,
+			   void *data)
+{
+    extra->jit_callback = callback;
+    extra->jit_callback_data = data;
+}
+
+int guile_pcre2_serialize(const pcre *code, unsigned char **bytes,
+			  size_t *size)
+{
+    PCRE2_SIZE len = 0;
+    int  rc;
+
+    pthread_once(&once, guile_pcre2_init);
+    rc = pcre2_serialize_encode(&code, 1, bytes, &len, general_context);
+    *size = len;
+    return rc < 0 ? guile_pcre2_error(rc) : 0;
+}
+
+#define GUILE_PCRE2_SERIALIZED_HEADER 16
+
+pcre *guile_pcre2_deserialize(const unsigned char *bytes, size_t size)
+{
+    pcre2_code *code = NULL;
+    size_t code_size = 0;
+
+    pthread_once(&once, guile_pcre2_init);
+    if (size < GUILE_PCRE2_SERIALIZED_HEADER ||
+	pcre2_serialize_get_number_of_codes(bytes) != 1 ||
+	pcre2_serialize_decode(&code, 1, bytes, general_context) != 1)
+	return NULL;
+    pcre2_pattern_info(code, PCRE2_INFO_SIZE, &code_size);
+    if (code_size > size - GUILE_PCRE2_SERIALIZED_HEADER) {
+	pcre2_code_free(code);
+	return NULL;
+    }
+    return code;
+}
@@ -0,0 +1,224 @@
+/* pcre2-compat.h -*- c-basic-offset: 4 -*-
+ *
+ * Copyright (C) 2026 the guile-pcre contributors
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 3, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; see the file COPYING.LESSER.  If
+ * not, write to the Free Software Foundation, Inc., 51 Franklin
+ * Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * The part of the pcre API guile-pcre.c uses, implemented over the
+ * 8-bit pcre2 library when configured --with-pcre2.  Options, info and
+ * config codes and error numbers are pcre's, so that the Scheme
+ * constants keep their values; pcre2-compat.c translates them.
+ *
+ * A compiled pattern is a pcre2_code, to be released with
+ * pcre2_code_free().  pcre_study() leaves it alone: a JIT compiled
+ * copy goes in the pcre_extra instead, so that a regexp can be
+ * studied again while other threads match it, as with pcre.
+ */
+
+#ifndef GUILE_PCRE2_COMPAT_H
+#define GUILE_PCRE2_COMPAT_H
+
+#include <stddef.h>
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+
+#define PCRE_CASELESS		0x00000001
+#define PCRE_MULTILINE		0x00000002
+#define PCRE_DOTALL		0x00000004
+#define PCRE_EXTENDED		0x00000008
+#define PCRE_ANCHORED		0x00000010
+#define PCRE_DOLLAR_ENDONLY	0x00000020
+#define PCRE_EXTRA		0x00000040
+#define PCRE_NOTBOL		0x00000080
+#define PCRE_NOTEOL		0x00000100
+#define PCRE_UNGREEDY		0x00000200
+#define PCRE_NOTEMPTY		0x00000400
+#define PCRE_UTF8		0x00000800
+#define PCRE_UTF16		0x00000800
+#define PCRE_UTF32		0x00000800
+#define PCRE_NO_AUTO_CAPTURE	0x00001000
+#define PCRE_NO_UTF8_CHECK	0x00002000
+#define PCRE_NO_UTF16_CHECK	0x00002000
+#define PCRE_NO_UTF32_CHECK	0x00002000
+#define PCRE_AUTO_CALLOUT	0x00004000
+#define PCRE_PARTIAL_SOFT	0x00008000
+#define PCRE_PARTIAL		0x00008000
+#define PCRE_NEVER_UTF		0x00010000
+#define PCRE_DFA_SHORTEST	0x00010000
+#define PCRE_NO_AUTO_POSSESS	0x00020000
+#define PCRE_DFA_RESTART	0x00020000
+#define PCRE_FIRSTLINE		0x00040000
+#define PCRE_DUPNAMES		0x00080000
+#define PCRE_NEWLINE_CR		0x00100000
+#define PCRE_NEWLINE_LF		0x00200000
+#define PCRE_NEWLINE_CRLF	0x00300000
+#define PCRE_NEWLINE_ANY	0x00400000
+#define PCRE_NEWLINE_ANYCRLF	0x00500000
+#define PCRE_BSR_ANYCRLF	0x00800000
+#define PCRE_BSR_UNICODE	0x01000000
+#define PCRE_JAVASCRIPT_COMPAT	0x02000000
+#define PCRE_NO_START_OPTIMIZE	0x04000000
+#define PCRE_NO_START_OPTIMISE	0x04000000
+#define PCRE_PARTIAL_HARD	0x08000000
+#define PCRE_NOTEMPTY_ATSTART	0x10000000
+#define PCRE_UCP		0x20000000
+
+#define PCRE_ERROR_NOMATCH		(-1)
+#define PCRE_ERROR_NULL			(-2)
+#define PCRE_ERROR_BADOPTION		(-3)
+#define PCRE_ERROR_BADMAGIC		(-4)
+#define PCRE_ERROR_UNKNOWN_OPCODE	(-5)
+#define PCRE_ERROR_UNKNOWN_NODE		(-5)
+#define PCRE_ERROR_NOMEMORY		(-6)
+#define PCRE_ERROR_NOSUBSTRING		(-7)
+#define PCRE_ERROR_MATCHLIMIT		(-8)
+#define PCRE_ERROR_CALLOUT		(-9)
+#define PCRE_ERROR_BADUTF8		(-10)
+#define PCRE_ERROR_BADUTF8_OFFSET	(-11)
+#define PCRE_ERROR_PARTIAL		(-12)
+#define PCRE_ERROR_BADPARTIAL		(-13)
+#define PCRE_ERROR_INTERNAL		(-14)
+#define PCRE_ERROR_BADCOUNT		(-15)
+#define PCRE_ERROR_DFA_UITEM		(-16)
+#define PCRE_ERROR_DFA_UCOND		(-17)
+#define PCRE_ERROR_DFA_UMLIMIT		(-18)
+#define PCRE_ERROR_DFA_WSSIZE		(-19)
+#define PCRE_ERROR_DFA_RECURSE		(-20)
+#define PCRE_ERROR_RECURSIONLIMIT	(-21)
+#define PCRE_ERROR_NULLWSLIMIT		(-22)
+#define PCRE_ERROR_BADNEWLINE		(-23)
+#define PCRE_ERROR_BADOFFSET		(-24)
+#define PCRE_ERROR_SHORTUTF8		(-25)
+#define PCRE_ERROR_RECURSELOOP		(-26)
+#define PCRE_ERROR_JIT_STACKLIMIT	(-27)
+#define PCRE_ERROR_BADMODE		(-28)
+#define PCRE_ERROR_BADENDIANNESS	(-29)
+#define PCRE_ERROR_DFA_BADRESTART	(-30)
+#define PCRE_ERROR_JIT_BADOPTION	(-31)
+#define PCRE_ERROR_BADLENGTH		(-32)
+#define PCRE_ERROR_UNSET		(-33)
+
+#define PCRE_INFO_OPTIONS		0
+#define PCRE_INFO_SIZE			1
+#define PCRE_INFO_CAPTURECOUNT		2
+#define PCRE_INFO_BACKREFMAX		3
+#define PCRE_INFO_FIRSTBYTE		4
+#define PCRE_INFO_FIRSTCHAR		4
+#define PCRE_INFO_FIRSTTABLE		5
+#define PCRE_INFO_LASTLITERAL		6
+#define PCRE_INFO_NAMEENTRYSIZE		7
+#define PCRE_INFO_NAMECOUNT		8
+#define PCRE_INFO_NAMETABLE		9
+#define PCRE_INFO_STUDYSIZE		10
+#define PCRE_INFO_DEFAULT_TABLES	11
+#define PCRE_INFO_OKPARTIAL		12
+#define PCRE_INFO_JCHANGED		13
+#define PCRE_INFO_HASCRORLF		14
+#define PCRE_INFO_MINLENGTH		15
+#define PCRE_INFO_JIT			16
+#define PCRE_INFO_JITSIZE		17
+#define PCRE_INFO_MAXLOOKBEHIND		18
+#define PCRE_INFO_FIRSTCHARACTER	19
+#define PCRE_INFO_FIRSTCHARACTERFLAGS	20
+#define PCRE_INFO_REQUIREDCHAR		21
+#define PCRE_INFO_REQUIREDCHARFLAGS	22
+#define PCRE_INFO_MATCHLIMIT		23
+#define PCRE_INFO_RECURSIONLIMIT	24
+#define PCRE_INFO_MATCH_EMPTY		25
+
+#define PCRE_CONFIG_UTF8			0
+#define PCRE_CONFIG_NEWLINE			1
+#define PCRE_CONFIG_LINK_SIZE			2
+#define PCRE_CONFIG_POSIX_MALLOC_THRESHOLD	3
+#define PCRE_CONFIG_MATCH_LIMIT			4
+#define PCRE_CONFIG_STACKRECURSE		5
+#define PCRE_CONFIG_UNICODE_PROPERTIES		6
+#define PCRE_CONFIG_MATCH_LIMIT_RECURSION	7
+#define PCRE_CONFIG_BSR				8
+#define PCRE_CONFIG_JIT				9
+#define PCRE_CONFIG_UTF16			10
+#define PCRE_CONFIG_JITTARGET			11
+#define PCRE_CONFIG_UTF32			12
+#define PCRE_CONFIG_PARENS_LIMIT		13
+
+#define PCRE_STUDY_JIT_COMPILE			0x0001
+#define PCRE_STUDY_JIT_PARTIAL_SOFT_COMPILE	0x0002
+#define PCRE_STUDY_JIT_PARTIAL_HARD_COMPILE	0x0004
+#define PCRE_STUDY_EXTRA_NEEDED			0x0008
+
+#define PCRE_EXTRA_STUDY_DATA			0x0001
+#define PCRE_EXTRA_MATCH_LIMIT			0x0002
+#define PCRE_EXTRA_CALLOUT_DATA			0x0004
+#define PCRE_EXTRA_TABLES			0x0008
+#define PCRE_EXTRA_MATCH_LIMIT_RECURSION	0x0010
+#define PCRE_EXTRA_MARK				0x0020
+#define PCRE_EXTRA_EXECUTABLE_JIT		0x0040
+
+typedef pcre2_code pcre;
+typedef pcre2_jit_stack pcre_jit_stack;
+typedef pcre_jit_stack *(*pcre_jit_callback)(void *);
+
+typedef struct pcre_extra
+{
+    unsigned long flags;
+    void *study_data;
+    unsigned long match_limit;
+    void *callout_data;
+    const unsigned char *tables;
+    unsigned long match_limit_recursion;
+    unsigned char **mark;
+    void *executable_jit;
+    pcre_jit_callback jit_callback;
+    void *jit_callback_data;
+} pcre_extra;
+
+extern void *(*pcre_malloc)(size_t);
+extern void (*pcre_free)(void *);
+extern void *(*pcre_stack_malloc)(size_t);
+extern void (*pcre_stack_free)(void *);
+
+pcre *pcre_compile(const char *pattern, int options, const char **errptr,
+		   int *erroffset, const unsigned char *tables);
+pcre *pcre_compile2(const char *pattern, int options, int *errorcode,
+		    const char **errptr, int *erroffset,
+		    const unsigned char *tables);
+pcre_extra *pcre_study(const pcre *code, int options, const char **errptr);
+void pcre_free_study(pcre_extra *extra);
+int  pcre_exec(const pcre *code, const pcre_extra *extra,
+	       const char *subject, int length, int start_offset,
+	       int options, int *ovector, int ovecsize);
+int  pcre_dfa_exec(const pcre *code, const pcre_extra *extra,
+		   const char *subject, int length, int start_offset,
+		   int options, int *ovector, int ovecsize,
+		   int *workspace, int wscount);
+int  pcre_fullinfo(const pcre *code, const pcre_extra *extra, int what,
+		   void *where);
+int  pcre_config(int what, void *where);
+const char *pcre_version(void);
+int  pcre_get_stringnumber(const pcre *code, const char *name);
+pcre_jit_stack *pcre_jit_stack_alloc(int startsize, int maxsize);
+void pcre_jit_stack_free(pcre_jit_stack *stack);
+void pcre_assign_jit_stack(pcre_extra *extra, pcre_jit_callback callback,
+			   void *data);
+
+int  guile_pcre2_serialize(const pcre *code, unsigned char **bytes,
+			   size_t *size);
+pcre *guile_pcre2_deserialize(const unsigned char *bytes, size_t size);
+
+#endif
@@ -5,8 +5,11 @@
 	     (ice-9 regex)
 	     (ice-9 format)
 	     (ice-9 match)
+	     (ice-9 threads)
 	     (rnrs control)
+	     (rnrs bytevectors)
 	     (srfi srfi-1)
+	     (srfi srfi-4)
 	     (srfi srfi-69)
 	     (guile-pcre)
  	     (bohtner srfi-64))
@@ -41,12 +44,12 @@
 
 (test-assert "caseless match "
 	     (match
-	       (pcre-exec (make-pcre "abc" PCRE_CASELESS) "123ABC456")
+	       (pcre-exec/vector (make-pcre "abc" PCRE_CASELESS) "123ABC456")
 	       (#(string (3 . 6)) #t)
 	       (_ #f)))
 (test-assert "grouping match" 
 	     (match
-	       (pcre-exec (make-pcre
+	       (pcre-exec/vector (make-pcre
 			   "(\\w+)\\s+(\\w+)\\s+(\\w+)\\s+(\\w+)\\s+(\\w+)")
 			  "The quick brown fox jumped")
 	       (#(string (0 . 26) (0 . 3) (4 . 9) (10 . 15) (16 . 19) (20 . 26)) #t)
@@ -54,7 +57,7 @@
 
 (test-assert "jit compiled" 
 	     (match
-	       (pcre-exec (make-pcre
+	       (pcre-exec/vector (make-pcre
 			   "(\\w+)\\s+(\\w+)\\s+(\\w+)\\s+(\\w+)\\s+(\\w+)"
 			    PCRE_STUDY_JIT_COMPILE)
 			  "The quick brown fox jumped")
@@ -99,4 +102,499 @@
 		   (string=? (match:named m 'verb) "jumped")
 		   (not (match:named m 'xxx)))))
 
+(let ((re (make-pcre "\\d+")))
+  (test-equal "start offset" "456" (match:substring (pcre-exec re "12 456 89" 2)))
+  (test-equal "start offset keeps subject" '(3 6)
+	      (let ((m (pcre-exec re "12 456 89" 2)))
+		(list (match:start m) (match:end m))))
+  (test-assert "start offset past last match" (not (pcre-exec re "12 456 " 6)))
+  (test-equal "list matches" '("12" "456" "89")
+	      (map match:substring (pcre-list-matches re "12 456 89")))
+  (test-eqv "fold matches" 557
+	    (pcre-fold-matches re "12 456 89" 0
+			       (lambda (m sum)
+				 (+ sum (string->number (match:substring m)))))))
+(test-assert "exec flags"
+	     (not (pcre-exec (make-pcre "^abc") "abc" 0 PCRE_NOTBOL)))
+(test-equal "empty matches" '(0 1 2 3)
+	    (map match:start (pcre-list-matches (make-pcre "x*") "axb")))
+(test-equal "empty matches at crlf" '(0 2 4)
+	    (map match:start
+		 (pcre-list-matches (make-pcre "(*CRLF)") "\r\n\r\n")))
+
+(let* ((bv (string->utf8 "a\u00e9bbc"))
+       (m (pcre-exec/bytevector (make-pcre "b+") bv)))
+  (test-equal "bytevector byte offsets" '(3 5)
+	      (list (match:start m) (match:end m)))
+  (test-eq "bytevector subject" bv (match:string m))
+  (test-assert "bytevector via pcre-exec"
+	       (pcre-exec (make-pcre "c$") bv 5))
+  (test-assert "bytevector start offset"
+	       (not (pcre-exec (make-pcre "a") bv 1))))
+
+(test-equal "utf-8 substring" "caf\u00e9"
+	    (match:substring (pcre-exec (make-pcre "caf." PCRE_UTF8)
+					"\u65e5\u672c caf\u00e9!")))
+(test-equal "utf-8 start offset" 3
+	    (match:start (pcre-exec (make-pcre "\\d") "\u00e91\u00e92" 2)))
+(test-equal "utf-8 list matches" '("\u65e5\u672c" "\u00e9t\u00e9")
+	    (map match:substring
+		 (pcre-list-matches (make-pcre "\\S+" PCRE_UTF8)
+				    "\u65e5\u672c \u00e9t\u00e9")))
+(test-equal "latin-1 offsets" '(2 4)
+	    (let ((m (pcre-exec (make-pcre "\u00e9+" PCRE_UTF8) "ca\u00e9\u00e9 x")))
+	      (list (match:start m) (match:end m))))
+
+(pcre-cache-clear!)
+(let ((a (pcre-compile/cached "ca(che)" PCRE_CASELESS 0))
+      (b (pcre-compile/cached "ca(che)" PCRE_CASELESS 0))
+      (c (make-pcre/cached "ca(che)" PCRE_CASELESS)))
+  (test-eq "cache hit" a b)
+  (test-eq "cached make-pcre" a c)
+  (test-assert "cache keyed on flags"
+	       (not (eq? a (pcre-compile/cached "ca(che)" 0 0))))
+  (test-equal "cached regexp matches" "CHE"
+	      (match:substring (pcre-exec a "CaChE") 1))
+  (test-equal "cached regexp is fixed" '(pcre-error pcre-error pcre-error)
+	      (map (lambda (change)
+		     (catch #t (lambda () (change a)) (lambda (key . args) key)))
+		   (list (lambda (re) (pcre-study re PCRE_STUDY_JIT_COMPILE))
+			 (lambda (re) (pcre-set-match-limit! re 10))
+			 (lambda (re) (pcre-set-jit-stack! re 65536)))))
+  (test-equal "cached regexp keeps its limits" '(#f . #f) (pcre-limits a))
+  (test-equal "cache counters" '(2 2)
+	      (let ((stats (pcre-cache-stats)))
+		(list (assq-ref stats 'hits) (assq-ref stats 'misses))))
+  (pcre-set-cache-capacity! 1)
+  (test-equal "cache eviction" '(1 1)
+	      (let ((stats (pcre-cache-stats)))
+		(list (assq-ref stats 'size) (assq-ref stats 'evictions))))
+  (pcre-set-cache-capacity! 512))
+
+(define (literal-site) (make-pcre "lit(er)al" PCRE_CASELESS))
+(test-eq "literal pattern compiled once" (literal-site) (literal-site))
+(test-assert "literal pattern not shared between forms"
+	     (not (eq? (make-pcre "lit(er)al" PCRE_CASELESS)
+		       (make-pcre "lit(er)al" PCRE_CASELESS))))
+(test-equal "literal pattern flags" "ER"
+	    (match:substring (pcre-exec (literal-site) "LITERAL") 1))
+(test-assert "literal pattern error at expansion"
+	     (catch 'syntax-error
+	       (lambda () (eval '(lambda () (make-pcre "a(b")) (current-module)) #f)
+	       (lambda args #t)))
+(let ((PCRE_CASELESS 0))
+  (test-assert "literal pattern local flag"
+	       (not (pcre-exec (make-pcre "x" PCRE_CASELESS) "X")))
+  (test-assert "literal pattern local flags"
+	       (not (pcre-exec (make-pcre "x" PCRE_CASELESS PCRE_UTF8) "X"))))
+
+(let ((re (make-pcre "^(a+)+$")))
+  (test-equal "no limits" '(#f . #f) (pcre-limits re))
+  (pcre-set-match-limit! re 1000)
+  (test-equal "match limit set" '(1000 . #f) (pcre-limits re))
+  (test-equal "match limit exceeded" 'pcre-match-limit
+	      (catch #t
+		(lambda () (pcre-exec re (string-append (make-string 30 #\a) "!")))
+		(lambda (key . args) key)))
+  (pcre-set-match-limit! re #f)
+  (test-equal "per-call match limit" 'pcre-match-limit
+	      (catch #t
+		(lambda ()
+		  (call-with-pcre-limits 1000 #f
+		    (lambda () (pcre-exec re (string-append (make-string 30 #\a) "!")))))
+		(lambda (key . args) key)))
+  (test-assert "match within limits"
+	       (call-with-pcre-limits 1000 #f
+		 (lambda () (pcre-exec re "aa")))))
+
+(let ((re (make-pcre "(\\d+)(x)?")))
+  (test-assert "match? true" (pcre-match? re "abc 123 xyz"))
+  (test-assert "match? false" (not (pcre-match? re "abc xyz")))
+  (test-equal "match-span" '(4 7)
+	      (call-with-values (lambda () (pcre-match-span re "abc 123 xyz"))
+		list))
+  (test-equal "match-span character indices" '(2 4)
+	      (call-with-values (lambda () (pcre-match-span re "\u00e9\u00e9 12"))
+		list))
+  (test-equal "match-span no match" '(#f #f)
+	      (call-with-values (lambda () (pcre-match-span re "abc"))
+		list))
+  (let ((ovector (make-pcre-ovector re)))
+    (test-equal "exec! count" 2 (pcre-exec! re "abc 123 xyz" ovector))
+    (test-equal "exec! offsets" '(4 7 4 7 -1 -1)
+		(map (lambda (i) (s32vector-ref ovector i)) (iota 6)))
+    (test-equal "exec! no match" #f (pcre-exec! re "abc" ovector))))
+
+(let* ((re (make-pcre "(a)(b)?(?<tail>c)?"))
+       (m (pcre-exec re "xa")))
+  (test-assert "match object" (pcre-match-object? m))
+  (test-eq "match regexp" re (pcre-match->regexp m))
+  (test-equal "match count" 2 (match:count m))
+  (test-equal "trailing unset group" #f (match:substring m 3))
+  (test-equal "trailing unset named group" #f (match:named m "tail"))
+  (test-equal "match vector" #("xa" (1 . 2) (1 . 2))
+	      (pcre-match->vector m)))
+(test-equal "print bytevector match" "#<pcre-match #vu8(255 97)>"
+	    (format #f "~a" (pcre-exec (make-pcre "\\xffa")
+				       (u8-list->bytevector '(0 255 97)))))
+(let ((re (make-pcre "(?<year>\\d{4})-(?<month>\\d\\d)(-(?<day>\\d\\d))?")))
+  (test-equal "exec->captures" #("2024-05" "2024" "05" #f #f)
+	      (pcre-exec->captures re "on 2024-05"))
+  (test-equal "exec->alist" '((day . #f) (month . "05") (year . "2024"))
+	      (pcre-exec->alist re "on 2024-05"))
+  (test-equal "exec->captures no match" #f
+	      (pcre-exec->captures re "none")))
+(test-equal "exec->captures characters" #("\u00e91" "1")
+	    (pcre-exec->captures (make-pcre "\u00e9(\\d)") "a\u00e91"))
+(test-equal "exec->captures bytevector" (vector #vu8(98 99) #vu8(99))
+	    (pcre-exec->captures (make-pcre "b(c)") (string->utf8 "abc")))
+(test-equal "exec->alist duplicate names" '((n . "b"))
+	    (pcre-exec->alist (make-pcre "(?<n>a)|(?<n>b)" PCRE_DUPNAMES)
+			      "b"))
+(test-equal "bytevector substring" "\u00e9b"
+	    (match:substring (pcre-exec (make-pcre "\xc3\xa9b")
+					(string->utf8 "a\u00e9bc"))))
+(test-equal "ice-9 regex matches" "b"
+	    (match:substring (string-match "b" "abc")))
+
+(let ((m (pcre-dfa-exec (make-pcre "<.*>") "x <a> <b>")))
+  (test-equal "dfa alternatives" '("<a> <b>" "<a>")
+	      (list (match:substring m 0) (match:substring m 1)))
+  (test-equal "dfa start" 2 (match:start m))
+  (test-equal "dfa no regexp" #f (pcre-match->regexp m)))
+(test-equal "dfa shortest" "<a>"
+	    (match:substring (pcre-dfa-exec (make-pcre "<.*>") "<a> <b>" 0 #f
+					    PCRE_DFA_SHORTEST)))
+(let ((re (make-pcre "abc\\d+"))
+      (ws (make-pcre-dfa-workspace)))
+  (test-eq "dfa partial" 'partial
+	   (pcre-dfa-exec re "xxab" 0 ws PCRE_PARTIAL_SOFT))
+  (test-equal "dfa restart" "c12"
+	      (match:substring (pcre-dfa-exec re "c12" 0 ws
+					      PCRE_PARTIAL_SOFT
+					      PCRE_DFA_RESTART))))
+
+(define (port-matches pattern text chunk-size)
+  (reverse!
+   (pcre-fold-port (make-pcre pattern) (open-input-string text) '()
+		   (lambda (m prev)
+		     (cons (list (match:substring m) (match:start m)) prev))
+		   chunk-size)))
+(test-equal "port matches across chunks" '(("12345" 4) ("678" 14))
+	    (port-matches "\\d+" "abc 12345 def 678" 4))
+(test-equal "port line start at chunk boundary" '(("foo" 4))
+	    (port-matches "(?m)^foo" "bar\nfoo" 4))
+(test-equal "port word boundary across chunks" '()
+	    (port-matches "\\bfoo" "xfoo" 1))
+(test-equal "port lookbehind across chunks" '(("bar" 5))
+	    (port-matches "(?<=foo)bar" "xxfoobar" 3))
+(test-equal "port anchored at stream start" '(("ab" 0))
+	    (port-matches "^ab" "abab" 2))
+(test-equal "port empty matches" '(0 1 2)
+	    (map cadr (port-matches "x*" "ab" 1)))
+
+(let ((set (make-pcre-set (list "error" "warn(ing)?"
+				(list "^debug" PCRE_CASELESS)
+				(make-pcre "x*")
+				"\\d{5}"))))
+  (test-assert "pcre-set?" (pcre-set? set))
+  (test-equal "set match" '(1 2 3) (pcre-set-match set "DEBUG: warning"))
+  (test-equal "set caseless key" '(2 3) (pcre-set-match set "Debug"))
+  (test-equal "set min length" '(3) (pcre-set-match set "1234"))
+  (test-equal "set exec" '((0 . "error") (3 . ""))
+	      (map (lambda (p) (cons (car p) (match:substring (cdr p))))
+		   (pcre-set-exec set "an error"))))
+
+(let ((set (make-pcre-set (list "key1=\\d" "key2=\\d" "y2=" "x(ab)?yz"))))
+  (test-equal "set literals" '(1 2) (pcre-set-match set "akey2=7"))
+  (test-equal "set literal at end" '(3) (pcre-set-match set "xxyz"))
+  (test-equal "set repeated literal" '(0 2)
+	      (pcre-set-match set "key1=1 key1=y2= key1=")))
+
+(let ((re (make-pcre "ERROR: \\d+" GUILE_PCRE_STUDY_PREFILTER)))
+  (test-equal "prefilter literal" "ERROR: "
+	      (assq-ref (pcre-prefilter-stats re) 'literal))
+  (test-assert "prefilter rejects" (not (pcre-match? re "ERROR 42")))
+  (test-assert "prefilter passes" (pcre-match? re "x ERROR: 42"))
+  (test-equal "prefilter from start" #f (pcre-exec re "ERROR: 1 ok" 3))
+  (test-equal "prefilter fold" '("ERROR: 1" "ERROR: 22")
+	      (map match:substring (pcre-list-matches re "ERROR: 1 ERROR: 22 x")))
+  (test-equal "prefilter counts" '(3 3)
+	      (let ((stats (pcre-prefilter-stats re)))
+		(list (assq-ref stats 'rejects) (assq-ref stats 'passes)))))
+(test-equal "prefilter optional" "colr"
+	    (match:substring (pcre-exec (make-pcre "colou?r" GUILE_PCRE_STUDY_PREFILTER)
+					"colr")))
+(test-equal "no prefilter" #f (pcre-prefilter-stats (make-pcre "abc")))
+
+(let* ((re (make-pcre "(\\w+)@(\\w+)" PCRE_STUDY_JIT_COMPILE))
+       (subjects (list-tabulate 1000
+				(lambda (i)
+				  (case (modulo i 3)
+				    ((0) (format #f "\u00e9~a@host~a" i i))
+				    ((1) (string->utf8 (format #f "u~a@h" i)))
+				    (else "nobody")))))
+       (expected (map (lambda (s) (pcre-exec re s)) subjects)))
+  (pcre-set-jit-stack! re (* 64 1024))
+  (test-equal "batch matches" (map (lambda (m) (and m (match:substring m 2)))
+				   expected)
+	      (map (lambda (m) (and m (match:substring m 2)))
+		   (vector->list (pcre-exec-batch re subjects 'match 4))))
+  (test-equal "batch offsets" (map (lambda (m) (and m (match:start m 1)))
+				   expected)
+	      (map (lambda (m) (and m (match:start m 1)))
+		   (vector->list (pcre-exec-batch re (list->vector subjects)))))
+  (test-equal "batch booleans" (map ->bool expected)
+	      (vector->list (pcre-exec-batch re subjects 'boolean 3)))
+  (test-equal "batch indices" (filter (lambda (i) (not (= 2 (modulo i 3))))
+				      (iota 1000))
+	      (pcre-exec-batch re subjects 'index)))
+(test-equal "batch empty" #() (pcre-exec-batch (make-pcre "a") '()))
+(test-equal "batch limits" 'pcre-match-limit
+	    (catch #t
+	      (lambda ()
+		(call-with-pcre-limits 1000 #f
+		  (lambda ()
+		    (pcre-exec-batch (make-pcre "^(a+)+$")
+				     (list (string-append (make-string 30 #\a) "!"))
+				     'boolean))))
+	      (lambda (key . args) key)))
+
+;;; While one thread matches 100 MB, another should still be able to
+;;; allocate and collect.  The match is known to have left Guile mode
+;;; by the count of detached calls; how many collections the other
+;;; thread fits in meanwhile depends on the machine.
+(define (detached-calls) (assq-ref (pcre-stats) 'detached-calls))
+(let* ((subject (make-bytevector (* 100 1024 1024) (char->integer #\a)))
+       (before (detached-calls))
+       (done #f)
+       (matcher (call-with-new-thread
+		 (lambda ()
+		   (let ((rv (pcre-match? (make-pcre "^[ab]*$") subject)))
+		     (set! done #t)
+		     rv)))))
+  (let loop ()
+    (unless done
+      (make-vector 1000 #f)
+      (gc)
+      (loop)))
+  (test-assert "large match" (join-thread matcher))
+  (test-equal "large match detached" (1+ before) (detached-calls)))
+(let ((before (detached-calls)))
+  (pcre-match? (make-pcre "^[ab]*$") (make-string 1000 #\a))
+  (test-equal "small match stays in guile mode" before (detached-calls)))
+
+(let* ((re (make-pcre "(?<year>\\d{4})-(?<month>\\d\\d)" PCRE_STUDY_JIT_COMPILE))
+       (copy (bytevector->pcre (pcre->bytevector re))))
+  (test-assert "reloaded pcre" (pcre? copy))
+  (test-equal "reloaded match" "2024-05"
+	      (match:substring (pcre-exec copy "on 2024-05-17")))
+  (test-equal "reloaded names" "05"
+	      (match:named (pcre-exec copy "on 2024-05-17") 'month)))
+(let* ((re (make-pcre "(?<year>\\d{4})-(?<month>\\d\\d)" PCRE_CASELESS))
+       (image (pcre->bytevector re))
+       (code (- (bytevector-length image) 8)))
+  (test-equal "verified reload" "05"
+	      (match:named (pcre-exec (bytevector->pcre image #t) "on 2024-05")
+			   'month))
+  (bytevector-u8-set! image code (logxor (bytevector-u8-ref image code) 255))
+  (test-equal "verified reload ignores code" "2024-05"
+	      (match:substring (pcre-exec (bytevector->pcre image #t)
+					  "on 2024-05"))))
+(test-equal "bad compiled pattern" 'pcre-error
+	    (catch #t
+	      (lambda () (bytevector->pcre (make-bytevector 100 0)))
+	      (lambda (key . args) key)))
+(let ((file (tmpnam)))
+  (pcre-write-bundle file (list (make-pcre "\\d+")
+				(make-pcre "ERROR: \\w+" GUILE_PCRE_STUDY_PREFILTER)))
+  (let ((bundle (pcre-load-bundle file)))
+    (delete-file file)
+    (test-equal "bundle size" 2 (vector-length bundle))
+    (test-equal "bundle match" "42"
+		(match:substring (pcre-exec (vector-ref bundle 0) "x 42")))
+    (test-equal "bundle prefilter" "ERROR: "
+		(assq-ref (pcre-prefilter-stats (vector-ref bundle 1))
+			  'literal))))
+
+(let ((re (make-pcre "\\d+" GUILE_PCRE_STUDY_JIT_LAZY)))
+  (pcre-set-lazy-jit-threshold! 5 #f)
+  (test-eq "lazy jit pending" 'pending (assq-ref (pcre-stats re) 'jit))
+  (do ((i 0 (1+ i))) ((= i 4)) (pcre-exec re "abc 123"))
+  (test-equal "lazy jit counts" 4
+	      (assq-ref (pcre-stats re) 'interpreted-calls))
+  (test-equal "lazy jit match" "123"
+	      (match:substring (pcre-exec re "abc 123")))
+  (test-equal "lazy jit promoted" (pcre-config PCRE_CONFIG_JIT)
+	      (assq-ref (pcre-stats re) 'jit))
+  (test-equal "lazy jit after promotion" "456"
+	      (match:substring (pcre-exec re "x 456")))
+  (pcre-set-lazy-jit-threshold! 100 1000000))
+
+(let ((re (make-pcre "(\\d+)"))
+      (other (make-pcre "x")))
+  (pcre-reset-stats!)
+  (pcre-set-instrumentation! #t)
+  (pcre-exec re "abc 123")
+  (pcre-exec re "abc")
+  (pcre-match? re "9")
+  (pcre-exec other "x")
+  (pcre-set-instrumentation! #f)
+  (pcre-exec re "456")
+  (let ((stats (pcre-stats re)))
+    (test-equal "instrumented calls" 3 (assq-ref stats 'calls))
+    (test-equal "instrumented matches" 2 (assq-ref stats 'matches))
+    (test-equal "instrumented no-matches" 1 (assq-ref stats 'no-matches))
+    (test-equal "instrumented bytes" 11 (assq-ref stats 'subject-bytes))
+    (test-equal "instrumented histogram" 3
+		(apply + (vector->list (assq-ref stats 'histogram)))))
+  (test-equal "global calls" 4 (assq-ref (pcre-stats) 'calls))
+  (test-assert "top stats" (memq re (map car (pcre-top-stats 10))))
+  (pcre-reset-stats!)
+  (test-equal "reset stats" 0 (assq-ref (pcre-stats re) 'calls)))
+
+(let ((re (make-pcre "(?<user>\\w+)@(\\w+)")))
+  (test-equal "substitute" "mail bob at host, ann@box"
+	      (pcre-substitute re "mail bob@host, ann@box" "$1 at ${2}"))
+  (test-equal "substitute all" "<bob> <ann>"
+	      (pcre-substitute-all re "bob@host ann@box" "<${user}>"))
+  (test-equal "substitute dollar" "$5"
+	      (pcre-substitute-all (make-pcre "\\d") "5" "$$$0"))
+  (test-equal "substitute utf-8" "été ab->x ü"
+	      (pcre-substitute-all re "été ab@x ü" "$1->$2"))
+  (test-equal "substitute bytevector" (string->utf8 "[a]")
+	      (pcre-substitute re (string->utf8 "a@b") "[$1]"))
+  (test-equal "substitute compiled" "B"
+	      (pcre-substitute re "a@B" (pcre-compile-template re "$2")))
+  (test-equal "substitute no match" "none"
+	      (pcre-substitute-all re "none" "$1"))
+  (test-equal "substitute bad group" 'pcre-error
+	      (catch #t
+		(lambda () (pcre-compile-template re "$3"))
+		(lambda (key . args) key)))
+  (test-equal "substitute bad name" 'pcre-error
+	      (catch #t
+		(lambda () (pcre-compile-template re "${host}"))
+		(lambda (key . args) key))))
+(test-equal "substitute procedure" "2 4 6"
+	    (pcre-substitute-all (make-pcre "\\d+") "1 2 3"
+				 (lambda (m)
+				   (number->string
+				    (* 2 (string->number (match:substring m)))))))
+(test-equal "substitute empty matches" "-a-b-"
+	    (pcre-substitute-all (make-pcre "x*") "ab" "-"))
+
+(test-equal "split" '("a" "b" "" "c")
+	    (pcre-split (make-pcre ",\\s*") "a, b,,c"))
+(test-equal "split limit" '("a" "b,,c")
+	    (pcre-split (make-pcre ",\\s*") "a, b,,c" 2))
+(test-equal "split groups" '("1" "-" #f "2" #f "+" "3")
+	    (pcre-split (make-pcre "(-)|(\\+)") "1-2+3" #f #t))
+(test-equal "split utf-8" '("été" "ça" "")
+	    (pcre-split (make-pcre ";") "été;ça;"))
+(test-equal "split no match" '("abc") (pcre-split (make-pcre ",") "abc"))
+(test-equal "tokenize" '((2 0 . 2) (3 2 . 3) (1 3 . 5))
+	    (pcre-tokenize (make-pcre "(\\d+)|([a-z]+)|(\\s+)") "ab 12"))
+(test-equal "tokenize stuck" 'pcre-error
+	    (catch #t
+	      (lambda () (pcre-tokenize (make-pcre "(\\d+)|(\\s+)") "1 x"))
+	      (lambda (key . args) key)))
+
+(let* ((re (make-pcre "(a|b)+c"))
+       (stats (pcre-memory-stats re)))
+  (test-assert "memory code" (> (assq-ref stats 'code) 0))
+  (test-assert "memory total" (>= (assq-ref (pcre-memory-stats) 'code)
+				  (assq-ref stats 'code)))
+  (test-assert "memory heap" (>= (assq-ref (pcre-memory-stats) 'heap)
+				 (assq-ref stats 'code)))
+  (pcre-study re PCRE_STUDY_JIT_COMPILE)
+  (test-equal "memory jit" (pcre-config PCRE_CONFIG_JIT)
+	      (> (assq-ref (pcre-memory-stats re) 'jit) 0)))
+
+(let ((re (make-pcre "(\\p{Han}+)(\\d*)" PCRE_UTF8 PCRE_UCP)))
+  (test-equal "wide match" '(2 . 4)
+	      (let ((m (pcre-exec re "ab日本12")))
+		(cons (match:start m) (match:end m 1))))
+  (test-equal "wide substring" "本"
+	      (match:substring (pcre-exec re "x日本" 2) 1))
+  (test-equal "latin-1 subject" 3
+	      (match:start (pcre-exec (make-pcre "é+" PCRE_UTF8) "cafée")))
+  (test-equal "ascii subject" "42"
+	      (match:substring (pcre-exec (make-pcre "\\d+") "abc 42")))
+  (test-equal "wide fold" '(6 1)
+	      (pcre-fold-matches re "a日本1 b中 c" '()
+				 (lambda (m acc)
+				   (cons (match:start m) acc))))
+  (test-equal "wide substitute" "a<日本1> b<中> c"
+	      (pcre-substitute-all re "a日本1 b中 c" "<$1$2>"))
+  (test-equal "wide split" '("日" "中" "")
+	      (pcre-split (make-pcre "本" PCRE_UTF8) "日本中本"))
+  (test-equal "wide batch" '(1)
+	      (pcre-exec-batch re (list "abc" "x日") 'index))
+  (test-assert "byte mode dot"
+	       (not (pcre-exec (make-pcre "^.$") "é"))))
+
+(let ((re (make-pcre "^b" PCRE_MULTILINE PCRE_NEWLINE_CR)))
+  (test-equal "exec newline as compiled" 2
+	      (match:start (pcre-exec re "a\rb" 0 PCRE_NEWLINE_CR)))
+  (test-equal "exec newline not compiled" 'pcre-error
+	      (catch #t
+		(lambda () (match:start (pcre-exec re "a\nb" 0 PCRE_NEWLINE_LF)))
+		(lambda (key . args) key)))
+  (test-equal "exec bsr not compiled" 'pcre-error
+	      (catch #t
+		(lambda ()
+		  (pcre-exec (make-pcre "a\\Rb" PCRE_BSR_UNICODE) "a\nb" 0
+			     PCRE_BSR_ANYCRLF))
+		(lambda (key . args) key)))
+  (test-equal "exec no start optimize" 1
+	      (match:start (pcre-exec (make-pcre "b") "abc" 0
+				      PCRE_NO_START_OPTIMIZE))))
+
+(define (grep-lines re file . args)
+  (reverse!
+   (apply pcre-grep-file re file '()
+	  (lambda (n line m prev) (cons (list n line (match:start m)) prev))
+	  args)))
+(let ((file (tmpnam)))
+  (with-output-to-file file
+    (lambda ()
+      (display "first\nan error here\nfine\nerror: and error\nlast error")))
+  (test-equal "grep lines" '((2 "an error here" 3)
+			     (4 "error: and error" 0)
+			     (5 "last error" 5))
+	      (grep-lines (make-pcre "error") file))
+  (test-equal "grep multiline anchor" '((4 "error: and error" 0))
+	      (grep-lines (make-pcre "^error" PCRE_MULTILINE) file))
+  (test-equal "grep match across lines" '((2 "an error here\nfine" 9))
+	      (grep-lines (make-pcre "here\\s+fine") file))
+  (delete-file file))
+(let ((file (tmpnam)))
+  (with-output-to-file file
+    (lambda ()
+      (do ((i 1 (1+ i))) ((> i 20000))
+	(simple-format #t "line ~A ~A of hay\n" i
+		       (if (zero? (modulo i 97)) "needle" "straw")))))
+  (test-equal "grep threaded"
+	      (grep-lines (make-pcre "needle") file)
+	      (grep-lines (make-pcre "needle") file 4))
+  (test-equal "grep threaded line numbers" (iota 206 97 97)
+	      (map car (grep-lines (make-pcre "needle") file 4)))
+  (test-equal "grep threaded match across ranges"
+	      (grep-lines (make-pcre "hay\nline") file)
+	      (grep-lines (make-pcre "hay\nline") file 4))
+  (let ((re (make-pcre "needle")))
+    (pcre-study re PCRE_STUDY_JIT_COMPILE)
+    (test-equal "grep threaded jit" (iota 206 97 97)
+		(map car (grep-lines re file 4))))
+  (delete-file file))
+(let ((file (tmpnam)))
+  (with-output-to-file file
+    (lambda ()
+      (set-port-encoding! (current-output-port) "UTF-8")
+      (display "naïve café\n")))
+  (test-equal "grep utf-8 line" '((1 "naïve café" 6))
+	      (grep-lines (make-pcre "caf") file))
+  (delete-file file))
+
 (test-end "pcre-unit-test")